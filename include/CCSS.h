@@ -1,15 +1,24 @@
 #ifndef CCSS_H
 #define CCSS_H
 
-#include <CCSSTagData.h>
+#include <CCSSTagNode.h>
 
 #include <string>
-#include <map>
+#include <string_view>
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <cstdint>
 #include <iostream>
 #include <sstream>
 #include <sys/types.h>
 
-class CStrParse;
+class CCSSTokenizer;
 
 //------
 
@@ -29,6 +38,12 @@ class CCSS {
   };
 
   typedef std::vector<std::string> Names;
+  typedef CCSSAtoms                Atoms;
+
+  // combine hash value into hash
+  static void hashCombine(std::size_t &h, std::size_t v) {
+    h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2);
+  }
 
   //---
 
@@ -63,6 +78,16 @@ class CCSS {
       return s1.cmp(s2) < 0;
     }
 
+    // single integer with same ordering as cmp (8 bits per part, clamped)
+    uint packed() const {
+      uint p = 0;
+
+      for (int i = 0; i < 4; ++i)
+        p = (p << 8) | uint(std::min(std::max(value_[i], 0), 255));
+
+      return p;
+    }
+
     void print(std::ostream &os) const {
       for (int i = 0; i < 4; ++i) {
         if (i > 0) os << ",";
@@ -83,44 +108,21 @@ class CCSS {
 
   //---
 
-  // Selector id (name and next type)
-  struct Id {
-    std::string id;
-    NextType    nextType { NextType::NONE };
-
-    int cmp(const Id &rhs) const {
-      if (id < rhs.id) return -1;
-      if (id > rhs.id) return  1;
-
-      if (nextType < rhs.nextType) return -1;
-      if (nextType > rhs.nextType) return  1;
-
-      return 0;
-    }
-
-    friend bool operator<(const Id &id1, const Id &id2) {
-      return id1.cmp(id2) < 0;
-    }
-
-    friend bool operator==(const Id &id1, const Id &id2) {
-      return id1.cmp(id2) == 0;
-    }
-  };
-
-  typedef std::vector<Id>     IdList;
-  typedef std::vector<IdList> IdListList;
-
-  //---
-
   class Expr {
    public:
-    explicit Expr(const std::string &str) {
+    explicit Expr(std::string_view str) {
       init(str);
     }
 
-    void init(const std::string &str);
+    Expr(const CCSSAtom &id, CCSSAttributeOp op, const std::string &value) :
+     id_(id), op_(op), value_(value) {
+    }
+
+    void init(std::string_view str);
+
+    const std::string &id() const { return id_.str(); }
 
-    const std::string &id() const { return id_; }
+    const CCSSAtom &idAtom() const { return id_; }
 
     const CCSSAttributeOp &op() const { return op_; }
 
@@ -172,7 +174,7 @@ class CCSS {
     }
 
    private:
-    std::string     id_;
+    CCSSAtom        id_;
     CCSSAttributeOp op_ { CCSSAttributeOp::NONE };
     std::string     value_;
   };
@@ -181,6 +183,95 @@ class CCSS {
 
   //---
 
+  // compiled An+B expression of nth-child style function.
+  // matches 1-based index i if i = A*n + B for some n >= 0
+  class NthExpr {
+   public:
+    NthExpr(int a=0, int b=0) :
+     a_(a), b_(b) {
+    }
+
+    int a() const { return a_; }
+    int b() const { return b_; }
+
+    // parse An+B, odd, even or integer
+    static bool parse(std::string_view str, NthExpr &expr);
+
+    bool isMatch(int i) const {
+      if (a_ == 0)
+        return (i == b_);
+
+      // wide difference so large A and B can't overflow
+      int64_t d = int64_t(i) - b_;
+
+      return (d % a_ == 0 && d / a_ >= 0);
+    }
+
+   private:
+    int a_ { 0 };
+    int b_ { 0 };
+  };
+
+  // selector (pseudo class) function type
+  enum class FunctionType {
+    UNKNOWN,          // not supported (ignored when matching)
+    BAD_EXPR,         // nth function with invalid expression (never matches)
+    NTH_CHILD,
+    NTH_LAST_CHILD,
+    NTH_OF_TYPE,
+    NTH_LAST_OF_TYPE,
+    FIRST_CHILD,
+    LAST_CHILD,
+    ONLY_CHILD,
+    FIRST_OF_TYPE,
+    LAST_OF_TYPE,
+    ONLY_OF_TYPE,
+    ROOT,
+    REQUIRED,
+    INVALID
+  };
+
+  // selector function classified (and nth expression compiled) at parse time
+  class Function {
+   public:
+    Function() { }
+
+    explicit Function(std::string_view str) {
+      init(str);
+    }
+
+    // already classified function (e.g. from precompiled binary file)
+    Function(FunctionType type, const NthExpr &nthExpr) :
+     type_(type), nthExpr_(nthExpr) {
+    }
+
+    void init(std::string_view str);
+
+    FunctionType type() const { return type_; }
+
+    const NthExpr &nthExpr() const { return nthExpr_; }
+
+    bool isSupported() const { return (type_ != FunctionType::UNKNOWN); }
+
+    // true if depends on tag's siblings (nth, first, last and only functions)
+    bool isSiblingSensitive() const {
+      return (type_ >= FunctionType::NTH_CHILD && type_ <= FunctionType::ONLY_OF_TYPE);
+    }
+
+    // check tag of adapter's tree matches (defined in CCSSMatch.h)
+    template<typename Adapter>
+    bool checkMatch(const Adapter &adapter, const typename Adapter::Node &node,
+                    const CCSSAtom &typeName) const;
+
+   private:
+    FunctionType type_ { FunctionType::UNKNOWN };
+    NthExpr      nthExpr_;
+  };
+
+  typedef std::vector<Function> Functions;
+
+  //---
+
   // data for parse of id into type, class names, expressions and functions
   struct SelectorData {
     std::string name;
@@ -199,9 +290,21 @@ class CCSS {
      name_(name), value_(value), important_(important) {
     }
 
-    const std::string &getName () const { return name_ ; }
+    Option(const CCSSAtom &name, const std::string &value, bool important=false) :
+     name_(name), value_(value), important_(important) {
+    }
+
+    const std::string &getName () const { return name_.str(); }
     const std::string &getValue() const { return value_; }
 
+    const CCSSAtom &nameAtom() const { return name_; }
+
+    bool isImportant() const { return important_; }
+
+    // source order of declaration in stylesheet
+    uint order() const { return order_; }
+    void setOrder(uint i) { order_ = i; }
+
     void printStyle(std::ostream &os) const {
       os << name_ << "=\"" << value_;
 
@@ -234,9 +337,10 @@ class CCSS {
     }
 
    private:
-    std::string name_;
+    CCSSAtom    name_;
     std::string value_;
     bool        important_ { false };
+    uint        order_     { 0 };
   };
 
   typedef std::vector<Option> OptionList;
@@ -248,45 +352,75 @@ class CCSS {
    public:
     Selector() { }
 
-    const std::string &name() const { return name_; }
-    void setName(const std::string &v) { name_ = v; }
+    const std::string &name() const { return name_.str(); }
+    void setName(const std::string &v) { name_ = CCSSAtom(v); updateSpecificity(); }
+    void setName(const CCSSAtom &v) { name_ = v; updateSpecificity(); }
+
+    const CCSSAtom &nameAtom() const { return name_; }
 
-    const Names &idNames() const { return idNames_; }
-    void setIdNames(const Names &v) { idNames_ = v; }
+    bool isUniversal() const { return (name_.empty() || name_ == universalAtom()); }
 
-    const Names &classNames() const { return classNames_; }
-    void setClassNames(const Names &v) { classNames_ = v; }
+    const Atoms &idNames() const { return idNames_; }
+    void setIdNames(const Names &v) { idNames_ = toAtoms(v); updateSpecificity(); }
+    void setIdNames(const Atoms &v) { idNames_ = v; updateSpecificity(); }
+
+    const Atoms &classNames() const { return classNames_; }
+    void setClassNames(const Names &v) { classNames_ = toAtoms(v); updateSpecificity(); }
+    void setClassNames(const Atoms &v) { classNames_ = v; updateSpecificity(); }
 
     const Exprs &expressions() const { return exprs_; }
-    void setExpressions(const Exprs &v) { exprs_ = v; }
+    void setExpressions(const Exprs &v) { exprs_ = v; updateSpecificity(); }
 
     const Names &functions() const { return fns_; }
-    void setFunctions(const Names &v) { fns_ = v; }
+    void setFunctions(const Names &v) { fns_ = v; updateSpecificity(); compileFunctions(); }
+
+    // classified function for each function
+    const Functions &compiledFunctions() const { return compiledFns_; }
+
+    // true if selector only checks element, id and class names (so has the same
+    // result for tags with the same names)
+    bool isNamesOnly() const;
 
     const NextType &nextType() const { return nextType_; }
     void setNextType(const NextType &v) { nextType_ = v; }
 
-    Specificity specificity() const {
-      Specificity s;
+    // specificity (updated when selector parts are set)
+    const Specificity &specificity() const { return specificity_; }
 
-      if (name_ != "" && name_ != "*")
-        s.addElement();
+    bool checkMatch(const CCSSTagDataP &data) const;
 
-      s.addId   (int(idNames   ().size()));
-      s.addClass(int(classNames().size()));
+    bool checkMatch(const CCSSTagNode &node) const;
 
-      s.addClass(int(exprs_.size()));
+    // check tag of adapter's tree matches (defined in CCSSMatch.h)
+    template<typename Adapter>
+    bool checkMatch(const Adapter &adapter, const typename Adapter::Node &node) const;
 
-      s.addClass(int(fns_.size()));
+    std::size_t hash() const {
+      std::size_t h = name_.id();
 
-      return s;
-    }
+      for (const auto &idName : idNames_)
+        hashCombine(h, idName.id());
 
-    bool checkMatch(const CCSSTagDataP &data) const;
+      for (const auto &className : classNames_)
+        hashCombine(h, className.id());
+
+      for (const auto &expr : exprs_) {
+        hashCombine(h, expr.idAtom().id());
+        hashCombine(h, std::size_t(expr.op()));
+        hashCombine(h, std::hash<std::string>()(expr.value()));
+      }
+
+      for (const auto &fn : fns_)
+        hashCombine(h, std::hash<std::string>()(fn));
+
+      hashCombine(h, std::size_t(nextType_));
+
+      return h;
+    }
 
     int cmp(const Selector &selector) const {
-      if (name() < selector.name()) return -1;
-      if (name() > selector.name()) return  1;
+      if (name_ < selector.name_) return -1;
+      if (name_ > selector.name_) return  1;
 
       //---
 
@@ -331,7 +465,7 @@ class CCSS {
 
       if (fns_.size() != selector.fns_.size()) {
         if (fns_.size() < selector.fns_.size()) return -1;
-        if (fns_.size() < selector.fns_.size()) return  1;
+        if (fns_.size() > selector.fns_.size()) return  1;
       }
       else {
         for (std::size_t i = 0; i < fns_.size(); ++i) {
@@ -441,12 +575,48 @@ class CCSS {
     }
 
    private:
-    std::string name_;                        // tag name
-    Names       idNames_;                     // id names
-    Names       classNames_;                  // class name
+    void compileFunctions();
+
+    void updateSpecificity() {
+      Specificity s;
+
+      if (! isUniversal())
+        s.addElement();
+
+      s.addId   (int(idNames   ().size()));
+      s.addClass(int(classNames().size()));
+
+      s.addClass(int(exprs_.size()));
+
+      s.addClass(int(fns_.size()));
+
+      specificity_ = s;
+    }
+
+    static const CCSSAtom &universalAtom() {
+      static CCSSAtom atom("*");
+
+      return atom;
+    }
+
+    static Atoms toAtoms(const Names &names) {
+      Atoms atoms;
+
+      for (const auto &name : names)
+        atoms.push_back(CCSSAtom(name));
+
+      return atoms;
+    }
+
+   private:
+    CCSSAtom    name_;                        // tag name
+    Atoms       idNames_;                     // id names
+    Atoms       classNames_;                  // class name
     Exprs       exprs_;                       // expressions
     Names       fns_;                         // functions
+    Functions   compiledFns_;                 // classified functions
     NextType    nextType_ { NextType::NONE }; // next selector type
+    Specificity specificity_;                 // specificity of parts
   };
 
   //---
@@ -463,17 +633,18 @@ class CCSS {
 
     void addSelector(const Selector &selector) {
       selectors_.push_back(selector);
-    }
-
-    Specificity specificity() const {
-      Specificity s;
 
-      for (const auto &selector : selectors_)
-        s+= selector.specificity();
+      hashCombine(hash_, selector.hash());
 
-      return s;
+      specificity_ += selector.specificity();
     }
 
+    // hash of all selectors (updated as selectors are added)
+    std::size_t hash() const { return hash_; }
+
+    // sum of selector specificities (updated as selectors are added)
+    const Specificity &specificity() const { return specificity_; }
+
     bool checkMatch(const CCSSTagDataP &data) const;
 
     int cmp(const SelectorList &selectorList) const {
@@ -493,6 +664,8 @@ class CCSS {
     }
 
     friend bool operator==(const SelectorList &s1, const SelectorList &s2) {
+      if (s1.hash_ != s2.hash_) return false;
+
       return s1.cmp(s2) == 0;
     }
 
@@ -509,7 +682,317 @@ class CCSS {
     }
 
    private:
-    Selectors selectors_;
+    Selectors   selectors_;
+    std::size_t hash_ { 0 };
+    Specificity specificity_;
+  };
+
+  typedef std::vector<SelectorList> SelectorLists;
+
+  //---
+
+  // counting bloom filter of the names (element, ids and classes) of the
+  // ancestors of the tag being matched. A name not in the filter is definitely
+  // not on an ancestor so rules needing it can be rejected without walking the tree
+  class AncestorFilter {
+   public:
+    AncestorFilter() { }
+
+    // add names of tag (returns false if tag has no names)
+    bool push(const CCSSTagData &data);
+    bool push(const CCSSTagNode &node);
+
+    // add names (null if tag has no names)
+    bool pushNames(const CCSSTagNames *names);
+
+    // remove names of last pushed tag
+    void pop();
+
+    void clear();
+
+    // number of pushed tags
+    uint depth() const { return uint(frames_.size()); }
+
+    // false if any pushed tag has no names (filter can't reject anything)
+    bool isValid() const { return numUnnamed_ == 0; }
+
+    // check if name hash may be in filter (false if definitely not)
+    bool mayContain(uint hash) const {
+      return (counts_[hash1(hash)] && counts_[hash2(hash)]);
+    }
+
+   private:
+    enum { NUM_BITS = 12, SIZE = 1<<NUM_BITS, MASK = SIZE - 1 };
+
+    static uint hash1(uint hash) { return hash & MASK; }
+    static uint hash2(uint hash) { return (hash >> 16) & MASK; }
+
+    void add   (uint hash);
+    void remove(uint hash);
+
+   private:
+    struct Frame {
+      std::size_t start { 0 };     // start of tag hashes in hashes_
+      bool        named { true };  // tag has names
+    };
+
+    typedef std::vector<Frame> Frames;
+    typedef std::vector<uint>  Hashes;
+
+    // counts saturate at max value and are then never decremented
+    uint8_t counts_[SIZE] = {};
+    Hashes  hashes_;
+    Frames  frames_;
+    uint    numUnnamed_ { 0 };
+  };
+
+  //---
+
+  // rule sort keys (see StyleData::sortKey)
+  typedef std::vector<uint64_t> RuleKeys;
+
+  // rules of tag which can be reused by tags with the same names and ancestor names
+  struct SharedRules {
+    RuleKeys checkKeys;    // candidate rules which must be checked
+    RuleKeys chainMatched; // matched rules which only check names (see StyleData::ShareType)
+  };
+
+  //---
+
+  // rule match results of recently matched tags which are reused by later tags
+  // with the same names (siblings and cousins).
+  //
+  // Rules which only check names and don't use sibling combinators on the matched
+  // tag have the same result for tags with the same names and parent. Rules which
+  // also only check names on ancestors through descendant or child combinators have
+  // the same result for tags whose ancestors all have the same names (chain)
+  class StyleShareCache {
+   public:
+    // rules of last tag with names. Candidate rules are the same for all tags with
+    // the same names so only the rules which can't be shared need to be checked
+    struct Entry {
+      uint64_t     parent { 0 };     // id of parent of last tag using entry
+      uint         chain  { 0 };     // id of tag's names and its ancestors names
+      bool         valid  { false }; // rules set
+      SharedRules  rules;            // rules shared by chain
+      RuleKeys     siblingMatched;   // matched rules shared by same parent
+    };
+
+   public:
+    StyleShareCache() { }
+
+    bool isEnabled() const { return enabled_; }
+    void setEnabled(bool b) { enabled_ = b; clear(); }
+
+    // add ancestor (names are null if tag has none). Each push gets a new id so tags
+    // are never identified by address (tag data may be freed and its address reused)
+    void pushAncestor(const CCSSTagNames *names);
+
+    void popAncestor();
+
+    // id of last pushed ancestor (zero if none)
+    uint64_t parent() const {
+      return (! ancestors_.empty() ? ancestors_.back().id : 0);
+    }
+
+    // get entry for tag with names whose parent is the last pushed ancestor (created
+    // if needed). Returns null if disabled or no ancestors. Entries are reset when
+    // rule version (unique to stylesheet and its rules, see CCSS::RuleVersion) changes
+    Entry *lookup(uint64_t version, const CCSSTagNames &names);
+
+    void clear();
+
+   private:
+    // parent chain and sorted names
+    struct Key {
+      uint              chain { 0 };
+      std::vector<uint> names;
+
+      friend bool operator==(const Key &key1, const Key &key2) {
+        return (key1.chain == key2.chain && key1.names == key2.names);
+      }
+    };
+
+    struct KeyHash {
+      std::size_t operator()(const Key &key) const {
+        std::size_t h = key.chain;
+
+        for (const auto &name : key.names)
+          hashCombine(h, name);
+
+        return h;
+      }
+    };
+
+    struct Ancestor {
+      uint64_t id    { 0 };
+      uint     chain { 0 };
+    };
+
+    typedef std::unordered_map<Key, Entry, KeyHash> Entries;
+    typedef std::vector<Ancestor>                   Ancestors;
+
+    enum { MAX_ENTRIES = 1024 };
+
+    void setKey(const CCSSTagNames &names);
+
+    Entry &findEntry();
+
+   private:
+    bool        enabled_        { true };
+    uint64_t    version_        { 0 };
+    Entries     entries_;
+    Ancestors   ancestors_;
+    Key         key_;
+    uint        lastChain_      { 0 };
+    uint64_t    lastAncestorId_ { 0 }; // never reset so ids are never reused
+  };
+
+  //---
+
+  // state kept while matching tags in document order.
+  //
+  // call pushAncestor for a tag after matching it and before matching its
+  // children and popAncestor when its children are done
+  class MatchContext {
+   public:
+    MatchContext() { }
+
+    void pushAncestor(const CCSSTagDataP &data);
+    void pushAncestor(const CCSSTagNode  &node);
+
+    void popAncestor() {
+      filter_.pop();
+
+      shareCache_.popAncestor();
+
+      ancestorHashes_.pop_back();
+    }
+
+    const AncestorFilter &ancestorFilter() const { return filter_; }
+
+    // share matched rules between tags with the same names (on by default).
+    // Siblings share rules while their parent is pushed so clear context if the
+    // tree changes
+    bool isStyleSharing() const { return shareCache_.isEnabled(); }
+    void setStyleSharing(bool b) { shareCache_.setEnabled(b); }
+
+    // cache is updated by matching
+    StyleShareCache &shareCache() const { return shareCache_; }
+
+    // hash of names of pushed ancestors (false if an ancestor has no names or first
+    // ancestor is not the document root)
+    bool ancestorsHash(uint64_t &hash) const {
+      if (ancestorHashes_.empty() || ! ancestorHashes_.back())
+        return false;
+
+      hash = ancestorHashes_.back();
+
+      return true;
+    }
+
+    void clear() { filter_.clear(); shareCache_.clear(); ancestorHashes_.clear(); }
+
+   private:
+    void pushAncestorHash(bool isRoot, const CCSSTagNames *names);
+
+   private:
+    AncestorFilter          filter_;
+    mutable StyleShareCache shareCache_;
+    std::vector<uint64_t>   ancestorHashes_; // zero if not valid
+    std::vector<uint>       namesKey_;
+  };
+
+  //---
+
+  // path from root to current tag in a document order walk.
+  //
+  // Each level keeps the children of the tag at the previous level and the index of
+  // the tag on the path, so ancestors and previous siblings of the current tag are
+  // found without calling getParent or getPrevSibling
+  class TreePath {
+   public:
+    typedef CCSSTagData::TagDataArray TagDataArray;
+
+   public:
+    TreePath() { }
+
+    bool empty() const { return depth_ == 0; }
+
+    // number of levels (root is at level zero)
+    uint depth() const { return depth_; }
+
+    // tag at index of level
+    const CCSSTagDataP &tag(uint level, uint index) const {
+      return levels_[level].array()[index];
+    }
+
+    // index of tag on path at level
+    uint index(uint level) const { return levels_[level].index; }
+
+    const CCSSTagDataP &current() const { return tag(depth_ - 1, index(depth_ - 1)); }
+
+    // true if all tags at last level have been visited
+    bool atLevelEnd() const {
+      const Level &level = levels_[depth_ - 1];
+
+      return (level.index >= level.end);
+    }
+
+    // start walk at root
+    void setRoot(const CCSSTagDataP &root);
+
+    // add level for children of current tag
+    void pushChildren();
+
+    // add level for tags start to end - 1 of children array owned by caller
+    // (array must not change while it is in the path)
+    void pushLevel(const TagDataArray &children, uint start, uint end);
+
+    // remove last level
+    void pop();
+
+    // move to next sibling at last level
+    void next() { ++levels_[depth_ - 1].index; }
+
+    void clear();
+
+   private:
+    struct Level {
+      TagDataArray        children;               // owned children
+      const TagDataArray *borrowed { nullptr };   // children owned by caller
+      uint                index    { 0 };
+      uint                end      { 0 };
+
+      const TagDataArray &array() const { return (borrowed ? *borrowed : children); }
+    };
+
+    // levels are reused as walk goes up and down tree
+    typedef std::vector<Level> Levels;
+
+    Levels levels_;
+    uint   depth_ { 0 };
+  };
+
+  //---
+
+  // match statistics of a rule (see CCSS::setRuleStats)
+  struct RuleStats {
+    uint64_t attempts         { 0 }; // number of times rule was checked against a tag
+    uint64_t filtered         { 0 }; // attempts rejected by ancestor filter
+    uint64_t rightmostRejects { 0 }; // attempts rejected by rightmost compound selector
+    uint64_t combinatorWalks  { 0 }; // attempts which checked tags for combinators
+    uint64_t matches          { 0 }; // attempts which matched
+    uint64_t time             { 0 }; // nanoseconds spent checking
+
+    void add(const RuleStats &stats) {
+      attempts         += stats.attempts;
+      filtered         += stats.filtered;
+      rightmostRejects += stats.rightmostRejects;
+      combinatorWalks  += stats.combinatorWalks;
+      matches          += stats.matches;
+      time             += stats.time;
+    }
   };
 
   //---
@@ -517,10 +1000,20 @@ class CCSS {
   // style data (selector list and options)
   class StyleData {
    public:
-    explicit StyleData(const SelectorList &selectorList=SelectorList()) :
-     selectorList_(selectorList), options_() {
+    explicit StyleData(const SelectorList &selectorList=SelectorList(), uint order=0) :
+     selectorList_(selectorList), options_(), specificity_(selectorList.specificity()),
+     order_(order) {
+      initAncestorHashes();
+      initShareType();
     }
 
+    // tags whose match result can be shared by tags with the same names (see StyleShareCache)
+    enum class ShareType {
+      NONE,    // never shared
+      SIBLING, // shared by tags with same parent
+      CHAIN    // shared by tags whose ancestors have the same names
+    };
+
     const SelectorList &getSelectorList() const { return selectorList_; }
 
     const OptionList &getOptions() const { return options_; }
@@ -531,6 +1024,8 @@ class CCSS {
 
     void addOption(const Option &opt) { options_.push_back(opt); }
 
+    void setOptions(const OptionList &options) { options_ = options; }
+
     bool getOptionValue(const std::string &name, std::string &value) const {
       for (const auto &option : options_) {
         if (option.getName() == name) {
@@ -542,12 +1037,49 @@ class CCSS {
       return false;
     }
 
-    Specificity specificity() const {
-      return selectorList_.specificity();
-    }
+    const Specificity &specificity() const { return specificity_; }
+
+    // source order of rule in stylesheet
+    uint order() const { return order_; }
+
+    // source order of rule's last declaration block (order of replaced declarations)
+    uint declarationOrder() const { return declOrder_; }
+    void setDeclarationOrder(uint i) { declOrder_ = i; }
+
+    // removed rule (see CCSS::removeRule) has no selectors
+    bool isRemoved() const { return selectorList_.selectors().empty(); }
+
+    // sort key : packed specificity in high 32 bits and source order in low 32 bits
+    uint64_t sortKey() const { return (uint64_t(specificity_.packed()) << 32) | order_; }
 
     bool checkMatch(const CCSSTagDataP &data) const;
 
+    bool checkMatch(const CCSSTagNode &node) const;
+
+    // check match of current tag of path
+    bool checkMatch(const TreePath &path) const;
+
+    // check tag of adapter's tree matches (defined in CCSSMatch.h)
+    template<typename Adapter>
+    bool checkMatch(const Adapter &adapter, const typename Adapter::Node &node) const;
+
+    // check tag of adapter's tree matches and add attempt and time to stats
+    template<typename Adapter>
+    bool checkMatch(const Adapter &adapter, const typename Adapter::Node &node,
+                    RuleStats &stats) const;
+
+    ShareType shareType() const { return shareType_; }
+
+    // check if names needed on ancestors by descendant and child combinators
+    // may be in filter (false if rule can't match)
+    bool checkAncestorFilter(const AncestorFilter &filter) const {
+      for (uint i = 0; i < numAncestorHashes_; ++i)
+        if (! filter.mayContain(ancestorHashes_[i]))
+          return false;
+
+      return true;
+    }
+
     friend std::ostream &operator<<(std::ostream &os, const StyleData &data) {
       data.print(os);
 
@@ -565,34 +1097,690 @@ class CCSS {
     void printDebug(std::ostream &os) const;
 
    private:
+    void initAncestorHashes();
+
+    void initShareType();
+
+   private:
+    enum { MAX_ANCESTOR_HASHES = 4 };
+
     SelectorList selectorList_;
     OptionList   options_;
+    Specificity  specificity_;
+    uint         order_ { 0 };
+    uint         declOrder_ { 0 };
+    uint         ancestorHashes_[MAX_ANCESTOR_HASHES] = {};
+    uint         numAncestorHashes_ { 0 };
+    ShareType    shareType_ { ShareType::NONE };
+  };
+
+  //---
+
+  // comma separated selector lists compiled once from text (see CCSS::compileSelector)
+  // which match tags without a stylesheet. Matching has no side effects so can be
+  // done from multiple threads
+  class CompiledSelector {
+   public:
+    typedef CCSSTagData::TagDataArray TagDataArray;
+
+   public:
+    CompiledSelector() { }
+
+    bool isValid() const { return ! selectorLists_.empty(); }
+
+    const SelectorLists &selectorLists() const { return selectorLists_; }
+
+    // true if tag matches any selector list
+    bool checkMatch(const CCSSTagDataP &data) const;
+
+    // check tag of adapter's tree matches (defined in CCSSMatch.h)
+    template<typename Adapter>
+    bool checkMatch(const Adapter &adapter, const typename Adapter::Node &node) const;
+
+    // first descendant of root (in document order) which matches (null if none)
+    CCSSTagDataP querySelector(const CCSSTagDataP &root) const;
+
+    // all descendants of root (in document order) which match
+    void querySelectorAll(const CCSSTagDataP &root, TagDataArray &tags) const;
+
+    TagDataArray querySelectorAll(const CCSSTagDataP &root) const;
+
+   private:
+    friend class CCSS;
+
+    void init(SelectorLists &selectorLists);
+
+    // walk descendants of root in document order until proc returns false
+    template<typename Proc>
+    void walk(const CCSSTagDataP &root, const Proc &proc) const;
+
+   private:
+    // selectors which only check a single name (checked directly)
+    enum class FastPath {
+      NONE,
+      ID,
+      CLASS,
+      ELEMENT
+    };
+
+    SelectorLists selectorLists_;
+    FastPath      fastPath_ { FastPath::NONE };
+    CCSSAtom      fastName_;
+  };
+
+  //---
+
+  // cascaded option values for a tag (one option per name)
+  class ComputedStyle {
+   public:
+    ComputedStyle() { }
+
+    // options sorted by name
+    const OptionList &getOptions() const { return options_; }
+
+    uint getNumOptions() const { return uint(options_.size()); }
+
+    const Option *getOption(const CCSSAtom &name) const;
+
+    const Option *getOption(const std::string &name) const {
+      return getOption(CCSSAtom::find(name));
+    }
+
+    bool getOptionValue(const std::string &name, std::string &value) const {
+      const Option *option = getOption(name);
+      if (! option) return false;
+
+      value = option->getValue();
+
+      return true;
+    }
+
+    void setOptions(OptionList &&options);
+
+    void print(std::ostream &os) const {
+      int i = 0;
+
+      for (const auto &option : options_) {
+        if (i > 0) os << " ";
+
+        option.print(os);
+
+        ++i;
+      }
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const ComputedStyle &style) {
+      style.print(os);
+
+      return os;
+    }
+
+   private:
+    OptionList        options_;
+    std::vector<uint> atomIndex_; // indices of options sorted by name atom (for lookup)
+  };
+
+  // rules in source order (deque so references stay valid as rules are added)
+  typedef std::deque<StyleData> StyleDataList;
+
+  // index of rules by selector list hash
+  typedef std::unordered_multimap<std::size_t, uint> StyleDataIndex;
+
+  typedef std::vector<const StyleData *> StyleDataArray;
+
+  // rule keys sorted by specificity then source order.
+  // keys after numSorted have been added but not yet sorted
+  struct RuleBucket {
+    RuleKeys    keys;
+    std::size_t numSorted { 0 };
+  };
+
+  typedef std::vector<RuleBucket *> RuleBucketPs;
+
+  // rules by rightmost selector id, first class or element name
+  struct RuleBuckets {
+    typedef std::unordered_map<CCSSAtom, RuleBucket> AtomRules;
+
+    AtomRules  idRules;
+    AtomRules  classRules;
+    AtomRules  elementRules;
+    RuleBucket universalRules;
+    RuleBucket allRules;
+  };
+
+  //---
+
+  // change of tag which may change the rules it, or tags related to it, match
+  enum class ChangeType {
+    ELEMENT,  // element name
+    ID,       // id name
+    CLASS,    // class name
+    ATTRIBUTE // attribute (or :required, :invalid input value)
+  };
+
+  // tags which may be affected by a change (any tag or tags with one of the names)
+  class TagFilter {
+   public:
+    TagFilter() { }
+
+    bool isAll() const { return all_; }
+
+    bool isEmpty() const {
+      return (! all_ && ids_.empty() && classes_.empty() && attributes_.empty() &&
+              elements_.empty());
+    }
+
+    void setAll();
+
+    void addName(ChangeType type, const CCSSAtom &name);
+
+    void add(const TagFilter &filter);
+
+    bool checkMatch(const CCSSTagData &data) const;
+
+   private:
+    // filters with more names than this match all tags
+    enum { MAX_NAMES = 32 };
+
+    Atoms &names(ChangeType type);
+
+    bool  all_ { false };
+    Atoms ids_;
+    Atoms classes_;
+    Atoms attributes_;
+    Atoms elements_;
+  };
+
+  // tags whose matching rules may change when a name or attribute of a tag changes
+  // (from the position of the name in the selectors of all rules)
+  struct InvalidationSet {
+    bool      self { false };     // tag itself
+    TagFilter descendants;        // descendants of tag
+    TagFilter siblings;           // later siblings of tag
+    TagFilter siblingDescendants; // descendants of later siblings of tag
+
+    bool isEmpty() const {
+      return (! self && descendants.isEmpty() && siblings.isEmpty() &&
+              siblingDescendants.isEmpty());
+    }
+
+    void add(const InvalidationSet &set);
+  };
+
+  // invalidation sets of each name used by rules. Built from all rules when first used
+  // and then updated as rules are added.
+  //
+  // Locked so can be built by queries on multiple threads. Copies are empty (rebuilt
+  // when used)
+  class Invalidations {
+   public:
+    Invalidations() { }
+
+    Invalidations(const Invalidations &) { }
+
+    Invalidations &operator=(const Invalidations &) { clear(); return *this; }
+
+    bool isBuilt() const { return built_; }
+
+    // build sets from rules (if not already built)
+    void build(const StyleDataList &styleData);
+
+    // add names of selectors of rule to sets
+    void addRule(const SelectorList &selectorList);
+
+    // set for name (empty if not used by any rule)
+    const InvalidationSet &get(ChangeType type, const CCSSAtom &name) const;
+
+    void clear();
+
+   private:
+    typedef std::unordered_map<CCSSAtom, InvalidationSet> AtomSets;
+
+    AtomSets &sets(ChangeType type);
+
+   private:
+    std::mutex mutex_;
+    bool       built_ { false };
+    AtomSets   elements_;
+    AtomSets   ids_;
+    AtomSets   classes_;
+    AtomSets   attributes_;
+  };
+
+  //---
+
+  // source text of a stylesheet (memory mapped file or owned string)
+  class Source {
+   public:
+    explicit Source(std::string &&str);
+
+    ~Source();
+
+    Source(const Source &) = delete;
+    Source &operator=(const Source &) = delete;
+
+    static std::shared_ptr<Source> mapFile(const std::string &filename);
+
+    std::string_view text() const {
+      if (data_) return std::string_view(data_, len_);
+
+      return std::string_view(str_);
+    }
+
+   private:
+    Source() { }
+
+   private:
+    std::string  str_;                // owned text (if not mapped)
+    const char  *data_ { nullptr };   // mapped text
+    std::size_t  len_  { 0 };         // mapped length
+  };
+
+  typedef std::shared_ptr<Source> SourceP;
+  typedef std::vector<SourceP>    Sources;
+
+  //---
+
+  // incremental scanner for the end of top level rules in css text
+  // (skips comments, quoted strings, escaped chars and bracketed text and tracks
+  // nested braces)
+  class RuleScanner {
+   public:
+    RuleScanner() { }
+
+    // scan str from pos and return position after end of next rule (npos if incomplete).
+    // state is kept so scanning can be resumed when more text is appended
+    std::size_t scan(std::string_view str, std::size_t pos);
+
+    void reset() { *this = RuleScanner(); }
+
+    bool isTopLevel() const {
+      return (state_ == State::NORMAL && depth_ == 0 && bracketDepth_ == 0);
+    }
+
+   private:
+    enum class State {
+      NORMAL,
+      COMMENT,
+      STRING
+    };
+
+    State state_        { State::NORMAL };
+    int   depth_        { 0 };
+    int   bracketDepth_ { 0 };
+    char  quote_        { '\0' };
+    char  lastChar_     { '\0' };
+  };
+
+  //---
+
+  // push parser for css text received in arbitrary sized chunks.
+  // complete rules are added to the stylesheet as soon as their end is seen
+  class StreamParser {
+   public:
+    explicit StreamParser(CCSS &css) :
+     css_(css) {
+    }
+
+    // add next chunk of text
+    bool addChunk(std::string_view chunk);
+
+    // parse any remaining (incomplete) text
+    bool finish();
+
+    // pending text of incomplete rule
+    const std::string &pending() const { return buffer_; }
+
+   private:
+    CCSS       &css_;
+    std::string buffer_;         // text not yet parsed
+    std::size_t scanPos_ { 0 };  // scanned position in buffer
+    RuleScanner scanner_;        // scan state at scan position
   };
 
-  typedef std::map<SelectorList, StyleData> StyleDataMap;
+  //---
+
+  typedef std::vector<std::string> Diagnostics;
+
+  //---
+
+  // process wide unique stamp of a stylesheet's rules. A new stamp is taken when rules
+  // change and by copies so caches of match results never confuse two stylesheets
+  // (even at the same address) or two versions of the rules of one stylesheet
+  class RuleVersion {
+   public:
+    RuleVersion() : id_(nextId()) { }
+
+    RuleVersion(const RuleVersion &) : id_(nextId()) { }
+
+    RuleVersion &operator=(const RuleVersion &) { update(); return *this; }
+
+    uint64_t id() const { return id_; }
+
+    void update() { id_ = nextId(); }
+
+   private:
+    static uint64_t nextId();
+
+   private:
+    uint64_t id_ { 0 };
+  };
 
   //---
 
+  struct MatchCacheStats {
+    std::size_t hits   { 0 };
+    std::size_t misses { 0 };
+    std::size_t size   { 0 };
+  };
+
+  // bounded least recently used cache of shared rules of tags keyed by their names
+  // and hash of their ancestors names (see CCSS::setMatchCacheSize).
+  //
+  // Locked so can be used by matches on multiple threads. Copies only copy the size
+  class MatchCache {
+   public:
+    MatchCache() { }
+
+    MatchCache(const MatchCache &cache) :
+     maxSize_(cache.maxSize()) {
+    }
+
+    MatchCache &operator=(const MatchCache &cache) {
+      setMaxSize(cache.maxSize());
+
+      return *this;
+    }
+
+    std::size_t maxSize() const { return maxSize_; }
+    void setMaxSize(std::size_t n);
+
+    bool isEnabled() const { return maxSize_ > 0; }
+
+    // get rules for tag names key and ancestors hash of rule version (false if not found)
+    bool lookup(const std::vector<uint> &names, uint64_t ancestorsHash, uint64_t version,
+                SharedRules &rules);
+
+    void add(const std::vector<uint> &names, uint64_t ancestorsHash, uint64_t version,
+             const SharedRules &rules);
+
+    MatchCacheStats stats() const;
+
+    void resetStats();
+
+    void clear();
+
+   private:
+    struct Entry {
+      uint64_t          hash          { 0 };
+      std::vector<uint> names;
+      uint64_t          ancestorsHash { 0 };
+      SharedRules       rules;
+    };
+
+    typedef std::list<Entry>                                  Entries;
+    typedef std::unordered_map<uint64_t, Entries::iterator>   EntryMap;
+
+    static uint64_t entryHash(const std::vector<uint> &names, uint64_t ancestorsHash);
+
+    void clearEntries();
+
+   private:
+    mutable std::mutex mutex_;
+    std::size_t        maxSize_ { 0 };
+    uint64_t           version_ { 0 };
+    Entries            entries_;  // most recently used first
+    EntryMap           entryMap_;
+    std::size_t        hits_    { 0 };
+    std::size_t        misses_  { 0 };
+  };
+
+  //---
+
+  // match statistics of each rule indexed by rule order (see CCSS::setRuleStats).
+  //
+  // Counters are atomic so can be updated by matches on multiple threads
+  class RuleStatsTable {
+   public:
+    RuleStatsTable() { }
+
+    RuleStatsTable(const RuleStatsTable &table) {
+      *this = table;
+    }
+
+    RuleStatsTable &operator=(const RuleStatsTable &table);
+
+    bool isEnabled() const { return enabled_; }
+    void setEnabled(bool b) { enabled_ = b; }
+
+    std::size_t size() const { return counters_.size(); }
+
+    // add counters for new rules (existing counters are kept)
+    void resize(std::size_t n);
+
+    // add stats of attempt to rule's counters
+    void add(uint ind, const RuleStats &stats);
+
+    RuleStats stats(uint ind) const;
+
+    // zero all counters
+    void reset();
+
+    void clear() { counters_.clear(); }
+
+   private:
+    struct Counters {
+      std::atomic<uint64_t> attempts         { 0 };
+      std::atomic<uint64_t> filtered         { 0 };
+      std::atomic<uint64_t> rightmostRejects { 0 };
+      std::atomic<uint64_t> combinatorWalks  { 0 };
+      std::atomic<uint64_t> matches          { 0 };
+      std::atomic<uint64_t> time             { 0 };
+    };
+
+    // deque as counters can't be moved
+    typedef std::deque<Counters> CountersList;
+
+    bool         enabled_ { false };
+    CountersList counters_;
+  };
+
+  //---
+
+  // handle of rule (index of its StyleData which is also its order()). Stays valid
+  // until the rule is removed and is never reused
+  typedef uint                    RuleHandle;
+  typedef std::vector<RuleHandle> RuleHandles;
+
+  // parsed rule (not yet added to stylesheet)
+  struct Rule {
+    SelectorLists selectorLists;
+    OptionList    options;
+  };
+
+  typedef std::vector<Rule> Rules;
+
  public:
   CCSS();
 
   bool isDebug() const { return debug_; }
   void setDebug(bool b) { debug_ = b; }
 
+  // problems found when loading stylesheet (each reported once)
+  const Diagnostics &diagnostics() const { return diagnostics_; }
+
+  // number of threads used to parse large stylesheets (one for no threads, zero for
+  // number of hardware threads)
+  uint parseThreads() const { return parseThreads_; }
+  void setParseThreads(uint n) { parseThreads_ = n; }
+
+  // size of cache of rules of tags keyed by their names and a hash of their ancestors
+  // names (zero disables it, default). Rules which only check names of the tag and its
+  // ancestors are reused from the cache and the other candidate rules are checked.
+  // Cache is shared by all matches and cleared when rules are added
+  std::size_t matchCacheSize() const { return matchCache_.maxSize(); }
+  void setMatchCacheSize(std::size_t n) { matchCache_.setMaxSize(n); }
+
+  // hit and miss counts of match cache (to tune its size)
+  MatchCacheStats matchCacheStats() const { return matchCache_.stats(); }
+  void resetMatchCacheStats() { matchCache_.resetStats(); }
+
+  // record number of attempts, rejections, matches and time of each rule checked by
+  // matching (off by default). Rules reused from the match or share caches are not
+  // checked so are not counted
+  bool isRuleStats() const { return ruleStats_.isEnabled(); }
+  void setRuleStats(bool b);
+
+  // match statistics of rule (zero if not recorded)
+  RuleStats ruleStats(RuleHandle handle) const { return ruleStats_.stats(handle); }
+
+  void resetRuleStats() { ruleStats_.reset(); }
+
+  // print statistics of the n rules with the most time spent matching them
+  void printRuleStats(std::ostream &os, uint n=20) const;
+
   bool processFile(const std::string &fileName);
 
   bool processLine(const std::string &line);
 
-  bool parseSelector(const std::string &id, std::vector<StyleData> &styles);
+  // save rules to precompiled binary file which can be matched in place without
+  // parsing (see CCSSBinaryStyleSheet)
+  bool saveBinary(const std::string &fileName) const;
+
+  // add rules from precompiled binary file written by saveBinary so they can be
+  // changed (processFile also loads binary files)
+  bool loadBinary(const std::string &fileName);
+
+  // true if text starts with precompiled binary file header
+  static bool isBinary(std::string_view text);
+
+  // parse comma separated selectors and get copy of rule for each (empty if not in
+  // stylesheet). The stylesheet is not changed
+  bool parseSelector(const std::string &id, std::vector<StyleData> &styles) const;
+
+  // compile comma separated selectors for matching tags (false if invalid)
+  bool compileSelector(const std::string &text, CompiledSelector &selector) const;
+
+  // first descendant of root (in document order) which matches selectors text
+  CCSSTagDataP querySelector(const CCSSTagDataP &root, const std::string &text) const;
+
+  // all descendants of root (in document order) which match selectors text
+  CCSSTagData::TagDataArray querySelectorAll(const CCSSTagDataP &root,
+                                             const std::string &text) const;
+
+  // parse rule text ("<selectors> { <declarations> }") and add a new rule after all
+  // other rules for each comma separated selector (false if text is not a single rule)
+  bool insertRule(const std::string &text, RuleHandles &handles);
+
+  // remove rule (false if handle is not a rule)
+  bool removeRule(RuleHandle handle);
+
+  // replace declarations of rule with parsed declarations text ("<name>: <value>; ...").
+  // The rule keeps its position in the cascade: a declaration replacing one of the same
+  // name keeps its position and others are placed at the rule's last declaration block
+  bool replaceDeclarations(RuleHandle handle, const std::string &text);
+
+  // rule for handle (null if removed or invalid)
+  const StyleData *getRule(RuleHandle handle) const;
 
   void getSelectors(std::vector<SelectorList> &selectors) const;
 
   bool hasStyleData() const;
 
+  // get rule for selector list (new empty rule added after all rules if not found)
   StyleData &getStyleData(const SelectorList &selectorList);
 
   const StyleData &getStyleData(const SelectorList &selectorList) const;
 
+  const StyleData *findStyleData(const SelectorList &selectorList) const;
+
+  const StyleData *findStyleData(const std::string &selectorStr) const;
+
+  // get rules which match tag (in specificity then source order)
+  void matchRules(const CCSSTagDataP &data, StyleDataArray &styles) const;
+
+  StyleDataArray matchRules(const CCSSTagDataP &data) const;
+
+  // get rules which match tag using context of ancestors of tag from a
+  // document order walk to reject rules needing missing ancestor names
+  void matchRules(const CCSSTagDataP &data, const MatchContext &context,
+                  StyleDataArray &styles) const;
+
+  // node versions of matchRules (tree is walked using borrowed links)
+  void matchRules(const CCSSTagNode &node, StyleDataArray &styles) const;
+
+  void matchRules(const CCSSTagNode &node, const MatchContext &context,
+                  StyleDataArray &styles) const;
+
+  // get rules which match node of any tree type using an adapter class with statically
+  // dispatched checks (defined in CCSSMatch.h which describes the adapter interface)
+  template<typename Adapter>
+  void match(const typename Adapter::Node &node, StyleDataArray &styles,
+             const Adapter &adapter=Adapter()) const;
+
+  template<typename Adapter>
+  void match(const typename Adapter::Node &node, const MatchContext &context,
+             StyleDataArray &styles, const Adapter &adapter=Adapter()) const;
+
+  template<typename Adapter>
+  StyleDataArray match(const typename Adapter::Node &node,
+                       const Adapter &adapter=Adapter()) const;
+
+  // get value of each option for tag from all matching rules using
+  // !important, specificity and source order
+  void computeStyle(const CCSSTagDataP &data, ComputedStyle &style) const;
+
+  ComputedStyle computeStyle(const CCSSTagDataP &data) const;
+
+  void computeStyle(const CCSSTagDataP &data, const MatchContext &context,
+                    ComputedStyle &style) const;
+
+  void computeStyle(const CCSSTagNode &node, ComputedStyle &style) const;
+
+  void computeStyle(const CCSSTagNode &node, const MatchContext &context,
+                    ComputedStyle &style) const;
+
+  // get value of each option from matching rules (as returned by matchRules)
+  void computeStyle(const StyleDataArray &styles, ComputedStyle &style) const;
+
+  // called for each tag of styleTree with its matching rules
+  typedef std::function<void (const CCSSTagDataP &data, const StyleDataArray &styles)>
+    StyleTreeProc;
+
+  // match rules for root and all its descendants in document order (single walk
+  // of tree using getChildren)
+  void styleTree(const CCSSTagDataP &root, const StyleTreeProc &proc) const;
+
+  // match rules for root and all its descendants using numThreads threads (zero for
+  // number of hardware threads). proc is called on the calling thread in document
+  // order once all tags are matched. The tags must support concurrent reads
+  void styleTree(const CCSSTagDataP &root, const StyleTreeProc &proc, uint numThreads) const;
+
+  // called for each node of styleTree with its matching rules
+  typedef std::function<void (const CCSSTagNode &node, const StyleDataArray &styles)>
+    NodeStyleProc;
+
+  // match rules for root node and all its descendants in document order
+  void styleTree(const CCSSTagNode &root, const NodeStyleProc &proc) const;
+
+  // invalidation set for change of name or attribute of a tag (empty if not used by
+  // any rule). Sets are built from all rules when first used and then kept up to date
+  // as rules are added (removed rules are still included)
+  const InvalidationSet &invalidationSet(ChangeType type, const CCSSAtom &name) const;
+
+  // add invalidation set for change of name or attribute to set
+  void addInvalidation(ChangeType type, const CCSSAtom &name, InvalidationSet &set) const;
+
+  // add invalidation sets for change of tag's classes from oldClasses to newClasses
+  // (classes in only one of them)
+  void addClassChange(const Atoms &oldClasses, const Atoms &newClasses,
+                      InvalidationSet &set) const;
+
+  // get tags which need to be restyled for changes of tag with invalidation set
+  // (in document order of tag, its descendants and later siblings and their descendants)
+  void getInvalidatedTags(const CCSSTagDataP &data, const InvalidationSet &set,
+                          CCSSTagData::TagDataArray &tags) const;
+
   void clear();
 
   void printStyle(std::ostream &os) const;
@@ -606,35 +1794,112 @@ class CCSS {
   }
 
  private:
-  bool parse(const std::string &str);
+  bool processSource(const SourceP &source);
+
+  bool loadBinarySource(const SourceP &source);
+
+  bool parse(std::string_view str);
+
+  bool parseParallel(std::string_view str);
+
+  enum class RuleStatus {
+    NONE,  // no more rules
+    OK,    // rule parsed
+    LAST,  // rule parsed but no close brace (no more rules)
+    ERROR  // invalid rule
+  };
+
+  RuleStatus parseRule(CCSSTokenizer &tokenizer, Rule &rule) const;
+
+  // parse and add rules until end of text or error
+  bool addRules(CCSSTokenizer &tokenizer);
+
+  // add parsed rule. If handles are returned a new rule is always added for each
+  // selector list (not merged with an existing rule)
+  void addRule(Rule &rule, RuleHandles *handles=nullptr);
+
+  bool parseSelectorLists(CCSSTokenizer &tokenizer, SelectorLists &selectorLists) const;
+
+  bool parseSelectorList(CCSSTokenizer &tokenizer, SelectorList &selectorList) const;
+
+  bool parseSelectorData(CCSSTokenizer &tokenizer, SelectorData &selectorData) const;
+
+  bool parseAttr(CCSSTokenizer &tokenizer, OptionList &options) const;
+
+  void addSelectorParts(Selector &selector, const SelectorData &selectorData,
+                        NextType nextType) const;
+
+  void addRuleBucket(uint ind);
+
+  void removeRuleBucket(uint ind);
+
+  // get existing rule for selector list (unchanged) or add new rule with declaration order
+  StyleData &addStyleData(const SelectorList &selectorList, uint declOrder);
+
+  // add rule for selector list which is not already in stylesheet
+  StyleData &addNewStyleData(const SelectorList &selectorList, uint declOrder);
+
+  void sortRuleBuckets();
 
-  bool parseIdListList(CStrParse &parse, IdListList &idListList);
+  void getCandidateRules(const CCSSTagNames *names, RuleKeys &keys) const;
 
-  bool parseAttr(const std::string &str, StyleData &styleData);
+  // get candidate rules of tag split into rules which must be checked and matched
+  // rules which only check names (from match cache if ancestorsHash set) and the
+  // rules which match (sorted)
+  template<typename CheckRule>
+  void matchSharedRules(const CCSSTagNames *names, const uint64_t *ancestorsHash,
+                        const CheckRule &checkRule, SharedRules &rules,
+                        RuleKeys &matched) const;
 
-  std::string readAttrName(CStrParse &parse) const;
+  // check rule (rejected if ancestor filter set and it can't match) and add attempt to
+  // rule's match statistics
+  template<typename Adapter>
+  bool checkRuleStats(const StyleData &styleData, const AncestorFilter *filter,
+                      const Adapter &adapter, const typename Adapter::Node &node) const;
 
-  std::string readAttrValue(CStrParse &parse) const;
+  // hash of names of ancestors of tag (false if tag is root or an ancestor has no names)
+  template<typename Adapter>
+  bool getAncestorsHash(const Adapter &adapter, const typename Adapter::Node &node,
+                        uint64_t &hash) const;
 
-  static bool findIdChar(const std::string &str, char c, uint &pos);
+  // sorted atom ids of tag names (element, number of ids, ids then classes)
+  static void getNamesKey(const CCSSTagNames &names, std::vector<uint> &key);
 
-  bool readId(CStrParse &parse, std::string &id) const;
+  // add names of next ancestor to ancestors hash
+  static uint64_t addAncestorHash(uint64_t hash, const std::vector<uint> &key);
 
-  bool readBracedString(CStrParse &parse, std::string &str) const;
+  // ancestors hash of document root
+  static const uint64_t rootAncestorsHash = 14695981039346656037ULL;
 
-  bool isComment(CStrParse &parse) const;
+  void matchPathRules(const TreePath &path, const MatchContext &context,
+                      StyleDataArray &styles) const;
 
-  bool skipComment(CStrParse &parse) const;
+  void styleWalk(TreePath &path, MatchContext &context, const StyleTreeProc &proc) const;
 
-  void addSelectorParts(Selector &selector, const Id &id);
+  void addFunctionDiagnostics(const SelectorList &selectorList);
 
-  void parseSelectorData(const std::string &id, SelectorData &selectorData) const;
+  void addDiagnostic(const std::string &msg);
 
   void errorMsg(const std::string &msg) const;
 
  private:
-  bool         debug_ { false };
-  StyleDataMap styleData_;
+  // smallest text split for parsing on multiple threads
+  static const std::size_t minParallelParseSize = 64*1024;
+
+  bool                   debug_ { false };
+  uint                   parseThreads_ { 1 };
+  StyleDataList          styleData_;
+  StyleDataIndex         styleDataIndex_;
+  RuleBuckets            ruleBuckets_;
+  RuleBucketPs           unsortedBuckets_;
+  uint                   optionOrder_ { 0 };
+  RuleVersion            ruleVersion_;        // updated when rules change
+  uint                   numRemoved_ { 0 };   // number of removed rules
+  mutable MatchCache     matchCache_;         // updated by matching
+  mutable Invalidations  invalidations_;      // built by invalidation queries
+  mutable RuleStatsTable ruleStats_;          // updated by matching
+  Diagnostics            diagnostics_;
+  Sources                sources_;
 };
 
 #endif
@@ -0,0 +1,131 @@
+#ifndef CCSSAtom_H
+#define CCSSAtom_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <iostream>
+#include <sys/types.h>
+
+// Interned name (element, id, class or attribute name).
+//
+// All atoms for the same string share a single entry in a global table so
+// comparison and hashing are a single integer operation. Entries are never
+// freed so atoms (and their strings) stay valid for the life of the process.
+class CCSSAtom {
+ public:
+  // empty atom
+  CCSSAtom();
+
+  // intern string
+  explicit CCSSAtom(std::string_view str);
+
+  // unique id of atom (empty atom is zero)
+  uint id() const { return entry_->id; }
+
+  const std::string &str() const { return entry_->str; }
+
+  // hash of string (same value for same string in any process)
+  uint hash() const { return entry_->hash; }
+
+  bool empty() const { return entry_->id == 0; }
+
+  // lookup atom without adding (returns empty atom if string not interned)
+  static CCSSAtom find(std::string_view str);
+
+  // hash function used for atom strings
+  static uint hashString(std::string_view str) {
+    uint h = 2166136261u; // FNV-1a
+
+    for (char c : str) {
+      h ^= uint(static_cast<unsigned char>(c));
+      h *= 16777619u;
+    }
+
+    return h;
+  }
+
+  friend bool operator==(const CCSSAtom &a1, const CCSSAtom &a2) {
+    return a1.entry_ == a2.entry_;
+  }
+
+  friend bool operator!=(const CCSSAtom &a1, const CCSSAtom &a2) {
+    return a1.entry_ != a2.entry_;
+  }
+
+  friend bool operator<(const CCSSAtom &a1, const CCSSAtom &a2) {
+    return a1.id() < a2.id();
+  }
+
+  friend bool operator>(const CCSSAtom &a1, const CCSSAtom &a2) {
+    return a1.id() > a2.id();
+  }
+
+  friend std::ostream &operator<<(std::ostream &os, const CCSSAtom &atom) {
+    os << atom.str();
+
+    return os;
+  }
+
+ public:
+  struct Entry {
+    std::string str;
+    uint        id   { 0 };
+    uint        hash { 0 };
+  };
+
+ private:
+  friend class CCSSAtomCache;
+
+  explicit CCSSAtom(const Entry *entry) :
+   entry_(entry) {
+  }
+
+ private:
+  const Entry *entry_ { nullptr };
+};
+
+typedef std::vector<CCSSAtom> CCSSAtoms;
+
+//---
+
+// atoms of a fixed number of strings (e.g. the strings of a mapped file) interned
+// when first used. Can be used from multiple threads
+class CCSSAtomCache {
+ public:
+  explicit CCSSAtomCache(std::size_t n=0);
+
+  std::size_t size() const { return size_; }
+
+  // get atom of string with index (false if not yet interned)
+  bool find(std::size_t ind, CCSSAtom &atom) const {
+    const CCSSAtom::Entry *entry = entries_[ind].load(std::memory_order_acquire);
+
+    if (! entry)
+      return false;
+
+    atom = CCSSAtom(entry);
+
+    return true;
+  }
+
+  // intern string with index (str must be the same for each call with the index)
+  CCSSAtom add(std::size_t ind, std::string_view str) const;
+
+ private:
+  typedef std::atomic<const CCSSAtom::Entry *> EntryP;
+
+  std::unique_ptr<EntryP[]> entries_;
+  std::size_t               size_ { 0 };
+};
+
+namespace std {
+  template<>
+  struct hash<CCSSAtom> {
+    size_t operator()(const CCSSAtom &atom) const { return atom.id(); }
+  };
+}
+
+#endif
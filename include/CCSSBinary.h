@@ -0,0 +1,277 @@
+#ifndef CCSSBinary_H
+#define CCSSBinary_H
+
+#include <CCSSMatch.h>
+#include <cstring>
+
+// read only stylesheet matched in place from a precompiled binary file (see
+// CCSS::saveBinary).
+//
+// Loading maps the file and only checks its header. Rule buckets, selectors and
+// declarations are read from the mapped words when matching and names (but not
+// attribute values) are interned when first used, so no rules are built. Reads are
+// bounds checked so a corrupt file can give wrong results but never reads outside
+// the file.
+//
+// Matching has no side effects (apart from interning names) so can be done from
+// multiple threads. Use CCSS::loadBinary to add the rules of a file to an editable
+// stylesheet
+class CCSSBinaryStyleSheet {
+ public:
+  // rule indices (position of rules in file)
+  typedef std::vector<uint> RuleIndices;
+
+ public:
+  CCSSBinaryStyleSheet() { }
+
+  CCSSBinaryStyleSheet(const CCSSBinaryStyleSheet &) = delete;
+  CCSSBinaryStyleSheet &operator=(const CCSSBinaryStyleSheet &) = delete;
+
+  // map file (false if not a binary stylesheet)
+  bool loadFile(const std::string &filename);
+
+  // use mapped (or owned) source text (kept alive while loaded)
+  bool load(const CCSS::SourceP &source);
+
+  bool isLoaded() const { return !! source_; }
+
+  uint numRules() const { return header_.numRules; }
+
+  // number of declaration orders used by rules
+  uint numOrders() const { return header_.numOrders; }
+
+  // get selectors, options and declarations order of rule (false if rule is invalid)
+  bool getRule(uint ind, CCSS::SelectorList &selectorList, CCSS::OptionList &options,
+               uint &declOrder) const;
+
+  // get rules which match tag (in specificity then file order)
+  void matchRules(const CCSSTagDataP &data, RuleIndices &rules) const;
+
+  void matchRules(const CCSSTagNode &node, RuleIndices &rules) const;
+
+  // get rules which match node of any tree type using an adapter class (see CCSSMatch.h)
+  template<typename Adapter>
+  void match(const typename Adapter::Node &node, RuleIndices &rules,
+             const Adapter &adapter=Adapter()) const;
+
+  // get value of each option for tag from all matching rules using
+  // !important, specificity and declaration order
+  void computeStyle(const CCSSTagDataP &data, CCSS::ComputedStyle &style) const;
+
+  // get value of each option from matching rules (as returned by matchRules)
+  void computeStyle(const RuleIndices &rules, CCSS::ComputedStyle &style) const;
+
+  // print rules (same as CCSS::print of saved stylesheet)
+  void print(std::ostream &os) const;
+
+ public:
+  struct Header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t numStrings;
+    uint32_t numRules;
+    uint32_t numOrders;
+    uint32_t numWords;
+    uint32_t bucketOffset;
+    uint32_t numChars;
+  };
+
+ private:
+  // compound selector at word position (see CCSS::saveBinary)
+  class SelectorView {
+   public:
+    SelectorView(const CCSSBinaryStyleSheet &sheet, std::size_t pos) :
+     sheet_(&sheet), pos_(pos) {
+    }
+
+    CCSS::NextType nextType() const { return CCSS::NextType(sheet_->word(pos_ + 1)); }
+
+    template<typename Adapter>
+    bool checkMatch(const Adapter &adapter, const typename Adapter::Node &node) const;
+
+   private:
+    const CCSSBinaryStyleSheet *sheet_ { nullptr };
+    std::size_t                 pos_   { 0 };
+  };
+
+  // selectors of rule at word position
+  class SelectorsView {
+   public:
+    SelectorsView(const CCSSBinaryStyleSheet &sheet, std::size_t pos) :
+     sheet_(&sheet), pos_(pos), size_(sheet.count(pos)) {
+    }
+
+    bool empty() const { return size_ == 0; }
+
+    std::size_t size() const { return size_; }
+
+    SelectorView operator[](std::size_t i) const {
+      return SelectorView(*sheet_, sheet_->word(pos_ + 1 + i));
+    }
+
+   private:
+    const CCSSBinaryStyleSheet *sheet_ { nullptr };
+    std::size_t                 pos_   { 0 };
+    std::size_t                 size_  { 0 };
+  };
+
+  // word i (zero if outside file)
+  uint32_t word(std::size_t i) const {
+    if (i >= header_.numWords)
+      return 0;
+
+    uint32_t w;
+
+    memcpy(&w, words_ + i*sizeof(uint32_t), sizeof(w));
+
+    return w;
+  }
+
+  // count at word i limited to words after it
+  uint32_t count(std::size_t i) const {
+    if (i >= header_.numWords)
+      return 0;
+
+    return std::min(word(i), uint32_t(header_.numWords - i - 1));
+  }
+
+  // string with index (empty if invalid)
+  std::string_view string(uint32_t ind) const;
+
+  // atom of string with index (interned when first used)
+  CCSSAtom atom(uint32_t ind) const {
+    if (ind >= header_.numStrings)
+      return CCSSAtom();
+
+    CCSSAtom atom;
+
+    if (! atoms_.find(ind, atom))
+      atom = atoms_.add(ind, string(ind));
+
+    return atom;
+  }
+
+  static bool isUniversal(const CCSSAtom &name) {
+    static CCSSAtom universalAtom("*");
+
+    return (name.empty() || name == universalAtom);
+  }
+
+  // sort keys (packed specificity and rule index) of rules which may match tag names
+  void getCandidateRules(const CCSSTagNames *names, CCSS::RuleKeys &keys) const;
+
+  // checked reads of rule words and strings (for getRule)
+  bool readWord  (std::size_t &pos, uint32_t &w) const;
+  bool readString(std::size_t &pos, std::string_view &str) const;
+  bool readAtom  (std::size_t &pos, CCSSAtom &atom) const;
+
+ private:
+  CCSS::SourceP  source_;
+  Header         header_ {};
+  const char    *offsets_ { nullptr };
+  const char    *words_   { nullptr };
+  const char    *chars_   { nullptr };
+  CCSSAtomCache  atoms_;
+};
+
+//---
+
+// check tag matches compound selector:
+//
+//   <name> <next type> <num ids> <id>* <num classes> <class>*
+//   <num exprs> { <id> <op> <value> }* <num fns> { <fn> <type> <a> <b> }*
+template<typename Adapter>
+bool
+CCSSBinaryStyleSheet::SelectorView::
+checkMatch(const Adapter &adapter, const typename Adapter::Node &node) const
+{
+  const CCSSBinaryStyleSheet &sheet = *sheet_;
+
+  std::size_t pos = pos_;
+
+  CCSSAtom name = sheet.atom(sheet.word(pos));
+
+  pos += 2;
+
+  bool universal = isUniversal(name);
+
+  if (! universal && ! adapter.isElement(node, name))
+    return false;
+
+  uint32_t numIds = sheet.count(pos++);
+
+  for (uint32_t i = 0; i < numIds; ++i) {
+    if (! adapter.isId(node, sheet.atom(sheet.word(pos++))))
+      return false;
+  }
+
+  uint32_t numClasses = sheet.count(pos++);
+
+  for (uint32_t i = 0; i < numClasses; ++i) {
+    if (! adapter.isClass(node, sheet.atom(sheet.word(pos++))))
+      return false;
+  }
+
+  uint32_t numExprs = sheet.count(pos++);
+
+  for (uint32_t i = 0; i < numExprs; ++i, pos += 3) {
+    uint32_t op = sheet.word(pos + 1);
+
+    if (op > uint32_t(CCSSAttributeOp::STARTS_WITH))
+      return false;
+
+    // value is not a name so is not interned
+    if (! adapter.hasAttribute(node, sheet.atom(sheet.word(pos)), CCSSAttributeOp(op),
+                               std::string(sheet.string(sheet.word(pos + 2)))))
+      return false;
+  }
+
+  uint32_t numFns = sheet.count(pos++);
+
+  CCSSAtom typeName = (! universal ? name : CCSSAtom());
+
+  for (uint32_t i = 0; i < numFns; ++i, pos += 4) {
+    uint32_t type = sheet.word(pos + 1);
+
+    if (type > uint32_t(CCSS::FunctionType::INVALID))
+      return false;
+
+    CCSS::Function fn(CCSS::FunctionType(type),
+                      CCSS::NthExpr(int(sheet.word(pos + 2)), int(sheet.word(pos + 3))));
+
+    if (! fn.checkMatch(adapter, node, typeName))
+      return false;
+  }
+
+  return true;
+}
+
+template<typename Adapter>
+void
+CCSSBinaryStyleSheet::
+match(const typename Adapter::Node &node, RuleIndices &rules, const Adapter &adapter) const
+{
+  static_assert(CCSSIsTagAdapter<Adapter>::value, "invalid CCSS tag adapter");
+
+  CCSSTagNames names;
+
+  bool hasNames = adapter.getNames(node, names);
+
+  CCSS::RuleKeys keys;
+
+  getCandidateRules(hasNames ? &names : nullptr, keys);
+
+  for (const auto &key : keys) {
+    uint ind = uint(key & 0xffffffff);
+
+    SelectorsView selectors(*this, word(3*std::size_t(ind)));
+
+    CCSSSelectorMatcher<Adapter, SelectorsView> matcher(selectors, adapter);
+
+    if (matcher.match(node))
+      rules.push_back(ind);
+  }
+}
+
+#endif
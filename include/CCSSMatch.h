@@ -0,0 +1,954 @@
+#ifndef CCSSMatch_H
+#define CCSSMatch_H
+
+#include <CCSS.h>
+#include <type_traits>
+#include <chrono>
+#include <utility>
+
+// Compile-time selector matching for any tree type.
+//
+// CCSS::match<Adapter> matches rules using an adapter class which checks and navigates
+// the user's own tree so every call is statically dispatched and can be inlined. The
+// adapter needs (members may be static):
+//
+//   typedef ... Node; // cheap copyable, default constructible handle to a tag (pointer, ...)
+//
+//   bool isElement   (const Node &node, const CCSSAtom &name) const;
+//   bool isClass     (const Node &node, const CCSSAtom &name) const;
+//   bool isId        (const Node &node, const CCSSAtom &name) const;
+//   bool hasAttribute(const Node &node, const CCSSAtom &name, CCSSAttributeOp op,
+//                     const std::string &value) const;
+//   bool getNames    (const Node &node, CCSSTagNames &names) const; // false checks all rules
+//   bool isNthChild  (const Node &node, int n) const;
+//   int  childIndex  (const Node &node, bool fromEnd) const;
+//   int  typeIndex   (const Node &node, const CCSSAtom &name, bool fromEnd) const;
+//   bool isInputValue(const Node &node, const std::string &value) const;
+//   bool isRoot      (const Node &node) const;
+//   bool parent      (const Node &node, Node &parent) const;  // false if none
+//   bool prevSibling (const Node &node, Node &sibling) const; // false if none
+//   uint64_t key     (const Node &node) const;                // unique id of node
+//
+// Keys must not be reused by another node during a match (failed states are
+// remembered by key).
+//
+// The virtual CCSSTagNode interface is matched using the CCSSTagNodeAdapter
+// instantiation. CCSSTagData is matched through CCSSTagDataNode so tags fetched
+// from its links are kept alive for the match.
+
+// check class meets adapter requirements
+template<typename Adapter, typename = void>
+struct CCSSIsTagAdapter : std::false_type {
+};
+
+template<typename Adapter>
+struct CCSSIsTagAdapter<Adapter, std::void_t<
+  typename Adapter::Node,
+  decltype(bool(std::declval<const Adapter &>().isElement(
+    std::declval<const typename Adapter::Node &>(), std::declval<const CCSSAtom &>()))),
+  decltype(bool(std::declval<const Adapter &>().isClass(
+    std::declval<const typename Adapter::Node &>(), std::declval<const CCSSAtom &>()))),
+  decltype(bool(std::declval<const Adapter &>().isId(
+    std::declval<const typename Adapter::Node &>(), std::declval<const CCSSAtom &>()))),
+  decltype(bool(std::declval<const Adapter &>().hasAttribute(
+    std::declval<const typename Adapter::Node &>(), std::declval<const CCSSAtom &>(),
+    CCSSAttributeOp::NONE, std::declval<const std::string &>()))),
+  decltype(bool(std::declval<const Adapter &>().getNames(
+    std::declval<const typename Adapter::Node &>(), std::declval<CCSSTagNames &>()))),
+  decltype(bool(std::declval<const Adapter &>().isNthChild(
+    std::declval<const typename Adapter::Node &>(), 1))),
+  decltype(int(std::declval<const Adapter &>().childIndex(
+    std::declval<const typename Adapter::Node &>(), true))),
+  decltype(int(std::declval<const Adapter &>().typeIndex(
+    std::declval<const typename Adapter::Node &>(), std::declval<const CCSSAtom &>(), true))),
+  decltype(bool(std::declval<const Adapter &>().isInputValue(
+    std::declval<const typename Adapter::Node &>(), std::declval<const std::string &>()))),
+  decltype(bool(std::declval<const Adapter &>().isRoot(
+    std::declval<const typename Adapter::Node &>()))),
+  decltype(bool(std::declval<const Adapter &>().parent(
+    std::declval<const typename Adapter::Node &>(), std::declval<typename Adapter::Node &>()))),
+  decltype(bool(std::declval<const Adapter &>().prevSibling(
+    std::declval<const typename Adapter::Node &>(), std::declval<typename Adapter::Node &>()))),
+  decltype(uint64_t(std::declval<const Adapter &>().key(
+    std::declval<const typename Adapter::Node &>())))>> : std::true_type {
+};
+
+//---
+
+// adapter for CCSSTagNode (virtual calls using borrowed links)
+class CCSSTagNodeAdapter {
+ public:
+  typedef const CCSSTagNode *Node;
+
+  static bool isElement(Node node, const CCSSAtom &name) { return node->isElement(name); }
+
+  static bool isClass(Node node, const CCSSAtom &name) { return node->isClass(name); }
+
+  static bool isId(Node node, const CCSSAtom &name) { return node->isId(name); }
+
+  static bool hasAttribute(Node node, const CCSSAtom &name, CCSSAttributeOp op,
+                           const std::string &value) {
+    return node->hasAttribute(name, op, value);
+  }
+
+  static bool getNames(Node node, CCSSTagNames &names) { return node->getNames(names); }
+
+  static bool isNthChild(Node node, int n) { return node->isNthChild(n); }
+
+  static int childIndex(Node node, bool fromEnd) { return node->childIndex(fromEnd); }
+
+  static int typeIndex(Node node, const CCSSAtom &name, bool fromEnd) {
+    return node->typeIndex(name, fromEnd);
+  }
+
+  static bool isInputValue(Node node, const std::string &value) {
+    return node->isInputValue(value);
+  }
+
+  static bool isRoot(Node node) { return ! node->parentNode(); }
+
+  static bool parent(Node node, Node &parent) {
+    parent = node->parentNode();
+
+    return parent;
+  }
+
+  static bool prevSibling(Node node, Node &sibling) {
+    sibling = node->prevSiblingNode();
+
+    return sibling;
+  }
+
+  static uint64_t key(Node node) { return uint64_t(reinterpret_cast<uintptr_t>(node)); }
+};
+
+// adapter for CCSSTagData (virtual calls using shared pointer links).
+//
+// Keys are tag addresses which can be reused if links return new tag data, so
+// only use for checks which don't follow links or for tags which stay alive
+class CCSSTagDataAdapter {
+ public:
+  typedef CCSSTagDataP Node;
+
+  static bool isElement(const Node &node, const CCSSAtom &name) { return node->isElement(name); }
+
+  static bool isClass(const Node &node, const CCSSAtom &name) { return node->isClass(name); }
+
+  static bool isId(const Node &node, const CCSSAtom &name) { return node->isId(name); }
+
+  static bool hasAttribute(const Node &node, const CCSSAtom &name, CCSSAttributeOp op,
+                           const std::string &value) {
+    return node->hasAttribute(name, op, value);
+  }
+
+  static bool getNames(const Node &node, CCSSTagNames &names) { return node->getNames(names); }
+
+  static bool isNthChild(const Node &node, int n) { return node->isNthChild(n); }
+
+  static int childIndex(const Node &node, bool fromEnd) { return node->childIndex(fromEnd); }
+
+  static int typeIndex(const Node &node, const CCSSAtom &name, bool fromEnd) {
+    return node->typeIndex(name, fromEnd);
+  }
+
+  static bool isInputValue(const Node &node, const std::string &value) {
+    return node->isInputValue(value);
+  }
+
+  static bool isRoot(const Node &node) { return ! node->getParent(); }
+
+  static bool parent(const Node &node, Node &parent) {
+    parent = node->getParent();
+
+    return !! parent;
+  }
+
+  static bool prevSibling(const Node &node, Node &sibling) {
+    sibling = node->getPrevSibling();
+
+    return !! sibling;
+  }
+
+  static uint64_t key(const Node &node) {
+    return uint64_t(reinterpret_cast<uintptr_t>(node.get()));
+  }
+};
+
+//---
+
+// set of failed match states (selector index and tag) for one selector list match.
+// Cleared by incrementing a generation number so the table is reused without
+// clearing or reallocating it
+class CCSSMatchMemo {
+ public:
+  CCSSMatchMemo() { }
+
+  void reset() {
+    count_ = 0;
+
+    if (++generation_ == 0) {
+      for (auto &entry : entries_)
+        entry.generation = 0;
+
+      generation_ = 1;
+    }
+  }
+
+  bool contains(uint64_t key, uint state) const {
+    if (count_ == 0) return false;
+
+    std::size_t mask = entries_.size() - 1;
+
+    for (std::size_t i = hash(key, state) & mask; ; i = (i + 1) & mask) {
+      const Entry &entry = entries_[i];
+
+      if (entry.generation != generation_)
+        return false;
+
+      if (entry.key == key && entry.state == state)
+        return true;
+    }
+  }
+
+  void add(uint64_t key, uint state) {
+    // keep table at most half full
+    if (2*(count_ + 1) > entries_.size())
+      grow();
+
+    std::size_t mask = entries_.size() - 1;
+
+    for (std::size_t i = hash(key, state) & mask; ; i = (i + 1) & mask) {
+      Entry &entry = entries_[i];
+
+      if (entry.generation != generation_) {
+        entry.key        = key;
+        entry.state      = state;
+        entry.generation = generation_;
+
+        ++count_;
+
+        return;
+      }
+
+      if (entry.key == key && entry.state == state)
+        return;
+    }
+  }
+
+ private:
+  struct Entry {
+    uint64_t key        { 0 };
+    uint     state      { 0 };
+    uint     generation { 0 };
+  };
+
+  typedef std::vector<Entry> Entries;
+
+  static std::size_t hash(uint64_t key, uint state) {
+    uint64_t h = (key ^ (uint64_t(state) << 48))*0x9e3779b97f4a7c15ULL;
+
+    return std::size_t(h >> 20);
+  }
+
+  void grow() {
+    Entries entries;
+
+    entries.swap(entries_);
+
+    entries_.resize(std::max(std::size_t(64), 2*entries.size()));
+
+    uint generation = generation_;
+
+    generation_ = 1;
+    count_      = 0;
+
+    for (const auto &entry : entries)
+      if (entry.generation == generation)
+        add(entry.key, entry.state);
+  }
+
+ private:
+  Entries entries_;
+  uint    count_      { 0 };
+  uint    generation_ { 1 };
+};
+
+// right to left selector list matcher with backtracking.
+//
+// Failed states are remembered so each (selector, tag) pair is tried at most once
+// and each ancestor or previous sibling is scanned at most once per selector, so
+// the cost is bounded by number of selectors times the tree depth (or number of
+// siblings). Any success ends the whole match so failures can be recorded eagerly.
+//
+// Selectors is any indexed list (empty, size, operator[]) of selectors with nextType
+// and checkMatch(adapter, node), e.g. the selectors of a mapped binary stylesheet
+template<typename Adapter, typename Selectors=CCSS::SelectorList::Selectors>
+class CCSSSelectorMatcher {
+ public:
+  typedef typename Adapter::Node Node;
+  typedef CCSS::NextType         NextType;
+
+  typedef std::decay_t<decltype(std::declval<const Selectors &>()[0])> Selector;
+
+ public:
+  CCSSSelectorMatcher(const Selectors &selectors, const Adapter &adapter) :
+   selectors_(selectors), adapter_(adapter) {
+  }
+
+  static_assert(CCSSIsTagAdapter<Adapter>::value, "invalid CCSS tag adapter");
+
+ public:
+  bool match(const Node &pos) {
+    if (selectors_.empty())
+      return false;
+
+    uint n = uint(selectors_.size());
+
+    if (! selectors_[n - 1].checkMatch(adapter_, pos))
+      return false;
+
+    rightmostMatched_ = true;
+
+    // states can only be reached twice with two or more combinators
+    if (n > 2) {
+      memo_ = &memo();
+
+      memo_->reset();
+    }
+
+    return matchBefore(n - 1, pos);
+  }
+
+  // true if last match got past the rightmost compound selector
+  bool isRightmostMatched() const { return rightmostMatched_; }
+
+ private:
+  // kinds of remembered failure
+  enum { MATCH_FAILED = 0, SCAN_FAILED = 1 };
+
+  // selector i matches tag at pos so check selectors before it
+  bool matchBefore(uint i, const Node &pos) {
+    if (i == 0)
+      return true;
+
+    uint64_t key = adapter_.key(pos);
+
+    if (isFailed(key, i, MATCH_FAILED))
+      return false;
+
+    const Selector &selector = selectors_[i - 1];
+
+    bool rc = false;
+
+    Node pos1;
+
+    switch (selector.nextType()) {
+      case NextType::DESCENDANT: {
+        // any ancestor matches selector
+        bool found = adapter_.parent(pos, pos1);
+
+        while (found && ! rc) {
+          if (scanStep(pos1, i - 1, selector, rc))
+            break;
+
+          found = adapter_.parent(Node(pos1), pos1);
+        }
+
+        break;
+      }
+      case NextType::CHILD: {
+        // parent matches selector
+        if (adapter_.parent(pos, pos1))
+          rc = (selector.checkMatch(adapter_, pos1) && matchBefore(i - 1, pos1));
+
+        break;
+      }
+      case NextType::SIBLING: {
+        // previous sibling matches selector
+        if (adapter_.prevSibling(pos, pos1))
+          rc = (selector.checkMatch(adapter_, pos1) && matchBefore(i - 1, pos1));
+
+        break;
+      }
+      case NextType::PRECEDER: {
+        // any previous sibling matches selector
+        bool found = adapter_.prevSibling(pos, pos1);
+
+        while (found && ! rc) {
+          if (scanStep(pos1, i - 1, selector, rc))
+            break;
+
+          found = adapter_.prevSibling(Node(pos1), pos1);
+        }
+
+        break;
+      }
+      default:
+        break;
+    }
+
+    if (! rc)
+      setFailed(key, i, MATCH_FAILED);
+
+    return rc;
+  }
+
+  // check tag at pos in ancestor or sibling scan for selector i.
+  // returns true if scan should stop (rc set on match)
+  bool scanStep(const Node &pos, uint i, const Selector &selector, bool &rc) {
+    uint64_t key = adapter_.key(pos);
+
+    // already scanned from here with no match
+    if (isFailed(key, i, SCAN_FAILED))
+      return true;
+
+    if (selector.checkMatch(adapter_, pos) && matchBefore(i, pos)) {
+      rc = true;
+      return true;
+    }
+
+    setFailed(key, i, SCAN_FAILED);
+
+    return false;
+  }
+
+  bool isFailed(uint64_t key, uint i, uint kind) const {
+    return (memo_ && memo_->contains(key, 2*i + kind));
+  }
+
+  void setFailed(uint64_t key, uint i, uint kind) {
+    if (memo_)
+      memo_->add(key, 2*i + kind);
+  }
+
+  // per thread memo table (reused by each match)
+  static CCSSMatchMemo &memo() {
+    static thread_local CCSSMatchMemo memo;
+
+    return memo;
+  }
+
+ private:
+  const Selectors &selectors_;
+  const Adapter   &adapter_;
+  CCSSMatchMemo   *memo_ { nullptr };
+  bool             rightmostMatched_ { false };
+};
+
+//---
+
+// check tag matches selector (simple selector only, combinators are handled by
+// CCSSSelectorMatcher)
+template<typename Adapter>
+bool
+CCSS::Selector::
+checkMatch(const Adapter &adapter, const typename Adapter::Node &node) const
+{
+  // check name
+  if (! isUniversal()) {
+    if (! adapter.isElement(node, name_))
+      return false;
+  }
+
+  //---
+
+  // check ids
+  if (! idNames_.empty()) {
+    // must match all
+    bool match = true;
+
+    for (const auto &idName : idNames_) {
+      if (! adapter.isId(node, idName)) {
+        match = false;
+        break;
+      }
+    }
+
+    if (! match)
+      return false;
+  }
+
+  //---
+
+  // check classes
+  if (! classNames_.empty()) {
+    // must match all
+    bool match = true;
+
+    for (const auto &className : classNames_) {
+      if (! adapter.isClass(node, className)) {
+        match = false;
+        break;
+      }
+    }
+
+    if (! match)
+      return false;
+  }
+
+  //---
+
+  // check expressions
+  if (! exprs_.empty()) {
+    // must match all
+    bool match = true;
+
+    for (const auto &expr : exprs_) {
+      if (! adapter.hasAttribute(node, expr.idAtom(), expr.op(), expr.value())) {
+        match = false;
+        break;
+      }
+    }
+
+    if (! match)
+      return false;
+  }
+
+  //---
+
+  // check functions (must match all, unsupported functions are ignored)
+  if (! compiledFns_.empty()) {
+    CCSSAtom typeName = (! isUniversal() ? name_ : CCSSAtom());
+
+    for (const auto &fn : compiledFns_) {
+      if (! fn.checkMatch(adapter, node, typeName))
+        return false;
+    }
+  }
+
+  //---
+
+  return true;
+}
+
+//---
+
+// check tag matches function. typeName is the element name of the selector (empty
+// if universal) used by the of-type functions
+template<typename Adapter>
+bool
+CCSS::Function::
+checkMatch(const Adapter &adapter, const typename Adapter::Node &node,
+           const CCSSAtom &typeName) const
+{
+  switch (type_) {
+    case FunctionType::UNKNOWN:
+      break;
+    case FunctionType::BAD_EXPR:
+      return false;
+    case FunctionType::NTH_CHILD:
+      // plain index uses tag's nth child check
+      if (nthExpr_.a() == 0)
+        return adapter.isNthChild(node, nthExpr_.b());
+
+      return nthExpr_.isMatch(adapter.childIndex(node, false));
+    case FunctionType::NTH_LAST_CHILD:
+      return nthExpr_.isMatch(adapter.childIndex(node, /*fromEnd*/true));
+    case FunctionType::FIRST_CHILD:
+      return (adapter.childIndex(node, false) == 1);
+    case FunctionType::LAST_CHILD:
+      return (adapter.childIndex(node, /*fromEnd*/true) == 1);
+    case FunctionType::ONLY_CHILD:
+      return (adapter.childIndex(node, false) == 1 &&
+              adapter.childIndex(node, /*fromEnd*/true) == 1);
+    case FunctionType::NTH_OF_TYPE:
+    case FunctionType::NTH_LAST_OF_TYPE:
+    case FunctionType::FIRST_OF_TYPE:
+    case FunctionType::LAST_OF_TYPE:
+    case FunctionType::ONLY_OF_TYPE: {
+      // type is selector element name or tag's element name
+      CCSSAtom typeName1 = typeName;
+
+      if (typeName1.empty()) {
+        CCSSTagNames names;
+
+        if (! adapter.getNames(node, names) || names.element.empty())
+          return false;
+
+        typeName1 = names.element;
+      }
+
+      if      (type_ == FunctionType::NTH_OF_TYPE)
+        return nthExpr_.isMatch(adapter.typeIndex(node, typeName1, /*fromEnd*/false));
+      else if (type_ == FunctionType::NTH_LAST_OF_TYPE)
+        return nthExpr_.isMatch(adapter.typeIndex(node, typeName1, /*fromEnd*/true));
+
+      if (type_ != FunctionType::LAST_OF_TYPE &&
+          adapter.typeIndex(node, typeName1, /*fromEnd*/false) != 1)
+        return false;
+
+      if (type_ != FunctionType::FIRST_OF_TYPE &&
+          adapter.typeIndex(node, typeName1, /*fromEnd*/true) != 1)
+        return false;
+
+      break;
+    }
+    case FunctionType::ROOT:
+      return adapter.isRoot(node);
+    case FunctionType::REQUIRED:
+      return adapter.isInputValue(node, "required");
+    case FunctionType::INVALID:
+      return adapter.isInputValue(node, "invalid");
+  }
+
+  return true;
+}
+
+//---
+
+template<typename Adapter>
+bool
+CCSS::StyleData::
+checkMatch(const Adapter &adapter, const typename Adapter::Node &node) const
+{
+  CCSSSelectorMatcher<Adapter> matcher(selectorList_.selectors(), adapter);
+
+  return matcher.match(node);
+}
+
+template<typename Adapter>
+bool
+CCSS::StyleData::
+checkMatch(const Adapter &adapter, const typename Adapter::Node &node, RuleStats &stats) const
+{
+  typedef std::chrono::steady_clock Clock;
+
+  Clock::time_point t1 = Clock::now();
+
+  CCSSSelectorMatcher<Adapter> matcher(selectorList_.selectors(), adapter);
+
+  bool rc = matcher.match(node);
+
+  Clock::time_point t2 = Clock::now();
+
+  ++stats.attempts;
+
+  if      (! matcher.isRightmostMatched())
+    ++stats.rightmostRejects;
+  else if (selectorList_.selectors().size() > 1)
+    ++stats.combinatorWalks;
+
+  if (rc)
+    ++stats.matches;
+
+  stats.time += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count());
+
+  return rc;
+}
+
+//---
+
+template<typename Adapter>
+bool
+CCSS::CompiledSelector::
+checkMatch(const Adapter &adapter, const typename Adapter::Node &node) const
+{
+  static_assert(CCSSIsTagAdapter<Adapter>::value, "invalid CCSS tag adapter");
+
+  switch (fastPath_) {
+    case FastPath::ID     : return adapter.isId     (node, fastName_);
+    case FastPath::CLASS  : return adapter.isClass  (node, fastName_);
+    case FastPath::ELEMENT: return adapter.isElement(node, fastName_);
+    default               : break;
+  }
+
+  for (const auto &selectorList : selectorLists_) {
+    CCSSSelectorMatcher<Adapter> matcher(selectorList.selectors(), adapter);
+
+    if (matcher.match(node))
+      return true;
+  }
+
+  return false;
+}
+
+//---
+
+template<typename Adapter>
+void
+CCSS::
+match(const typename Adapter::Node &node, StyleDataArray &styles, const Adapter &adapter) const
+{
+  static_assert(CCSSIsTagAdapter<Adapter>::value, "invalid CCSS tag adapter");
+
+  CCSSTagNames names;
+
+  bool hasNames = adapter.getNames(node, names);
+
+  bool useStats = ruleStats_.isEnabled();
+
+  auto checkRule = [&](const StyleData &styleData) {
+    if (useStats)
+      return checkRuleStats(styleData, nullptr, adapter, node);
+
+    return styleData.checkMatch(adapter, node);
+  };
+
+  // use match cache for rules which only check names
+  uint64_t ancestorsHash;
+
+  if (hasNames && matchCache_.isEnabled() && getAncestorsHash(adapter, node, ancestorsHash)) {
+    SharedRules rules;
+    RuleKeys    matched;
+
+    matchSharedRules(&names, &ancestorsHash, checkRule, rules, matched);
+
+    for (const auto &key : matched)
+      styles.push_back(&styleData_[uint(key & 0xffffffff)]);
+
+    return;
+  }
+
+  //---
+
+  RuleKeys keys;
+
+  getCandidateRules(hasNames ? &names : nullptr, keys);
+
+  for (const auto &key : keys) {
+    const StyleData &styleData = styleData_[uint(key & 0xffffffff)];
+
+    if (checkRule(styleData))
+      styles.push_back(&styleData);
+  }
+}
+
+template<typename Adapter>
+void
+CCSS::
+match(const typename Adapter::Node &node, const MatchContext &context,
+      StyleDataArray &styles, const Adapter &adapter) const
+{
+  static_assert(CCSSIsTagAdapter<Adapter>::value, "invalid CCSS tag adapter");
+
+  CCSSTagNames names;
+
+  bool hasNames = adapter.getNames(node, names);
+
+  const AncestorFilter &filter = context.ancestorFilter();
+
+  bool useFilter = filter.isValid();
+
+  bool useStats = ruleStats_.isEnabled();
+
+  auto checkRule = [&](const StyleData &styleData) {
+    if (useStats)
+      return checkRuleStats(styleData, useFilter ? &filter : nullptr, adapter, node);
+
+    return ((! useFilter || styleData.checkAncestorFilter(filter)) &&
+            styleData.checkMatch(adapter, node));
+  };
+
+  //---
+
+  // last tag with same names and ancestor names has the same candidate rules and the
+  // same result for rules shared by chain (and rules shared by parent if same parent)
+  StyleShareCache &shareCache = context.shareCache();
+
+  StyleShareCache::Entry *entry =
+    (hasNames ? shareCache.lookup(ruleVersion_.id(), names) : nullptr);
+
+  if (entry && entry->valid) {
+    bool sameParent = (entry->parent == shareCache.parent());
+
+    const SharedRules &rules = entry->rules;
+
+    RuleKeys keys = rules.chainMatched;
+
+    if (sameParent)
+      keys.insert(keys.end(), entry->siblingMatched.begin(), entry->siblingMatched.end());
+    else
+      entry->siblingMatched.clear();
+
+    for (const auto &key : rules.checkKeys) {
+      const StyleData &styleData = styleData_[uint(key & 0xffffffff)];
+
+      bool isSibling = (styleData.shareType() == StyleData::ShareType::SIBLING);
+
+      if (isSibling && sameParent)
+        continue;
+
+      if (! checkRule(styleData))
+        continue;
+
+      keys.push_back(key);
+
+      if (isSibling)
+        entry->siblingMatched.push_back(key);
+    }
+
+    entry->parent = shareCache.parent();
+
+    std::sort(keys.begin(), keys.end());
+
+    for (const auto &key : keys)
+      styles.push_back(&styleData_[uint(key & 0xffffffff)]);
+
+    return;
+  }
+
+  //---
+
+  // get rules (from match cache if enabled)
+  uint64_t ancestorsHash;
+
+  bool useCache = (hasNames && matchCache_.isEnabled() && context.ancestorsHash(ancestorsHash));
+
+  SharedRules  rules1;
+  SharedRules &rules = (entry ? entry->rules : rules1);
+
+  RuleKeys matched;
+
+  matchSharedRules(hasNames ? &names : nullptr, useCache ? &ancestorsHash : nullptr,
+                   checkRule, rules, matched);
+
+  if (entry) {
+    entry->parent = shareCache.parent();
+    entry->valid  = true;
+
+    entry->siblingMatched.clear();
+  }
+
+  for (const auto &key : matched) {
+    const StyleData &styleData = styleData_[uint(key & 0xffffffff)];
+
+    if (entry && styleData.shareType() == StyleData::ShareType::SIBLING)
+      entry->siblingMatched.push_back(key);
+
+    styles.push_back(&styleData);
+  }
+}
+
+template<typename Adapter>
+CCSS::StyleDataArray
+CCSS::
+match(const typename Adapter::Node &node, const Adapter &adapter) const
+{
+  StyleDataArray styles;
+
+  match(node, styles, adapter);
+
+  return styles;
+}
+
+template<typename Adapter>
+bool
+CCSS::
+checkRuleStats(const StyleData &styleData, const AncestorFilter *filter,
+               const Adapter &adapter, const typename Adapter::Node &node) const
+{
+  RuleStats stats;
+
+  bool rc = false;
+
+  if (filter && ! styleData.checkAncestorFilter(*filter)) {
+    ++stats.attempts;
+    ++stats.filtered;
+  }
+  else
+    rc = styleData.checkMatch(adapter, node, stats);
+
+  ruleStats_.add(styleData.order(), stats);
+
+  return rc;
+}
+
+//---
+
+template<typename CheckRule>
+void
+CCSS::
+matchSharedRules(const CCSSTagNames *names, const uint64_t *ancestorsHash,
+                 const CheckRule &checkRule, SharedRules &rules, RuleKeys &matched) const
+{
+  std::vector<uint> namesKey;
+
+  if (ancestorsHash) {
+    getNamesKey(*names, namesKey);
+
+    if (matchCache_.lookup(namesKey, *ancestorsHash, ruleVersion_.id(), rules)) {
+      matched = rules.chainMatched;
+
+      for (const auto &key : rules.checkKeys) {
+        if (checkRule(styleData_[uint(key & 0xffffffff)]))
+          matched.push_back(key);
+      }
+
+      std::sort(matched.begin(), matched.end());
+
+      return;
+    }
+  }
+
+  //---
+
+  RuleKeys keys;
+
+  getCandidateRules(names, keys);
+
+  rules.checkKeys   .clear();
+  rules.chainMatched.clear();
+
+  for (const auto &key : keys) {
+    const StyleData &styleData = styleData_[uint(key & 0xffffffff)];
+
+    bool isChain = (styleData.shareType() == StyleData::ShareType::CHAIN);
+
+    if (! isChain)
+      rules.checkKeys.push_back(key);
+
+    if (! checkRule(styleData))
+      continue;
+
+    matched.push_back(key);
+
+    if (isChain)
+      rules.chainMatched.push_back(key);
+  }
+
+  if (ancestorsHash)
+    matchCache_.add(namesKey, *ancestorsHash, ruleVersion_.id(), rules);
+}
+
+template<typename Adapter>
+bool
+CCSS::
+getAncestorsHash(const Adapter &adapter, const typename Adapter::Node &node,
+                 uint64_t &hash) const
+{
+  typedef typename Adapter::Node Node;
+
+  std::vector<Node> ancestors;
+
+  Node node1 = node, parent;
+
+  while (adapter.parent(node1, parent)) {
+    ancestors.push_back(parent);
+
+    node1 = parent;
+  }
+
+  if (ancestors.empty())
+    return false;
+
+  // hash names from root down (same as MatchContext)
+  hash = rootAncestorsHash;
+
+  CCSSTagNames      names;
+  std::vector<uint> namesKey;
+
+  for (auto p = ancestors.rbegin(); p != ancestors.rend(); ++p) {
+    names = CCSSTagNames();
+
+    if (! adapter.getNames(*p, names))
+      return false;
+
+    getNamesKey(names, namesKey);
+
+    hash = addAncestorHash(hash, namesKey);
+  }
+
+  return true;
+}
+
+#endif
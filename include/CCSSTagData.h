@@ -1,6 +1,7 @@
 #ifndef CCSSTagData_H
 #define CCSSTagData_H
 
+#include <CCSSAtom.h>
 #include <vector>
 #include <memory>
 
@@ -20,6 +21,15 @@ enum class CCSSAttributeOp {
 
 //---
 
+// names of tag used to find the rules which could match it
+struct CCSSTagNames {
+  CCSSAtom  element; // element (tag) name
+  CCSSAtoms ids;     // id names
+  CCSSAtoms classes; // class names
+};
+
+//---
+
 class CCSSTagData {
  public:
   typedef std::vector<CCSSTagDataP> TagDataArray;
@@ -38,8 +48,58 @@ class CCSSTagData {
   virtual bool hasAttribute(const std::string &name, CCSSAttributeOp op,
                             const std::string &value) const = 0;
 
+  // atom versions of name checks (called by the selector matching).
+  // default to the string versions, override to compare atoms directly
+  virtual bool isElement(const CCSSAtom &name) const { return isElement(name.str()); }
+
+  virtual bool isClass(const CCSSAtom &name) const { return isClass(name.str()); }
+
+  virtual bool isId(const CCSSAtom &name) const { return isId(name.str()); }
+
+  virtual bool hasAttribute(const CCSSAtom &name, CCSSAttributeOp op,
+                            const std::string &value) const {
+    return hasAttribute(name.str(), op, value);
+  }
+
+  // get element, id and class names of tag (used to only check rules which could match).
+  // return false if not supported, in which case all rules are checked
+  virtual bool getNames(CCSSTagNames &) const { return false; }
+
   virtual bool isNthChild(int n) const = 0;
 
+  // 1-based index of tag in its parent's children (counted from last child if fromEnd).
+  // default counts siblings
+  virtual int childIndex(bool fromEnd=false) const {
+    int ind = 1;
+
+    CCSSTagDataP sibling = (fromEnd ? getNextSibling() : getPrevSibling());
+
+    while (sibling) {
+      ++ind;
+
+      sibling = (fromEnd ? sibling->getNextSibling() : sibling->getPrevSibling());
+    }
+
+    return ind;
+  }
+
+  // 1-based index of tag in its parent's children with the specified element name
+  // (counted from last child if fromEnd). default counts siblings
+  virtual int typeIndex(const CCSSAtom &name, bool fromEnd=false) const {
+    int ind = 1;
+
+    CCSSTagDataP sibling = (fromEnd ? getNextSibling() : getPrevSibling());
+
+    while (sibling) {
+      if (sibling->isElement(name))
+        ++ind;
+
+      sibling = (fromEnd ? sibling->getNextSibling() : sibling->getPrevSibling());
+    }
+
+    return ind;
+  }
+
   virtual bool isInputValue(const std::string &value) const = 0;
 
   virtual CCSSTagDataP getParent() const = 0;
@@ -0,0 +1,254 @@
+#ifndef CCSSTagNode_H
+#define CCSSTagNode_H
+
+#include <CCSSTagData.h>
+#include <deque>
+#include <memory>
+
+// Interface class to check if css selector matches tag using borrowed pointers.
+//
+// Unlike CCSSTagData the links to other tags are plain pointers owned by the
+// document, so walking the tree during matching does no reference counting.
+// Tags must stay valid (and unchanged) while they are being matched
+class CCSSTagNode {
+ public:
+  CCSSTagNode() { }
+
+  virtual ~CCSSTagNode() { }
+
+  virtual bool isElement(const CCSSAtom &name) const = 0;
+
+  virtual bool isClass(const CCSSAtom &name) const = 0;
+
+  virtual bool isId(const CCSSAtom &name) const = 0;
+
+  virtual bool hasAttribute(const CCSSAtom &name, CCSSAttributeOp op,
+                            const std::string &value) const = 0;
+
+  // get element, id and class names of tag (used to only check rules which could match).
+  // return false if not supported, in which case all rules are checked
+  virtual bool getNames(CCSSTagNames &) const { return false; }
+
+  virtual bool isNthChild(int n) const { return childIndex() == n; }
+
+  // 1-based index of tag in its parent's children (counted from last child if fromEnd).
+  // default counts siblings
+  virtual int childIndex(bool fromEnd=false) const {
+    int ind = 1;
+
+    for (const CCSSTagNode *sibling = nextNode(this, fromEnd); sibling;
+           sibling = nextNode(sibling, fromEnd))
+      ++ind;
+
+    return ind;
+  }
+
+  // 1-based index of tag in its parent's children with the specified element name
+  // (counted from last child if fromEnd). default counts siblings
+  virtual int typeIndex(const CCSSAtom &name, bool fromEnd=false) const {
+    int ind = 1;
+
+    for (const CCSSTagNode *sibling = nextNode(this, fromEnd); sibling;
+           sibling = nextNode(sibling, fromEnd)) {
+      if (sibling->isElement(name))
+        ++ind;
+    }
+
+    return ind;
+  }
+
+  virtual bool isInputValue(const std::string &value) const = 0;
+
+  // linked tags (null if none)
+  virtual const CCSSTagNode *parentNode() const = 0;
+
+  virtual const CCSSTagNode *prevSiblingNode() const = 0;
+
+  virtual const CCSSTagNode *nextSiblingNode() const = 0;
+
+  virtual const CCSSTagNode *firstChildNode() const = 0;
+
+ private:
+  static const CCSSTagNode *nextNode(const CCSSTagNode *node, bool fromEnd) {
+    return (fromEnd ? node->nextSiblingNode() : node->prevSiblingNode());
+  }
+};
+
+//---
+
+// CCSSTagNode for a CCSSTagData (so shared_ptr tag data can be matched as nodes).
+//
+// Nodes for linked tags are created when first needed and are owned by the node the
+// adapter was created for, so are valid as long as it is. Each linked tag is only
+// fetched once so matching many rules against the same tag reuses its ancestors
+class CCSSTagDataNode : public CCSSTagNode {
+ public:
+  explicit CCSSTagDataNode(const CCSSTagDataP &data);
+
+  // node for tag linked to a node of owner (stored in owner's arena)
+  CCSSTagDataNode(const CCSSTagDataP &data, const CCSSTagDataNode *owner) :
+   data_(data), owner_(owner) {
+  }
+
+  CCSSTagDataNode(const CCSSTagDataNode &) = delete;
+  CCSSTagDataNode &operator=(const CCSSTagDataNode &) = delete;
+
+  const CCSSTagDataP &data() const { return data_; }
+
+  bool isElement(const CCSSAtom &name) const override { return data_->isElement(name); }
+
+  bool isClass(const CCSSAtom &name) const override { return data_->isClass(name); }
+
+  bool isId(const CCSSAtom &name) const override { return data_->isId(name); }
+
+  bool hasAttribute(const CCSSAtom &name, CCSSAttributeOp op,
+                    const std::string &value) const override {
+    return data_->hasAttribute(name, op, value);
+  }
+
+  bool getNames(CCSSTagNames &names) const override { return data_->getNames(names); }
+
+  bool isNthChild(int n) const override { return data_->isNthChild(n); }
+
+  int childIndex(bool fromEnd=false) const override { return data_->childIndex(fromEnd); }
+
+  int typeIndex(const CCSSAtom &name, bool fromEnd=false) const override {
+    return data_->typeIndex(name, fromEnd);
+  }
+
+  bool isInputValue(const std::string &value) const override {
+    return data_->isInputValue(value);
+  }
+
+  const CCSSTagNode *parentNode() const override {
+    if (parentSet_)
+      return parent_;
+
+    // siblings share parent so use first sibling with known parent
+    const CCSSTagDataNode *node = this;
+
+    while (! node->parentSet_ && node->siblingOf_)
+      node = node->siblingOf_;
+
+    const CCSSTagNode *parent = node->parent_;
+
+    if (! node->parentSet_)
+      parent = addNode(node->data_->getParent());
+
+    for (node = this; node && ! node->parentSet_; node = node->siblingOf_) {
+      node->parent_    = parent;
+      node->parentSet_ = true;
+    }
+
+    return parent_;
+  }
+
+  const CCSSTagNode *prevSiblingNode() const override {
+    if (! prevSet_) {
+      prev_ = addNode(data_->getPrevSibling());
+
+      if (prev_) {
+        prev_->setSiblingOf(this);
+
+        prev_->next_    = this;
+        prev_->nextSet_ = true;
+      }
+
+      prevSet_ = true;
+    }
+
+    return prev_;
+  }
+
+  const CCSSTagNode *nextSiblingNode() const override {
+    if (! nextSet_) {
+      next_ = addNode(data_->getNextSibling());
+
+      if (next_) {
+        next_->setSiblingOf(this);
+
+        next_->prev_    = this;
+        next_->prevSet_ = true;
+      }
+
+      nextSet_ = true;
+    }
+
+    return next_;
+  }
+
+  const CCSSTagNode *firstChildNode() const override {
+    if (! childSet_) {
+      CCSSTagData::TagDataArray children;
+
+      data_->getChildren(children);
+
+      child_ = (! children.empty() ? addNode(children[0]) : nullptr);
+
+      if (child_) {
+        child_->parent_    = this;
+        child_->parentSet_ = true;
+      }
+
+      childSet_ = true;
+    }
+
+    return child_;
+  }
+
+ private:
+  struct Arena;
+
+  const CCSSTagDataNode *addNode(const CCSSTagDataP &data) const;
+
+  void setSiblingOf(const CCSSTagDataNode *node) const {
+    if (node->parentSet_) {
+      parent_    = node->parent_;
+      parentSet_ = true;
+    }
+    else
+      siblingOf_ = node;
+  }
+
+ private:
+  CCSSTagDataP           data_;
+  std::unique_ptr<Arena> arena_;                // nodes for linked tags (if owner)
+  const CCSSTagDataNode *owner_ { nullptr };    // node owning arena (if linked)
+
+  mutable const CCSSTagNode     *parent_    { nullptr };
+  mutable const CCSSTagDataNode *prev_      { nullptr };
+  mutable const CCSSTagDataNode *next_      { nullptr };
+  mutable const CCSSTagDataNode *child_     { nullptr };
+  mutable const CCSSTagDataNode *siblingOf_ { nullptr };
+  mutable bool                   parentSet_ { false };
+  mutable bool                   prevSet_   { false };
+  mutable bool                   nextSet_   { false };
+  mutable bool                   childSet_  { false };
+};
+
+// nodes created for linked tags (deque so they don't move)
+struct CCSSTagDataNode::Arena {
+  std::deque<CCSSTagDataNode> nodes;
+};
+
+inline
+CCSSTagDataNode::
+CCSSTagDataNode(const CCSSTagDataP &data) :
+ data_(data), arena_(new Arena)
+{
+}
+
+inline const CCSSTagDataNode *
+CCSSTagDataNode::
+addNode(const CCSSTagDataP &data) const
+{
+  if (! data) return nullptr;
+
+  const CCSSTagDataNode *owner = (arena_ ? this : owner_);
+
+  owner->arena_->nodes.emplace_back(data, owner);
+
+  return &owner->arena_->nodes.back();
+}
+
+#endif
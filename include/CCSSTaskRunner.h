@@ -0,0 +1,32 @@
+#ifndef CCSSTaskRunner_H
+#define CCSSTaskRunner_H
+
+#include <functional>
+#include <sys/types.h>
+
+// Runs a set of independent tasks on a number of threads.
+//
+// Tasks are split into contiguous blocks, one per thread, and each thread runs
+// its own block in order. A thread which runs out of work steals a task from the
+// end of the next non-empty block after its own (in worker order), so stolen tasks
+// are those the block's owner would run last. The calling thread is worker zero.
+class CCSSTaskRunner {
+ public:
+  // task index and index of worker running it (for per worker scratch data)
+  typedef std::function<void (uint task, uint worker)> TaskProc;
+
+ public:
+  // zero threads uses number of hardware threads
+  explicit CCSSTaskRunner(uint numThreads=0);
+
+  uint numThreads() const { return numThreads_; }
+
+  // run tasks 0 to numTasks - 1 and wait for them to finish.
+  // if a task throws the first exception is rethrown after all threads finish
+  void run(uint numTasks, const TaskProc &proc) const;
+
+ private:
+  uint numThreads_ { 1 };
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef CCSSTokenizer_H
+#define CCSSTokenizer_H
+
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+
+// Tokenizer for css text.
+//
+// Tokens are returned as spans into the source text which is not owned or copied,
+// so it can parse directly from a mapped file or any other buffer which outlives
+// the tokenizer. Strings are only created by the caller when it needs to keep them.
+class CCSSTokenizer {
+ public:
+  enum class Type {
+    NONE,
+    SPACE,    // white space and/or comments
+    IDENT,    // name (element, class, property, ...)
+    HASH,     // '#' <name>
+    STRING,   // quoted string (text excludes quotes)
+    FUNCTION, // <name> '(' (text excludes '(')
+    DELIM     // any other single char
+  };
+
+  struct Token {
+    Type             type { Type::NONE };
+    std::string_view str;
+    char             c    { '\0' };
+
+    bool isDelim(char c1) const { return (type == Type::DELIM && c == c1); }
+  };
+
+ public:
+  explicit CCSSTokenizer(std::string_view str) :
+   str_(str) {
+  }
+
+  std::string_view str() const { return str_; }
+
+  std::size_t pos() const { return pos_; }
+  void setPos(std::size_t pos) { pos_ = std::min(pos, str_.size()); }
+
+  bool eof() const { return pos_ >= str_.size(); }
+
+  char getChar() const { return (! eof() ? str_[pos_] : '\0'); }
+
+  bool isChar(char c) const { return (! eof() && str_[pos_] == c); }
+
+  bool isOneOf(const char *chars) const {
+    return (! eof() && isOneOf(str_[pos_], chars));
+  }
+
+  bool skipChar() {
+    if (eof()) return false;
+
+    ++pos_;
+
+    return true;
+  }
+
+  // skip white space and comments (returns true if anything skipped)
+  bool skipSpace();
+
+  // read next token
+  Token nextToken();
+
+  // read name chars at current position
+  std::string_view readIdent();
+
+  // read raw text up to first of chars which is not inside a string,
+  // comment or () [] pair
+  std::string_view readUntil(const char *chars);
+
+  // text around current position (for error messages)
+  std::string stateStr() const;
+
+  //---
+
+  static bool isIdentChar(char c) {
+    return (isalnum(uchar(c)) || c == '-' || c == '_' || c == '@' || uchar(c) >= 0x80);
+  }
+
+  static bool isOneOf(char c, const char *chars) {
+    for ( ; *chars; ++chars)
+      if (*chars == c) return true;
+
+    return false;
+  }
+
+  static std::string_view trim(std::string_view str);
+
+  static bool hasComment(std::string_view str) {
+    return (str.find("/*") != std::string_view::npos);
+  }
+
+  static std::string stripComments(std::string_view str);
+
+ private:
+  typedef unsigned char uchar;
+
+  bool isComment() const { return (str_.compare(pos_, 2, "/*") == 0); }
+
+  void skipComment();
+
+  std::string_view readString();
+
+ private:
+  std::string_view str_;
+  std::size_t      pos_ { 0 };
+};
+
+#endif
@@ -1,11 +1,19 @@
 #include <CCSS.h>
+#include <CCSSMatch.h>
+#include <CCSSTokenizer.h>
+#include <CCSSTaskRunner.h>
 #include <CXML.h>
 #include <CXMLParser.h>
 #include <CFile.h>
-#include <CStrUtil.h>
-#include <CStrParse.h>
-#include <CRegExp.h>
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstring>
+#include <iomanip>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 CCSS::
 CCSS()
@@ -21,31 +29,36 @@ processFile(const std::string &filename)
     return false;
   }
 
-  CFile file(filename);
+  // map file and parse directly from mapped text
+  SourceP source = Source::mapFile(filename);
 
-  std::string str;
-
-  std::string line;
-
-  while (file.readLine(line)) {
-    line = CStrUtil::stripSpaces(line);
+  if (! source) {
+    errorMsg("Failed to read file '" + filename + "'");
+    return false;
+  }
 
-    if (line.empty())
-      continue;
+  std::string_view text = source->text();
 
-    if (! str.empty())
-      str += "\n";
+  // precompiled rules (see saveBinary)
+  if (isBinary(text)) {
+    if (! loadBinarySource(source)) {
+      errorMsg("Invalid binary file '" + filename + "'");
+      return false;
+    }
 
-    str += line;
+    return true;
   }
 
-  CXML xml;
+  // replace named chars (rare) into owned text
+  if (memchr(text.data(), '&', text.size())) {
+    CXML xml;
 
-  CXMLParser parser(xml);
+    CXMLParser parser(xml);
 
-  std::string str1 = parser.replaceNamedChars(str);
+    source = std::make_shared<Source>(parser.replaceNamedChars(std::string(text)));
+  }
 
-  processLine(str1);
+  processSource(source);
 
   return true;
 }
@@ -59,1037 +72,3476 @@ processLine(const std::string &line)
 
 bool
 CCSS::
-parseSelector(const std::string &id, std::vector<StyleData> &styles)
+processSource(const SourceP &source)
+{
+  // keep source alive for lifetime of stylesheet
+  sources_.push_back(source);
+
+  return parse(source->text());
+}
+
+bool
+CCSS::
+parseSelector(const std::string &id, std::vector<StyleData> &styles) const
 {
-  CStrParse parse(id);
+  CCSSTokenizer tokenizer(id);
 
-  // get ids
-  IdListList idListList;
+  // get selectors
+  SelectorLists selectorLists;
 
-  if (! parseIdListList(parse, idListList))
+  if (! parseSelectorLists(tokenizer, selectorLists))
     return false;
 
-  // add selector for each comma separated id
-  for (const auto &idList : idListList) {
-    SelectorList selectorList;
+  // add existing (or empty) style for each comma separated selector
+  for (const auto &selectorList : selectorLists) {
+    const StyleData *styleData1 = findStyleData(selectorList);
 
-    // add part for each space separator or child operator separated id
-    for (const auto &id1 : idList) {
-      Selector selector;
+    styles.push_back(styleData1 ? *styleData1 : StyleData(selectorList));
+  }
 
-      addSelectorParts(selector, id1);
+  return true;
+}
 
-      selectorList.addSelector(selector);
-    }
+bool
+CCSS::
+compileSelector(const std::string &text, CompiledSelector &selector) const
+{
+  CCSSTokenizer tokenizer(text);
+
+  SelectorLists selectorLists;
 
-    StyleData &styleData1 = getStyleData(selectorList);
+  if (! parseSelectorLists(tokenizer, selectorLists))
+    return false;
+
+  tokenizer.skipSpace();
 
-    styles.push_back(styleData1);
+  if (! tokenizer.eof()) {
+    errorMsg("Extra text after selector : '" + tokenizer.stateStr() + "'");
+    return false;
   }
 
+  selector.init(selectorLists);
+
   return true;
 }
 
+CCSSTagDataP
+CCSS::
+querySelector(const CCSSTagDataP &root, const std::string &text) const
+{
+  CompiledSelector selector;
+
+  if (! compileSelector(text, selector))
+    return CCSSTagDataP();
+
+  return selector.querySelector(root);
+}
+
+CCSSTagData::TagDataArray
+CCSS::
+querySelectorAll(const CCSSTagDataP &root, const std::string &text) const
+{
+  CompiledSelector selector;
+
+  if (! compileSelector(text, selector))
+    return CCSSTagData::TagDataArray();
+
+  return selector.querySelectorAll(root);
+}
+
 void
 CCSS::
 getSelectors(std::vector<SelectorList> &selectors) const
 {
-  for (const auto &d : styleData_) {
-    const SelectorList &selectorList = d.first;
-
-    selectors.push_back(selectorList);
+  for (const auto &styleData : styleData_) {
+    if (! styleData.isRemoved())
+      selectors.push_back(styleData.getSelectorList());
   }
 }
 
 bool
 CCSS::
-parse(const std::string &str)
+parse(std::string_view str)
 {
-  CStrParse parse(str);
+  if (parseThreads_ != 1 && str.size() >= minParallelParseSize && ! isDebug())
+    return parseParallel(str);
 
-  while (! parse.eof()) {
-    parse.skipSpace();
+  CCSSTokenizer tokenizer(str);
 
-    if (isComment(parse)) {
-      skipComment(parse);
+  bool rc = addRules(tokenizer);
 
-      parse.skipSpace();
-    }
+  sortRuleBuckets();
 
-    //---
+  return rc;
+}
 
-    // get ids
-    IdListList idListList;
+bool
+CCSS::
+addRules(CCSSTokenizer &tokenizer)
+{
+  while (true) {
+    Rule rule;
 
-    if (! parseIdListList(parse, idListList))
-      return false;
+    RuleStatus status = parseRule(tokenizer, rule);
 
-    //---
+    if (status == RuleStatus::NONE)
+      break;
 
-    if (! parse.isChar('{')) {
-      errorMsg("Missing '{' for rule");
+    if (status == RuleStatus::ERROR)
       return false;
-    }
 
-    std::string str1;
+    addRule(rule);
 
-    // still parse text with missing end brace, just exit loop
-    bool rc = readBracedString(parse, str1);
+    if (status == RuleStatus::LAST)
+      break;
+  }
 
-    StyleData styleData;
+  return true;
+}
 
-    if (! parseAttr(str1, styleData))
-      return false;
+bool
+CCSS::
+parseParallel(std::string_view str)
+{
+  CCSSTaskRunner runner(parseThreads_);
 
-    if (! rc)
-      break;
+  //---
 
-    //---
+  // split text into chunks of whole top level rules (about four per thread)
+  std::size_t targetSize = std::max(std::size_t(1), str.size()/(4*runner.numThreads()));
 
-    // add selector for each comma separated id
-    for (const auto &idList : idListList) {
-      SelectorList selectorList;
+  std::vector<std::size_t> boundaries;
 
-      // add part for each space separator or child operator separated id
-      for (const auto &id : idList) {
-        Selector selector;
+  boundaries.push_back(0);
 
-        addSelectorParts(selector, id);
+  RuleScanner scanner;
 
-        selectorList.addSelector(selector);
-      }
+  std::size_t pos = 0;
 
-      StyleData &styleData1 = getStyleData(selectorList);
+  while (pos < str.size()) {
+    std::size_t end = scanner.scan(str, pos);
 
-      for (const auto &opt : styleData.getOptions())
-        styleData1.addOption(opt);
-    }
+    if (end == std::string_view::npos)
+      break;
+
+    if (end - boundaries.back() >= targetSize)
+      boundaries.push_back(end);
+
+    pos = end;
   }
 
-  return true;
-}
+  if (boundaries.back() < str.size())
+    boundaries.push_back(str.size());
 
-bool
-CCSS::
-parseIdListList(CStrParse &parse, IdListList &idListList)
-{
-  // get ids
+  uint numChunks = uint(boundaries.size() - 1);
 
-  while (! parse.eof()) {
-    // read comma separated list of space separated ids
-    while (! parse.eof()) {
-      IdList idList;
+  //---
 
-      while (! parse.eof()) {
-        Id id;
+  // parse chunks on all threads (stylesheet is not changed)
+  struct Chunk {
+    Rules rules;
+    bool  complete { true }; // all text parsed without error or unterminated rule
+  };
 
-        // read selector id
-        if (! readId(parse, id.id)) {
-          errorMsg("Empty id : '" + parse.stateStr() + "'");
-          return false;
-        }
+  std::vector<Chunk> chunks(numChunks);
 
-        // check for child selector
-        if      (parse.isOneOf(">+~")) {
-          if      (parse.isChar('>'))
-            id.nextType = NextType::CHILD;
-          else if (parse.isChar('+'))
-            id.nextType = NextType::SIBLING;
-          else if (parse.isChar('~'))
-            id.nextType = NextType::PRECEDER;
+  runner.run(numChunks, [&](uint i, uint) {
+    Chunk &chunk = chunks[i];
 
-          parse.skipChar();
+    CCSSTokenizer tokenizer(str.substr(boundaries[i], boundaries[i + 1] - boundaries[i]));
 
-          parse.skipSpace();
+    while (true) {
+      Rule rule;
 
-          idList.push_back(id);
-        }
-        // break if no more ids '}', or new set of ids ','
-        else if (parse.isChar(',') || parse.isChar('{')) {
-          idList.push_back(id);
+      RuleStatus status = parseRule(tokenizer, rule);
 
-          break;
-        }
-        else {
-          id.nextType = NextType::DESCENDANT;
+      if (status == RuleStatus::NONE)
+        break;
 
-          idList.push_back(id);
-        }
+      if (status != RuleStatus::OK) {
+        chunk.complete = false;
+        break;
       }
 
-      if (! idList.empty())
-        idListList.push_back(idList);
+      chunk.rules.push_back(std::move(rule));
+    }
+  });
 
-      if (! parse.isChar(','))
-        break;
+  //---
 
-      parse.skipChar();
+  // add rules in source order. If a chunk did not parse cleanly parse the rest
+  // of the text on this thread so errors are handled as for a single thread
+  for (uint i = 0; i < numChunks; ++i) {
+    Chunk &chunk = chunks[i];
 
-      parse.skipSpace();
+    if (! chunk.complete) {
+      CCSSTokenizer tokenizer(str.substr(boundaries[i]));
+
+      bool rc = addRules(tokenizer);
+
+      sortRuleBuckets();
+
+      return rc;
     }
 
-    if (parse.isChar('{'))
-      break;
+    for (auto &rule : chunk.rules)
+      addRule(rule);
+
+    chunk.rules.clear();
   }
 
+  sortRuleBuckets();
+
   return true;
 }
 
-void
+CCSS::RuleStatus
 CCSS::
-addSelectorParts(Selector &selector, const Id &id)
+parseRule(CCSSTokenizer &tokenizer, Rule &rule) const
 {
-  SelectorData selectorData;
+  tokenizer.skipSpace();
 
-  parseSelectorData(id.id, selectorData);
+  if (tokenizer.eof())
+    return RuleStatus::NONE;
 
   //---
 
-  selector.setName(selectorData.name);
+  // get selectors
+  if (! parseSelectorLists(tokenizer, rule.selectorLists))
+    return RuleStatus::ERROR;
 
-  selector.setNextType(id.nextType);
+  //---
 
-  selector.setIdNames(selectorData.idNames);
+  if (! tokenizer.isChar('{')) {
+    errorMsg("Missing '{' for rule");
+    return RuleStatus::ERROR;
+  }
 
-  selector.setClassNames(selectorData.classNames);
+  tokenizer.skipChar();
 
-  selector.setExpressions(selectorData.exprs);
+  if (! parseAttr(tokenizer, rule.options))
+    return RuleStatus::ERROR;
 
-  selector.setFunctions(selectorData.fns);
+  // still add rule with missing end brace but no more rules
+  if (! tokenizer.isChar('}')) {
+    errorMsg("Missing close brace : '" + tokenizer.stateStr() + "'");
+    return RuleStatus::LAST;
+  }
+
+  tokenizer.skipChar();
+
+  return RuleStatus::OK;
 }
 
 void
 CCSS::
-parseSelectorData(const std::string &id, SelectorData &selectorData) const
+addRule(Rule &rule, RuleHandles *handles)
 {
-  assert(! id.empty());
-
-  selectorData.name = id;
+  // set source order of declarations (empty declarations still have an order
+  // for any replaced declarations)
+  uint declOrder = optionOrder_;
 
-  uint pos = 0;
+  for (auto &opt : rule.options)
+    opt.setOrder(optionOrder_++);
 
-  // <name> [# <id> ]
-  if (findIdChar(selectorData.name, '#', pos)) {
-    std::string idName = selectorData.name.substr(pos + 1);
+  if (rule.options.empty())
+    ++optionOrder_;
 
-    selectorData.name = selectorData.name.substr(0, pos);
+  // add options for each comma separated selector
+  for (const auto &selectorList : rule.selectorLists) {
+    addFunctionDiagnostics(selectorList);
 
-    uint pos1 = 0;
+    StyleData &styleData1 = (handles ? addNewStyleData(selectorList, declOrder) :
+                                       addStyleData   (selectorList, declOrder));
 
-    while (findIdChar(idName, '#', pos1)) {
-      std::string lhs = idName.substr(0, pos1);
-      std::string rhs = idName.substr(pos1 + 1);
+    // merged declarations are the rule's last declaration block
+    if (! rule.options.empty())
+      styleData1.setDeclarationOrder(declOrder);
 
-      selectorData.idNames.push_back(lhs);
-
-      idName = rhs;
-    }
+    for (const auto &opt : rule.options)
+      styleData1.addOption(opt);
 
-    selectorData.idNames.push_back(idName);
+    if (handles)
+      handles->push_back(styleData1.order());
   }
+}
 
-  // <name> [. <class> ]
-  if (findIdChar(selectorData.name, '.', pos)) {
-    std::string className = selectorData.name.substr(uint(pos + 1));
-
-    selectorData.name = selectorData.name.substr(0, uint(pos));
+bool
+CCSS::
+insertRule(const std::string &text, RuleHandles &handles)
+{
+  CCSSTokenizer tokenizer(text);
 
-    uint pos1 = 0;
+  Rule rule;
 
-    while (findIdChar(className, '.', pos1)) {
-      std::string lhs = className.substr(0, pos1);
-      std::string rhs = className.substr(pos1 + 1);
+  RuleStatus status = parseRule(tokenizer, rule);
 
-      selectorData.classNames.push_back(lhs);
+  if (status == RuleStatus::NONE || status == RuleStatus::ERROR)
+    return false;
 
-      className = rhs;
-    }
+  tokenizer.skipSpace();
 
-    selectorData.classNames.push_back(className);
+  if (! tokenizer.eof()) {
+    errorMsg("Extra text after rule : '" + tokenizer.stateStr() + "'");
+    return false;
   }
 
-  //---
+  addRule(rule, &handles);
+
+  sortRuleBuckets();
 
-  // <name> [ <expr> ]
-  auto p = selectorData.name.find('[');
+  return true;
+}
 
-  if (p != std::string::npos) {
-    std::string exprStr = selectorData.name.substr(p + 1);
+bool
+CCSS::
+removeRule(RuleHandle handle)
+{
+  if (! getRule(handle))
+    return false;
 
-    selectorData.name = selectorData.name.substr(0, p);
+  StyleData &styleData = styleData_[handle];
 
-    auto p1 = exprStr.find(']');
+  removeRuleBucket(handle);
 
-    if (p1 != std::string::npos) {
-      std::string rhs = exprStr.substr(p1 + 1);
+  auto range = styleDataIndex_.equal_range(styleData.getSelectorList().hash());
 
-      exprStr = exprStr.substr(0, p1);
+  for (auto p = range.first; p != range.second; ++p) {
+    if ((*p).second == handle) {
+      styleDataIndex_.erase(p);
+      break;
+    }
+  }
 
-      std::size_t i = 0;
+  // keep empty rule so other rules keep their index
+  styleData = StyleData(SelectorList(), handle);
 
-      while (i < rhs.size() && isspace(rhs[i]))
-        ++i;
+  ++numRemoved_;
 
-      while (i < rhs.size() && rhs[i] == '[') {
-        Expr expr(exprStr);
+  ruleVersion_.update();
 
-        selectorData.exprs.push_back(expr);
+  return true;
+}
 
-        ++i;
+bool
+CCSS::
+replaceDeclarations(RuleHandle handle, const std::string &text)
+{
+  if (! getRule(handle))
+    return false;
 
-        rhs = rhs.substr(i);
+  StyleData &styleData = styleData_[handle];
 
-        auto p2 = rhs.find(']');
+  CCSSTokenizer tokenizer(text);
 
-        if (p2 != std::string::npos) {
-          exprStr = rhs.substr(0, p2);
-          rhs     = rhs.substr(p2 + 1);
+  OptionList options;
 
-          i = 0;
-        }
-      }
+  if (! parseAttr(tokenizer, options))
+    return false;
 
-      selectorData.exprs.push_back(Expr(exprStr));
-    }
+  if (! tokenizer.eof()) {
+    errorMsg("Extra text after declarations : '" + tokenizer.stateStr() + "'");
+    return false;
   }
 
-  //---
-
-  // <name>:<fn> [:<fn>...]
-  p = selectorData.name.find(':');
+  // a declaration keeps the position of the rule's last declaration of the same name
+  // so restating a value does not change the cascade. Other declarations go at the
+  // position of the rule's last declaration block (later ones win ties in rule)
+  for (auto &opt : options) {
+    uint order = styleData.declarationOrder();
 
-  if (p != std::string::npos) {
-    std::string fn = selectorData.name.substr(p + 1);
+    for (const auto &opt1 : styleData.getOptions())
+      if (opt1.nameAtom() == opt.nameAtom())
+        order = opt1.order();
 
-    selectorData.name = selectorData.name.substr(0, p);
+    opt.setOrder(order);
+  }
 
-    auto p1 = fn.find(':');
+  // only declarations changed so rule buckets and match caches are still valid
+  styleData.setOptions(options);
 
-    while (p1 != std::string::npos) {
-      std::string lhs = fn.substr(0, p1);
-      std::string rhs = fn.substr(p1 + 1);
+  return true;
+}
 
-      selectorData.fns.push_back(lhs);
+const CCSS::StyleData *
+CCSS::
+getRule(RuleHandle handle) const
+{
+  if (handle >= styleData_.size())
+    return nullptr;
 
-      fn = rhs;
+  const StyleData &styleData = styleData_[handle];
 
-      p1 = fn.find(':');
-    }
+  if (styleData.isRemoved())
+    return nullptr;
 
-    selectorData.fns.push_back(fn);
-  }
+  return &styleData;
 }
 
 bool
 CCSS::
-findIdChar(const std::string &str, char c, uint &pos)
+parseSelectorLists(CCSSTokenizer &tokenizer, SelectorLists &selectorLists) const
 {
-  uint i = 0;
-
-  while (str[i] != '\0') {
-    if      (str[i] == '[') {
-      int sbracket = 1;
+  // read comma separated list of selectors
+  while (true) {
+    SelectorList selectorList;
 
-      while (str[i] != '\0') {
-        if      (str[i] == '[')
-          ++sbracket;
-        else if (str[i] == ']') {
-          --sbracket;
+    if (! parseSelectorList(tokenizer, selectorList))
+      return false;
 
-          if (sbracket == 0)
-            break;
-        }
+    selectorLists.push_back(std::move(selectorList));
 
-        ++i;
-      }
-    }
-    else if (str[i] == c) {
-      pos = i;
-      return true;
-    }
+    if (! tokenizer.isChar(','))
+      break;
 
-    ++i;
+    tokenizer.skipChar();
   }
 
-  return false;
+  return true;
 }
 
 bool
 CCSS::
-parseAttr(const std::string &str, StyleData &styleData)
+parseSelectorList(CCSSTokenizer &tokenizer, SelectorList &selectorList) const
 {
-  static std::string importantStr = "!important";
-
-  CStrParse parse(str);
-
-  parse.skipSpace();
-
-  if (parse.eof())
-    return true;
+  tokenizer.skipSpace();
 
-  while (! parse.eof()) {
-    std::string name = readAttrName(parse);
+  // read selectors separated by space or child, sibling or preceder operator
+  while (true) {
+    SelectorData selectorData;
 
-    parse.skipSpace();
-
-    // TODO: comma separated values
-    // TODO: collapse white space
-    std::string value;
-    bool        important = false;
-
-    if (parse.isChar(':')) {
-      parse.skipChar();
-
-      parse.skipSpace();
-
-      value = readAttrValue(parse);
+    if (! parseSelectorData(tokenizer, selectorData)) {
+      errorMsg("Empty id : '" + tokenizer.stateStr() + "'");
+      return false;
+    }
 
-      if (value.size() >= importantStr.size()) {
-        uint rpos = uint(value.size() - importantStr.size());
+    //---
 
-        if (value.substr(rpos) == importantStr) {
-          important = true;
+    // get next type
+    NextType nextType = NextType::NONE;
 
-          value = value.substr(0, rpos);
+    bool space = tokenizer.skipSpace();
 
-          value = CStrUtil::stripSpaces(value);
-        }
-      }
+    if      (tokenizer.isOneOf(">+~")) {
+      if      (tokenizer.isChar('>'))
+        nextType = NextType::CHILD;
+      else if (tokenizer.isChar('+'))
+        nextType = NextType::SIBLING;
+      else if (tokenizer.isChar('~'))
+        nextType = NextType::PRECEDER;
 
-      if (parse.isChar(';')) {
-        parse.skipChar();
+      tokenizer.skipChar();
 
-        parse.skipSpace();
-      }
+      tokenizer.skipSpace();
     }
-
-    if (name.empty()) {
-      errorMsg("Empty name : '" + parse.stateStr() + "'");
+    // no more selectors if new set of selectors ',' or start of rule '{'
+    else if (tokenizer.eof() || tokenizer.isOneOf(",{")) {
+    }
+    else if (space) {
+      nextType = NextType::DESCENDANT;
+    }
+    else {
+      errorMsg("Invalid selector : '" + tokenizer.stateStr() + "'");
       return false;
     }
 
-    styleData.addOption(Option(name, value, important));
-  }
-
-  return true;
-}
+    //---
 
-std::string
-CCSS::
-readAttrName(CStrParse &parse) const
-{
-  std::string name;
+    Selector selector;
 
-  while (! parse.eof() && ! parse.isSpace() && ! parse.isChar(':')) {
-    char c;
+    addSelectorParts(selector, selectorData, nextType);
 
-    parse.readChar(&c);
+    selectorList.addSelector(selector);
 
-    name += c;
+    if (nextType == NextType::NONE)
+      break;
   }
 
-  return name;
+  return true;
 }
 
-std::string
+bool
 CCSS::
-readAttrValue(CStrParse &parse) const
+parseSelectorData(CCSSTokenizer &tokenizer, SelectorData &selectorData) const
 {
-  std::string value;
-
-  while (! parse.eof() && ! parse.isChar(';')) {
-    char c;
-
-    parse.readChar(&c);
+  // [<name>] [#<id>...] [.<class>...] [[<expr>]...] [:<fn>...]
+  std::size_t start = tokenizer.pos();
 
-    value += c;
-  }
-
-  value = CStrUtil::stripSpaces(value);
+  while (! tokenizer.eof()) {
+    std::size_t pos = tokenizer.pos();
 
-  return value;
-}
+    CCSSTokenizer::Token token = tokenizer.nextToken();
 
-bool
-CCSS::
-readId(CStrParse &parse, std::string &id) const
-{
-  id = "";
+    // <name> or '*' (must be first)
+    if      (pos == start && (token.type == CCSSTokenizer::Type::IDENT || token.isDelim('*'))) {
+      selectorData.name = std::string(token.str);
+    }
+    // #<id>
+    else if (token.type == CCSSTokenizer::Type::HASH) {
+      selectorData.idNames.push_back(std::string(token.str));
+    }
+    // .<class>
+    else if (token.isDelim('.')) {
+      std::string_view className = tokenizer.readIdent();
 
-  parse.skipSpace();
+      if (className.empty())
+        return false;
 
-  while (! parse.eof() && ! parse.isSpace() && ! parse.isOneOf("{,>+~")) {
-    char c;
+      selectorData.classNames.push_back(std::string(className));
+    }
+    // [<expr>]
+    else if (token.isDelim('[')) {
+      std::string_view exprStr = tokenizer.readUntil("]");
 
-    if (parse.isChar('[')) {
-      char c1;
+      if (! tokenizer.isChar(']'))
+        return false;
 
-      parse.readChar(&c1);
+      tokenizer.skipChar();
 
-      id += c1;
+      selectorData.exprs.push_back(Expr(exprStr));
+    }
+    // :<fn>, :<fn>(<args>) or ::<fn>
+    else if (token.isDelim(':')) {
+      std::size_t fnStart = tokenizer.pos();
 
-      int sbracket = 1;
+      if (tokenizer.isChar(':'))
+        tokenizer.skipChar();
 
-      while (! parse.eof()) {
-        parse.readChar(&c1);
+      token = tokenizer.nextToken();
 
-        id += c1;
+      if      (token.type == CCSSTokenizer::Type::FUNCTION) {
+        (void) tokenizer.readUntil(")");
 
-        if      (c1 == '[')
-          ++sbracket;
-        else if (c1 == ']') {
-          --sbracket;
+        if (! tokenizer.isChar(')'))
+          return false;
 
-          if (sbracket == 0)
-            break;
-        }
+        tokenizer.skipChar();
       }
+      else if (token.type != CCSSTokenizer::Type::IDENT)
+        return false;
+
+      selectorData.fns.push_back(std::string(tokenizer.str().substr(fnStart,
+                                             tokenizer.pos() - fnStart)));
     }
     else {
-      parse.readChar(&c);
-
-      id += c;
+      tokenizer.setPos(pos);
+      break;
     }
   }
 
-  parse.skipSpace();
+  return (tokenizer.pos() > start);
+}
+
+void
+CCSS::
+addSelectorParts(Selector &selector, const SelectorData &selectorData, NextType nextType) const
+{
+  selector.setName(selectorData.name);
+
+  selector.setNextType(nextType);
+
+  selector.setIdNames(selectorData.idNames);
+
+  selector.setClassNames(selectorData.classNames);
+
+  selector.setExpressions(selectorData.exprs);
 
-  return ! id.empty();
+  selector.setFunctions(selectorData.fns);
 }
 
 bool
 CCSS::
-readBracedString(CStrParse &parse, std::string &str) const
+parseAttr(CCSSTokenizer &tokenizer, OptionList &options) const
 {
-  str = "";
+  static std::string_view importantStr = "!important";
 
-  parse.skipChar();
+  // read <name>: <value> [!important]; up to close brace
+  while (true) {
+    tokenizer.skipSpace();
 
-  parse.skipSpace();
-
-  while (! parse.eof() && ! parse.isChar('}')) {
-    if (isComment(parse))
-      skipComment(parse);
+    if (tokenizer.eof() || tokenizer.isChar('}'))
+      break;
 
-    char c;
+    if (tokenizer.isChar(';')) {
+      tokenizer.skipChar();
+      continue;
+    }
 
-    parse.readChar(&c);
+    std::string_view name = CCSSTokenizer::trim(tokenizer.readUntil(":;}"));
 
-    str += c;
-  }
+    if (name.empty()) {
+      errorMsg("Empty name : '" + tokenizer.stateStr() + "'");
+      return false;
+    }
 
-  if (! parse.isChar('}')) {
-    errorMsg("Missing close brace : '" + parse.stateStr() + "'");
-    return false;
-  }
+    // TODO: comma separated values
+    // TODO: collapse white space
+    std::string value;
+    bool        important = false;
 
-  parse.skipChar();
+    if (tokenizer.isChar(':')) {
+      tokenizer.skipChar();
 
-  parse.skipSpace();
+      std::string_view valueStr = CCSSTokenizer::trim(tokenizer.readUntil(";}"));
 
-  return true;
-}
+      if (valueStr.size() >= importantStr.size()) {
+        std::size_t rpos = valueStr.size() - importantStr.size();
 
-bool
-CCSS::
-isComment(CStrParse &parse) const
-{
-  return parse.isString("/*");
-}
+        if (valueStr.substr(rpos) == importantStr) {
+          important = true;
 
-bool
-CCSS::
-skipComment(CStrParse &parse) const
-{
-  parse.skipChars(2);
+          valueStr = CCSSTokenizer::trim(valueStr.substr(0, rpos));
+        }
+      }
 
-  while (! parse.eof()) {
-    if (parse.isString("*/")) {
-      parse.skipChars(2);
-      return true;
+      if (CCSSTokenizer::hasComment(valueStr))
+        value = std::string(CCSSTokenizer::trim(CCSSTokenizer::stripComments(valueStr)));
+      else
+        value = std::string(valueStr);
     }
 
-    parse.skipChar();
-  }
+    if (tokenizer.isChar(';'))
+      tokenizer.skipChar();
 
-  errorMsg("Unterminated commend : '" + parse.stateStr() + "'");
+    options.push_back(Option(std::string(name), value, important));
+  }
 
-  return false;
+  return true;
 }
 
 bool
 CCSS::
 hasStyleData() const
 {
-  return ! styleData_.empty();
+  return (styleData_.size() > numRemoved_);
 }
 
 CCSS::StyleData &
 CCSS::
 getStyleData(const SelectorList &selectorList)
 {
-  auto p = styleData_.find(selectorList);
+  // existing rule is unchanged (keeps its cascade position)
+  const StyleData *styleData = findStyleData(selectorList);
+
+  if (styleData)
+    return const_cast<StyleData &>(*styleData);
 
-  if (p == styleData_.end())
-    p = styleData_.insert(p, StyleDataMap::value_type(selectorList, StyleData(selectorList)));
+  // new empty rule gets its own declaration order
+  StyleData &styleData1 = addNewStyleData(selectorList, optionOrder_++);
 
-  StyleData &styleData = (*p).second;
+  sortRuleBuckets();
 
-  return styleData;
+  return styleData1;
 }
 
-const CCSS::StyleData &
+CCSS::StyleData &
+CCSS::
+addStyleData(const SelectorList &selectorList, uint declOrder)
+{
+  const StyleData *styleData = findStyleData(selectorList);
+
+  if (styleData)
+    return const_cast<StyleData &>(*styleData);
+
+  return addNewStyleData(selectorList, declOrder);
+}
+
+CCSS::StyleData &
+CCSS::
+addNewStyleData(const SelectorList &selectorList, uint declOrder)
+{
+  uint ind = uint(styleData_.size());
+
+  styleData_.push_back(StyleData(selectorList, ind));
+
+  styleData_.back().setDeclarationOrder(declOrder);
+
+  if (invalidations_.isBuilt())
+    invalidations_.addRule(selectorList);
+
+  if (ruleStats_.isEnabled())
+    ruleStats_.resize(styleData_.size());
+
+  ruleVersion_.update();
+
+  styleDataIndex_.insert(StyleDataIndex::value_type(selectorList.hash(), ind));
+
+  addRuleBucket(ind);
+
+  return styleData_.back();
+}
+
+const CCSS::StyleData &
 CCSS::
 getStyleData(const SelectorList &selectorList) const
 {
-  auto p = styleData_.find(selectorList);
+  const StyleData *styleData = findStyleData(selectorList);
+
+  assert(styleData);
+
+  return *styleData;
+}
+
+const CCSS::StyleData *
+CCSS::
+findStyleData(const SelectorList &selectorList) const
+{
+  auto range = styleDataIndex_.equal_range(selectorList.hash());
+
+  for (auto p = range.first; p != range.second; ++p) {
+    const StyleData &styleData = styleData_[(*p).second];
+
+    if (styleData.getSelectorList() == selectorList)
+      return &styleData;
+  }
+
+  return nullptr;
+}
+
+const CCSS::StyleData *
+CCSS::
+findStyleData(const std::string &selectorStr) const
+{
+  CCSSTokenizer tokenizer(selectorStr);
+
+  SelectorList selectorList;
+
+  if (! parseSelectorList(tokenizer, selectorList))
+    return nullptr;
+
+  tokenizer.skipSpace();
+
+  if (! tokenizer.eof())
+    return nullptr;
+
+  return findStyleData(selectorList);
+}
+
+void
+CCSS::
+addRuleBucket(uint ind)
+{
+  const StyleData &styleData = styleData_[ind];
+
+  uint64_t key = styleData.sortKey();
+
+  auto addKey = [&](RuleBucket &bucket) {
+    if (bucket.numSorted == bucket.keys.size())
+      unsortedBuckets_.push_back(&bucket);
+
+    bucket.keys.push_back(key);
+  };
+
+  addKey(ruleBuckets_.allRules);
+
+  //---
+
+  const auto &selectors = styleData.getSelectorList().selectors();
+
+  if (selectors.empty())
+    return;
+
+  // add to bucket for rightmost selector's id, first class or element name
+  const Selector &selector = selectors.back();
+
+  if      (! selector.idNames().empty())
+    addKey(ruleBuckets_.idRules[selector.idNames()[0]]);
+  else if (! selector.classNames().empty())
+    addKey(ruleBuckets_.classRules[selector.classNames()[0]]);
+  else if (! selector.isUniversal())
+    addKey(ruleBuckets_.elementRules[selector.nameAtom()]);
+  else
+    addKey(ruleBuckets_.universalRules);
+}
+
+void
+CCSS::
+removeRuleBucket(uint ind)
+{
+  // buckets are always sorted between changes
+  assert(unsortedBuckets_.empty());
+
+  const StyleData &styleData = styleData_[ind];
+
+  uint64_t key = styleData.sortKey();
+
+  auto removeKey = [&](RuleBucket &bucket) {
+    auto &keys = bucket.keys;
+
+    auto p = std::lower_bound(keys.begin(), keys.end(), key);
+
+    if (p != keys.end() && *p == key)
+      keys.erase(p);
+
+    bucket.numSorted = keys.size();
+  };
+
+  // remove from atom's bucket (and remove bucket if empty)
+  auto removeAtomKey = [&](RuleBuckets::AtomRules &atomRules, const CCSSAtom &atom) {
+    auto p = atomRules.find(atom);
+
+    if (p == atomRules.end())
+      return;
+
+    removeKey((*p).second);
+
+    if ((*p).second.keys.empty())
+      atomRules.erase(p);
+  };
+
+  removeKey(ruleBuckets_.allRules);
+
+  //---
+
+  const auto &selectors = styleData.getSelectorList().selectors();
+
+  if (selectors.empty())
+    return;
+
+  // remove from bucket for rightmost selector's id, first class or element name
+  const Selector &selector = selectors.back();
+
+  if      (! selector.idNames().empty())
+    removeAtomKey(ruleBuckets_.idRules, selector.idNames()[0]);
+  else if (! selector.classNames().empty())
+    removeAtomKey(ruleBuckets_.classRules, selector.classNames()[0]);
+  else if (! selector.isUniversal())
+    removeAtomKey(ruleBuckets_.elementRules, selector.nameAtom());
+  else
+    removeKey(ruleBuckets_.universalRules);
+}
+
+void
+CCSS::
+sortRuleBuckets()
+{
+  // sort keys added since last sort and merge into sorted keys
+  for (auto *bucket : unsortedBuckets_) {
+    auto &keys = bucket->keys;
+
+    auto mid = keys.begin() + long(bucket->numSorted);
+
+    std::sort(mid, keys.end());
+
+    if (mid != keys.begin() && *(mid - 1) > *mid)
+      std::inplace_merge(keys.begin(), mid, keys.end());
+
+    bucket->numSorted = keys.size();
+  }
+
+  unsortedBuckets_.clear();
+}
+
+namespace {
+
+// adapter for tags of path of document order walk
+// (parent and previous sibling only valid for ancestors of current tag and their
+// previous siblings)
+class CCSSPathAdapter {
+ public:
+  struct Node {
+    uint level { 0 };
+    uint index { 0 };
+  };
+
+ public:
+  explicit CCSSPathAdapter(const CCSS::TreePath &path) :
+   path_(path) {
+  }
+
+  const CCSSTagDataP &tag(const Node &node) const { return path_.tag(node.level, node.index); }
+
+  bool isElement(const Node &node, const CCSSAtom &name) const {
+    return tag(node)->isElement(name);
+  }
+
+  bool isClass(const Node &node, const CCSSAtom &name) const { return tag(node)->isClass(name); }
+
+  bool isId(const Node &node, const CCSSAtom &name) const { return tag(node)->isId(name); }
+
+  bool hasAttribute(const Node &node, const CCSSAtom &name, CCSSAttributeOp op,
+                    const std::string &value) const {
+    return tag(node)->hasAttribute(name, op, value);
+  }
+
+  bool getNames(const Node &node, CCSSTagNames &names) const {
+    return tag(node)->getNames(names);
+  }
+
+  bool isNthChild(const Node &node, int n) const { return tag(node)->isNthChild(n); }
+
+  int childIndex(const Node &node, bool fromEnd) const {
+    return tag(node)->childIndex(fromEnd);
+  }
+
+  int typeIndex(const Node &node, const CCSSAtom &name, bool fromEnd) const {
+    return tag(node)->typeIndex(name, fromEnd);
+  }
+
+  bool isInputValue(const Node &node, const std::string &value) const {
+    return tag(node)->isInputValue(value);
+  }
+
+  // root of document (not root of path)
+  bool isRoot(const Node &node) const { return ! tag(node)->getParent(); }
+
+  bool parent(const Node &node, Node &parent) const {
+    if (node.level == 0) return false;
+
+    parent.level = node.level - 1;
+    parent.index = path_.index(parent.level);
+
+    return true;
+  }
+
+  bool prevSibling(const Node &node, Node &sibling) const {
+    if (node.index == 0) return false;
+
+    sibling.level = node.level;
+    sibling.index = node.index - 1;
+
+    return true;
+  }
+
+  uint64_t key(const Node &node) const { return (uint64_t(node.level) << 32) | node.index; }
+
+  // current tag of path
+  Node current() const {
+    Node node;
+
+    node.level = path_.depth() - 1;
+    node.index = path_.index(node.level);
+
+    return node;
+  }
+
+ private:
+  const CCSS::TreePath &path_;
+};
+
+}
+
+void
+CCSS::
+getCandidateRules(const CCSSTagNames *names, RuleKeys &keys) const
+{
+  // no names so check all rules
+  if (! names) {
+    keys = ruleBuckets_.allRules.keys;
+    return;
+  }
+
+  // merge sorted keys of each bucket
+  auto addBucket = [&](const RuleBucket &bucket) {
+    if (bucket.keys.empty()) return;
+
+    std::size_t n = keys.size();
+
+    keys.insert(keys.end(), bucket.keys.begin(), bucket.keys.end());
+
+    if (n > 0)
+      std::inplace_merge(keys.begin(), keys.begin() + long(n), keys.end());
+  };
+
+  auto addAtomBucket = [&](const RuleBuckets::AtomRules &atomRules, const CCSSAtom &atom) {
+    if (atom.empty()) return;
+
+    auto p = atomRules.find(atom);
+
+    if (p != atomRules.end())
+      addBucket((*p).second);
+  };
+
+  for (const auto &id : names->ids)
+    addAtomBucket(ruleBuckets_.idRules, id);
+
+  for (const auto &className : names->classes)
+    addAtomBucket(ruleBuckets_.classRules, className);
+
+  addAtomBucket(ruleBuckets_.elementRules, names->element);
+
+  addBucket(ruleBuckets_.universalRules);
+
+  // remove duplicates from repeated names
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+void
+CCSS::
+matchRules(const CCSSTagDataP &data, StyleDataArray &styles) const
+{
+  CCSSTagDataNode node(data);
+
+  matchRules(node, styles);
+}
+
+void
+CCSS::
+matchRules(const CCSSTagDataP &data, const MatchContext &context, StyleDataArray &styles) const
+{
+  CCSSTagDataNode node(data);
+
+  matchRules(node, context, styles);
+}
+
+void
+CCSS::
+matchRules(const CCSSTagNode &node, StyleDataArray &styles) const
+{
+  match(&node, styles, CCSSTagNodeAdapter());
+}
+
+void
+CCSS::
+matchRules(const CCSSTagNode &node, const MatchContext &context, StyleDataArray &styles) const
+{
+  match(&node, context, styles, CCSSTagNodeAdapter());
+}
+
+CCSS::StyleDataArray
+CCSS::
+matchRules(const CCSSTagDataP &data) const
+{
+  StyleDataArray styles;
+
+  matchRules(data, styles);
+
+  return styles;
+}
+
+void
+CCSS::
+computeStyle(const CCSSTagDataP &data, ComputedStyle &style) const
+{
+  StyleDataArray styles;
+
+  matchRules(data, styles);
+
+  computeStyle(styles, style);
+}
+
+void
+CCSS::
+computeStyle(const CCSSTagDataP &data, const MatchContext &context, ComputedStyle &style) const
+{
+  StyleDataArray styles;
+
+  matchRules(data, context, styles);
+
+  computeStyle(styles, style);
+}
+
+void
+CCSS::
+styleTree(const CCSSTagDataP &root, const StyleTreeProc &proc) const
+{
+  if (! root)
+    return;
 
-  assert(p != styleData_.end());
+  TreePath     path;
+  MatchContext context;
 
-  const StyleData &styleData = (*p).second;
+  path.setRoot(root);
 
-  return styleData;
+  styleWalk(path, context, proc);
 }
 
 void
-CCSS::
-clear()
+CCSS::
+styleTree(const CCSSTagDataP &root, const StyleTreeProc &proc, uint numThreads) const
+{
+  typedef CCSSTagData::TagDataArray TagDataArray;
+
+  if (! root)
+    return;
+
+  CCSSTaskRunner runner(numThreads);
+
+  if (runner.numThreads() <= 1)
+    return styleTree(root, proc);
+
+  //---
+
+  // find first level with enough tags to keep all threads busy (or widest level)
+  uint targetTasks = 16*runner.numThreads();
+
+  uint splitLevel = 0, splitSize = 1;
+
+  {
+    TagDataArray levelTags, childTags;
+
+    levelTags.push_back(root);
+
+    for (uint level = 1; ! levelTags.empty(); ++level) {
+      childTags.clear();
+
+      for (const auto &tag : levelTags)
+        tag->getChildren(childTags);
+
+      if (childTags.size() > splitSize) {
+        splitLevel = level;
+        splitSize  = uint(childTags.size());
+      }
+
+      if (splitSize >= targetTasks)
+        break;
+
+      levelTags.swap(childTags);
+    }
+  }
+
+  // no parallelism in tree
+  if (splitLevel == 0)
+    return styleTree(root, proc);
+
+  uint chunkSize = std::max(1U, splitSize/targetTasks);
+
+  //---
+
+  // results of tags in document order
+  struct Result {
+    TagDataArray      tags;
+    std::vector<uint> numStyles;
+    StyleDataArray    styles;
+
+    void add(const CCSSTagDataP &data, const StyleDataArray &styles1) {
+      tags     .push_back(data);
+      numStyles.push_back(uint(styles1.size()));
+      styles   .insert(styles.end(), styles1.begin(), styles1.end());
+    }
+  };
+
+  // ancestor of task (children array of its parent and its index)
+  struct TaskLevel {
+    const TagDataArray *children { nullptr };
+    uint                index    { 0 };
+  };
+
+  typedef std::vector<TaskLevel> TaskLevels;
+
+  // siblings start to end - 1 of children of last ancestor and their descendants
+  struct Task {
+    TaskLevels          levels;
+    const TagDataArray *children { nullptr };
+    uint                start    { 0 };
+    uint                end      { 0 };
+    uint                result   { 0 };
+  };
+
+  std::deque<TagDataArray> levelArrays; // children arrays of tags above split level
+  std::deque<Result>       results;     // results in document order
+  std::vector<Task>        tasks;
+
+  //---
+
+  // match tags above split level on this thread and add tasks for the subtrees
+  // below them (in document order)
+  {
+    TreePath       path;
+    MatchContext   context;
+    StyleDataArray styles;
+
+    std::vector<const TagDataArray *> pathArrays; // children array of each path level
+
+    bool spineResult = false; // last result is for tags on this thread
+
+    levelArrays.emplace_back();
+
+    levelArrays.back().push_back(root);
+
+    path.pushLevel(levelArrays.back(), 0, 1);
+
+    pathArrays.push_back(&levelArrays.back());
+
+    while (! path.empty()) {
+      if (path.atLevelEnd()) {
+        path.pop();
+
+        pathArrays.pop_back();
+
+        if (! path.empty()) {
+          context.popAncestor();
+
+          path.next();
+        }
+
+        continue;
+      }
+
+      const CCSSTagDataP &data = path.current();
+
+      styles.clear();
+
+      matchPathRules(path, context, styles);
+
+      if (! spineResult) {
+        results.emplace_back();
+
+        spineResult = true;
+      }
+
+      results.back().add(data, styles);
+
+      levelArrays.emplace_back();
+
+      TagDataArray &children = levelArrays.back();
+
+      data->getChildren(children);
+
+      uint numChildren = uint(children.size());
+
+      // above split level so continue walk with children
+      if (path.depth() < splitLevel) {
+        context.pushAncestor(data);
+
+        path.pushLevel(children, 0, numChildren);
+
+        pathArrays.push_back(&children);
+
+        continue;
+      }
+
+      // add tasks for chunks of children
+      TaskLevels levels;
+
+      for (uint l = 0; l < path.depth(); ++l) {
+        TaskLevel level;
+
+        level.children = pathArrays[l];
+        level.index    = path.index(l);
+
+        levels.push_back(level);
+      }
+
+      for (uint start = 0; start < numChildren; start += chunkSize) {
+        Task task;
+
+        task.levels   = levels;
+        task.children = &children;
+        task.start    = start;
+        task.end      = std::min(start + chunkSize, numChildren);
+        task.result   = uint(results.size());
+
+        tasks.push_back(std::move(task));
+
+        results.emplace_back();
+      }
+
+      if (numChildren > 0)
+        spineResult = false;
+
+      path.next();
+    }
+  }
+
+  //---
+
+  // match tasks on all threads (each worker has its own path and context)
+  struct Scratch {
+    TreePath     path;
+    MatchContext context;
+  };
+
+  std::vector<Scratch> scratches(runner.numThreads());
+
+  runner.run(uint(tasks.size()), [&](uint taskInd, uint worker) {
+    const Task &task    = tasks[taskInd];
+    Scratch    &scratch = scratches[worker];
+    Result     &result  = results[task.result];
+
+    // context is left empty by previous task (so its share cache is kept)
+    scratch.path.clear();
+
+    for (const auto &level : task.levels) {
+      scratch.path.pushLevel(*level.children, level.index, level.index + 1);
+
+      scratch.context.pushAncestor((*level.children)[level.index]);
+    }
+
+    scratch.path.pushLevel(*task.children, task.start, task.end);
+
+    styleWalk(scratch.path, scratch.context,
+      [&](const CCSSTagDataP &data, const StyleDataArray &styles) {
+        result.add(data, styles);
+      });
+
+    for (std::size_t l = 0; l < task.levels.size(); ++l)
+      scratch.context.popAncestor();
+  });
+
+  //---
+
+  // report results in document order
+  StyleDataArray styles;
+
+  for (const auto &result : results) {
+    std::size_t pos = 0;
+
+    for (std::size_t i = 0; i < result.tags.size(); ++i) {
+      uint numStyles = result.numStyles[i];
+
+      styles.assign(result.styles.begin() + long(pos),
+                    result.styles.begin() + long(pos + numStyles));
+
+      proc(result.tags[i], styles);
+
+      pos += numStyles;
+    }
+  }
+}
+
+void
+CCSS::
+styleTree(const CCSSTagNode &root, const NodeStyleProc &proc) const
+{
+  MatchContext   context;
+  StyleDataArray styles;
+
+  const CCSSTagNode *node = &root;
+
+  while (node) {
+    styles.clear();
+
+    matchRules(*node, context, styles);
+
+    proc(*node, styles);
+
+    // visit children
+    const CCSSTagNode *child = node->firstChildNode();
+
+    if (child) {
+      context.pushAncestor(*node);
+
+      node = child;
+
+      continue;
+    }
+
+    // move to next sibling of tag or nearest ancestor with one
+    while (node != &root && ! node->nextSiblingNode()) {
+      node = node->parentNode();
+
+      context.popAncestor();
+    }
+
+    if (node == &root)
+      break;
+
+    node = node->nextSiblingNode();
+  }
+}
+
+const CCSS::InvalidationSet &
+CCSS::
+invalidationSet(ChangeType type, const CCSSAtom &name) const
+{
+  invalidations_.build(styleData_);
+
+  return invalidations_.get(type, name);
+}
+
+void
+CCSS::
+addInvalidation(ChangeType type, const CCSSAtom &name, InvalidationSet &set) const
+{
+  set.add(invalidationSet(type, name));
+}
+
+void
+CCSS::
+addClassChange(const Atoms &oldClasses, const Atoms &newClasses, InvalidationSet &set) const
+{
+  for (const auto &name : oldClasses) {
+    if (std::find(newClasses.begin(), newClasses.end(), name) == newClasses.end())
+      addInvalidation(ChangeType::CLASS, name, set);
+  }
+
+  for (const auto &name : newClasses) {
+    if (std::find(oldClasses.begin(), oldClasses.end(), name) == oldClasses.end())
+      addInvalidation(ChangeType::CLASS, name, set);
+  }
+}
+
+void
+CCSS::
+getInvalidatedTags(const CCSSTagDataP &data, const InvalidationSet &set,
+                   CCSSTagData::TagDataArray &tags) const
+{
+  // add descendants of tag which match filter (in document order)
+  auto addDescendants = [&](const CCSSTagDataP &tag, const TagFilter &filter) {
+    if (filter.isEmpty())
+      return;
+
+    CCSSTagData::TagDataArray stack, children;
+
+    tag->getChildren(children);
+
+    stack.assign(children.rbegin(), children.rend());
+
+    while (! stack.empty()) {
+      CCSSTagDataP tag1 = stack.back();
+
+      stack.pop_back();
+
+      if (filter.checkMatch(*tag1))
+        tags.push_back(tag1);
+
+      children.clear();
+
+      tag1->getChildren(children);
+
+      stack.insert(stack.end(), children.rbegin(), children.rend());
+    }
+  };
+
+  if (set.self)
+    tags.push_back(data);
+
+  addDescendants(data, set.descendants);
+
+  if (set.siblings.isEmpty() && set.siblingDescendants.isEmpty())
+    return;
+
+  for (auto sibling = data->getNextSibling(); sibling; sibling = sibling->getNextSibling()) {
+    if (set.siblings.checkMatch(*sibling))
+      tags.push_back(sibling);
+
+    addDescendants(sibling, set.siblingDescendants);
+  }
+}
+
+void
+CCSS::
+styleWalk(TreePath &path, MatchContext &context, const StyleTreeProc &proc) const
+{
+  // walk until last level of path at start is done
+  uint depth = path.depth();
+
+  StyleDataArray styles;
+
+  while (path.depth() >= depth) {
+    // all tags at level done so move to next sibling of parent
+    if (path.atLevelEnd()) {
+      if (path.depth() == depth)
+        break;
+
+      path.pop();
+
+      context.popAncestor();
+
+      path.next();
+
+      continue;
+    }
+
+    const CCSSTagDataP &data = path.current();
+
+    styles.clear();
+
+    matchPathRules(path, context, styles);
+
+    proc(data, styles);
+
+    // visit children
+    context.pushAncestor(data);
+
+    path.pushChildren();
+  }
+}
+
+void
+CCSS::
+matchPathRules(const TreePath &path, const MatchContext &context, StyleDataArray &styles) const
+{
+  CCSSPathAdapter adapter(path);
+
+  match(adapter.current(), context, styles, adapter);
+}
+
+void
+CCSS::
+computeStyle(const CCSSTagNode &node, ComputedStyle &style) const
+{
+  StyleDataArray styles;
+
+  matchRules(node, styles);
+
+  computeStyle(styles, style);
+}
+
+void
+CCSS::
+computeStyle(const CCSSTagNode &node, const MatchContext &context, ComputedStyle &style) const
+{
+  StyleDataArray styles;
+
+  matchRules(node, context, styles);
+
+  computeStyle(styles, style);
+}
+
+void
+CCSS::
+computeStyle(const StyleDataArray &styles, ComputedStyle &style) const
+{
+  // winning option (and rule specificity) for each option name
+  struct Winner {
+    const Option      *option      { nullptr };
+    const Specificity *specificity { nullptr };
+  };
+
+  std::vector<Winner> winners;
+
+  std::unordered_map<CCSSAtom, uint> nameWinner;
+
+  for (const auto &styleData : styles) {
+    const Specificity &specificity = styleData->specificity();
+
+    for (const auto &option : styleData->getOptions()) {
+      auto p = nameWinner.find(option.nameAtom());
+
+      if (p == nameWinner.end()) {
+        nameWinner[option.nameAtom()] = uint(winners.size());
+
+        winners.push_back(Winner());
+
+        winners.back().option      = &option;
+        winners.back().specificity = &specificity;
+
+        continue;
+      }
+
+      Winner &winner = winners[(*p).second];
+
+      // !important wins, then higher specificity, then later declaration
+      if (option.isImportant() != winner.option->isImportant()) {
+        if (! option.isImportant())
+          continue;
+      }
+      else {
+        int cmp = specificity.cmp(*winner.specificity);
+
+        if (cmp < 0 || (cmp == 0 && option.order() < winner.option->order()))
+          continue;
+      }
+
+      winner.option      = &option;
+      winner.specificity = &specificity;
+    }
+  }
+
+  //---
+
+  OptionList options;
+
+  options.reserve(winners.size());
+
+  for (const auto &winner : winners)
+    options.push_back(*winner.option);
+
+  style.setOptions(std::move(options));
+}
+
+CCSS::ComputedStyle
+CCSS::
+computeStyle(const CCSSTagDataP &data) const
+{
+  ComputedStyle style;
+
+  computeStyle(data, style);
+
+  return style;
+}
+
+void
+CCSS::
+clear()
+{
+  styleData_     .clear();
+  styleDataIndex_.clear();
+
+  ruleBuckets_ = RuleBuckets();
+
+  unsortedBuckets_.clear();
+
+  invalidations_.clear();
+
+  ruleStats_.clear();
+
+  optionOrder_ = 0;
+  numRemoved_  = 0;
+
+  ruleVersion_.update();
+
+  diagnostics_.clear();
+
+  sources_.clear();
+}
+
+void
+CCSS::
+printStyle(std::ostream &os) const
+{
+  for (const auto &styleData : styleData_) {
+    if (styleData.isRemoved())
+      continue;
+
+    styleData.printStyle(os);
+
+    os << std::endl;
+  }
+}
+
+void
+CCSS::
+print(std::ostream &os) const
+{
+  for (const auto &styleData : styleData_) {
+    if (styleData.isRemoved())
+      continue;
+
+    if (isDebug())
+      styleData.printDebug(os);
+    else
+      styleData.print(os);
+
+    os << std::endl;
+  }
+}
+
+void
+CCSS::
+setRuleStats(bool b)
+{
+  ruleStats_.setEnabled(b);
+
+  if (b)
+    ruleStats_.resize(styleData_.size());
+}
+
+void
+CCSS::
+printRuleStats(std::ostream &os, uint n) const
+{
+  typedef std::pair<RuleHandle, RuleStats> HandleStats;
+
+  std::vector<HandleStats> handleStats;
+
+  RuleStats total;
+
+  for (const auto &styleData : styleData_) {
+    if (styleData.isRemoved())
+      continue;
+
+    RuleStats stats = ruleStats_.stats(styleData.order());
+
+    if (stats.attempts > 0)
+      handleStats.push_back(HandleStats(styleData.order(), stats));
+
+    total.add(stats);
+  }
+
+  // most time first
+  auto cmp = [](const HandleStats &s1, const HandleStats &s2) {
+    return s1.second.time > s2.second.time;
+  };
+
+  std::size_t n1 = std::min(std::size_t(n), handleStats.size());
+
+  std::partial_sort(handleStats.begin(), handleStats.begin() + long(n1), handleStats.end(), cmp);
+
+  auto printStats = [&](const RuleStats &stats, const std::string &name) {
+    os << std::setw(10) << stats.time/1000 << std::setw(10) << stats.attempts <<
+          std::setw(10) << stats.filtered  << std::setw(10) << stats.rightmostRejects <<
+          std::setw(10) << stats.combinatorWalks << std::setw(10) << stats.matches <<
+          "  " << name << "\n";
+  };
+
+  os << std::setw(10) << "time (us)" << std::setw(10) << "attempts" <<
+        std::setw(10) << "filtered"  << std::setw(10) << "rightmost" <<
+        std::setw(10) << "walks"     << std::setw(10) << "matches" << "  rule\n";
+
+  for (std::size_t i = 0; i < n1; ++i)
+    printStats(handleStats[i].second, styleData_[handleStats[i].first].toString());
+
+  printStats(total, "(all rules)");
+}
+
+void
+CCSS::
+addFunctionDiagnostics(const SelectorList &selectorList)
+{
+  for (const auto &selector : selectorList.selectors()) {
+    const auto &fns = selector.functions();
+
+    for (std::size_t i = 0; i < fns.size(); ++i) {
+      const Function &fn = selector.compiledFunctions()[i];
+
+      if      (! fn.isSupported())
+        addDiagnostic("Selector function not handled: " + fns[i]);
+      else if (fn.type() == FunctionType::BAD_EXPR)
+        addDiagnostic("Invalid selector function expression: " + fns[i]);
+    }
+  }
+}
+
+void
+CCSS::
+addDiagnostic(const std::string &msg)
+{
+  // only report once
+  if (std::find(diagnostics_.begin(), diagnostics_.end(), msg) != diagnostics_.end())
+    return;
+
+  diagnostics_.push_back(msg);
+
+  errorMsg(msg);
+}
+
+void
+CCSS::
+errorMsg(const std::string &msg) const
+{
+  if (isDebug())
+    std::cerr << msg << std::endl;
+}
+
+//----------
+
+CCSS::Source::
+Source(std::string &&str) :
+ str_(std::move(str))
+{
+}
+
+CCSS::Source::
+~Source()
+{
+  if (data_)
+    munmap(const_cast<char *>(data_), len_);
+}
+
+CCSS::SourceP
+CCSS::Source::
+mapFile(const std::string &filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return SourceP();
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return SourceP();
+  }
+
+  SourceP source(new Source);
+
+  std::size_t len = std::size_t(st.st_size);
+
+  // empty file cannot be mapped
+  if (len > 0) {
+    void *data = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (data != MAP_FAILED) {
+      madvise(data, len, MADV_SEQUENTIAL);
+
+      source->data_ = static_cast<const char *>(data);
+      source->len_  = len;
+    }
+    else {
+      // fallback to read (e.g. special file systems)
+      source->str_.resize(len);
+
+      std::size_t pos = 0;
+
+      while (pos < len) {
+        ssize_t n = read(fd, &source->str_[pos], len - pos);
+        if (n <= 0) break;
+
+        pos += std::size_t(n);
+      }
+
+      source->str_.resize(pos);
+    }
+  }
+
+  close(fd);
+
+  return source;
+}
+
+//----------
+
+std::size_t
+CCSS::RuleScanner::
+scan(std::string_view str, std::size_t pos)
+{
+  std::size_t len = str.size();
+
+  for ( ; pos < len; ++pos) {
+    char c = str[pos];
+
+    if      (state_ == State::COMMENT) {
+      if (c == '/' && lastChar_ == '*') {
+        state_ = State::NORMAL;
+
+        c = '\0';
+      }
+    }
+    else if (state_ == State::STRING) {
+      if      (lastChar_ == '\\')
+        c = '\0'; // escaped char
+      else if (c == quote_)
+        state_ = State::NORMAL;
+    }
+    else {
+      // escaped and bracketed chars are skipped as in CCSSTokenizer::readUntil
+      if      (lastChar_ == '\\')
+        c = '\0'; // escaped char
+      else if (c == '*' && lastChar_ == '/') {
+        state_ = State::COMMENT;
+
+        c = '\0';
+      }
+      else if (c == '"' || c == '\'') {
+        state_ = State::STRING;
+        quote_ = c;
+      }
+      else if (c == '(' || c == '[')
+        ++bracketDepth_;
+      else if (c == ')' || c == ']') {
+        if (bracketDepth_ > 0)
+          --bracketDepth_;
+      }
+      else if (c == '{' && bracketDepth_ == 0)
+        ++depth_;
+      else if (c == '}' && bracketDepth_ == 0) {
+        if (depth_ > 0)
+          --depth_;
+
+        if (depth_ == 0) {
+          lastChar_ = c;
+
+          return pos + 1;
+        }
+      }
+    }
+
+    lastChar_ = c;
+  }
+
+  return std::string_view::npos;
+}
+
+//----------
+
+bool
+CCSS::StreamParser::
+addChunk(std::string_view chunk)
+{
+  bool rc = true;
+
+  buffer_.append(chunk.data(), chunk.size());
+
+  std::string_view str(buffer_);
+
+  std::size_t start = 0;
+
+  // parse each completed rule
+  while (true) {
+    std::size_t end = scanner_.scan(str, scanPos_);
+
+    if (end == std::string_view::npos) {
+      scanPos_ = str.size();
+      break;
+    }
+
+    if (! css_.parse(str.substr(start, end - start)))
+      rc = false;
+
+    start    = end;
+    scanPos_ = end;
+  }
+
+  // keep incomplete rule text
+  if (start > 0) {
+    buffer_.erase(0, start);
+
+    scanPos_ -= start;
+  }
+
+  return rc;
+}
+
+bool
+CCSS::StreamParser::
+finish()
+{
+  bool rc = true;
+
+  std::string_view str(buffer_);
+
+  std::size_t i = 0;
+
+  while (i < str.size() && isspace(str[i]))
+    ++i;
+
+  if (i < str.size())
+    rc = css_.parse(str.substr(i));
+
+  buffer_.clear();
+
+  scanPos_ = 0;
+
+  scanner_.reset();
+
+  return rc;
+}
+
+//----------
+
+void
+CCSS::Expr::
+init(std::string_view str)
+{
+  CCSSTokenizer tokenizer(str);
+
+  //---
+
+  // read id
+  tokenizer.skipSpace();
+
+  id_ = CCSSAtom(CCSSTokenizer::trim(tokenizer.readUntil(" \t\r\n=~|")));
+
+  //---
+
+  // read op
+  tokenizer.skipSpace();
+
+  if      (tokenizer.isChar('=')) {
+    tokenizer.skipChar();
+
+    op_ = CCSSAttributeOp::EQUAL;
+  }
+  else if (tokenizer.isChar('~')) {
+    tokenizer.skipChar();
+
+    if (tokenizer.isChar('=')) {
+      tokenizer.skipChar();
+
+      op_ = CCSSAttributeOp::PARTIAL;
+    }
+    else {
+      // TODO: error
+    }
+  }
+  else if (tokenizer.isChar('|')) {
+    tokenizer.skipChar();
+
+    if (tokenizer.isChar('=')) {
+      tokenizer.skipChar();
+
+      op_ = CCSSAttributeOp::STARTS_WITH;
+    }
+    else {
+      // TODO: error
+    }
+  }
+
+  //---
+
+  // read value (quoted string or name)
+  tokenizer.skipSpace();
+
+  if (tokenizer.isOneOf("\"'")) {
+    CCSSTokenizer::Token token = tokenizer.nextToken();
+
+    value_ = std::string(token.str);
+  }
+  else
+    value_ = std::string(CCSSTokenizer::trim(tokenizer.readUntil("")));
+}
+
+//----------
+
+bool
+CCSS::Selector::
+checkMatch(const CCSSTagDataP &data) const
+{
+  return checkMatch(CCSSTagDataAdapter(), data);
+}
+
+bool
+CCSS::Selector::
+checkMatch(const CCSSTagNode &node) const
+{
+  return checkMatch(CCSSTagNodeAdapter(), &node);
+}
+
+void
+CCSS::Selector::
+compileFunctions()
+{
+  compiledFns_.clear();
+
+  for (const auto &fn : fns_)
+    compiledFns_.push_back(Function(fn));
+}
+
+bool
+CCSS::Selector::
+isNamesOnly() const
+{
+  if (! exprs_.empty())
+    return false;
+
+  // unsupported and invalid functions don't depend on tag
+  for (const auto &fn : compiledFns_) {
+    if (fn.type() != FunctionType::UNKNOWN && fn.type() != FunctionType::BAD_EXPR)
+      return false;
+  }
+
+  return true;
+}
+
+//----------
+
+void
+CCSS::Function::
+init(std::string_view str)
+{
+  static const std::pair<std::string_view, FunctionType> nthNames[] = {
+    { "nth-child("       , FunctionType::NTH_CHILD        },
+    { "nth-last-child("  , FunctionType::NTH_LAST_CHILD   },
+    { "nth-of-type("     , FunctionType::NTH_OF_TYPE      },
+    { "nth-last-of-type(", FunctionType::NTH_LAST_OF_TYPE },
+  };
+
+  static const std::pair<std::string_view, FunctionType> names[] = {
+    { "first-child"  , FunctionType::FIRST_CHILD   },
+    { "last-child"   , FunctionType::LAST_CHILD    },
+    { "only-child"   , FunctionType::ONLY_CHILD    },
+    { "first-of-type", FunctionType::FIRST_OF_TYPE },
+    { "last-of-type" , FunctionType::LAST_OF_TYPE  },
+    { "only-of-type" , FunctionType::ONLY_OF_TYPE  },
+    { "root"         , FunctionType::ROOT          },
+    { "required"     , FunctionType::REQUIRED      },
+    { "invalid"      , FunctionType::INVALID       },
+  };
+
+  type_ = FunctionType::UNKNOWN;
+
+  for (const auto &name : names) {
+    if (str == name.first) {
+      type_ = name.second;
+      return;
+    }
+  }
+
+  if (str.empty() || str.back() != ')')
+    return;
+
+  for (const auto &nthName : nthNames) {
+    if (str.compare(0, nthName.first.size(), nthName.first) != 0)
+      continue;
+
+    std::string_view args = str.substr(nthName.first.size(),
+                                       str.size() - nthName.first.size() - 1);
+
+    if (NthExpr::parse(args, nthExpr_))
+      type_ = nthName.second;
+    else
+      type_ = FunctionType::BAD_EXPR;
+
+    return;
+  }
+}
+
+//----------
+
+bool
+CCSS::NthExpr::
+parse(std::string_view str, NthExpr &expr)
+{
+  str = CCSSTokenizer::trim(str);
+
+  auto isNoCase = [&](std::string_view name) {
+    if (str.size() != name.size()) return false;
+
+    for (std::size_t i = 0; i < str.size(); ++i)
+      if (tolower(str[i]) != name[i]) return false;
+
+    return true;
+  };
+
+  if (isNoCase("odd" )) { expr = NthExpr(2, 1); return true; }
+  if (isNoCase("even")) { expr = NthExpr(2, 0); return true; }
+
+  //---
+
+  std::size_t i   = 0;
+  std::size_t len = str.size();
+
+  auto skipSpace = [&]() {
+    while (i < len && isspace(str[i]))
+      ++i;
+  };
+
+  bool overflow = false;
+
+  // read optional sign (if allowed) and digits (returns false if neither).
+  // Sets overflow if value is too large for an int
+  auto readInteger = [&](int &value, bool &hasDigits, bool allowSign) {
+    int sign = 1;
+
+    bool hasSign = false;
+
+    if (allowSign && i < len && (str[i] == '+' || str[i] == '-')) {
+      sign    = (str[i] == '-' ? -1 : 1);
+      hasSign = true;
+
+      ++i;
+    }
+
+    value     = 0;
+    hasDigits = false;
+
+    while (i < len && isdigit(str[i])) {
+      int d = str[i] - '0';
+
+      if (value > (INT_MAX - d)/10)
+        overflow = true;
+      else
+        value = 10*value + d;
+
+      hasDigits = true;
+
+      ++i;
+    }
+
+    value *= sign;
+
+    if (! hasDigits && hasSign)
+      value = sign; // sign only (+n or -n)
+
+    return (hasDigits || hasSign);
+  };
+
+  int  a = 0, b = 0;
+  bool hasDigits = false;
+
+  bool hasA = readInteger(a, hasDigits, /*allowSign*/true);
+
+  if (overflow)
+    return false;
+
+  // An[+B]
+  if (i < len && (str[i] == 'n' || str[i] == 'N')) {
+    if (! hasA)
+      a = 1; // n
+
+    ++i;
+
+    skipSpace();
+
+    if (i < len) {
+      if (str[i] != '+' && str[i] != '-')
+        return false;
+
+      int sign = (str[i] == '-' ? -1 : 1);
+
+      ++i;
+
+      skipSpace();
+
+      // B is digits only after sign (3n+-2 is invalid)
+      if (! readInteger(b, hasDigits, /*allowSign*/false) || ! hasDigits || overflow)
+        return false;
+
+      b *= sign;
+    }
+  }
+  // B
+  else {
+    if (! hasDigits)
+      return false;
+
+    b = a;
+    a = 0;
+  }
+
+  skipSpace();
+
+  if (i < len)
+    return false;
+
+  expr = NthExpr(a, b);
+
+  return true;
+}
+
+//----------
+
+bool
+CCSS::SelectorList::
+checkMatch(const CCSSTagDataP &data) const
+{
+  // all selectors must match
+  for (const auto &selector : selectors_) {
+    if (! selector.checkMatch(data))
+      return false;
+  }
+
+  return true;
+}
+
+//----------
+
+void
+CCSS::StyleData::
+initAncestorHashes()
+{
+  numAncestorHashes_ = 0;
+
+  const auto &selectors = selectorList_.selectors();
+
+  if (selectors.size() < 2)
+    return;
+
+  // a selector followed by a descendant or child combinator is always an ancestor of
+  // the matched tag (siblings share the ancestors of the tag they are next to).
+  // Use names nearest the matched tag first and ids, then classes then elements as
+  // they are most likely to reject
+  auto addHash = [&](const CCSSAtom &atom) {
+    if (numAncestorHashes_ >= MAX_ANCESTOR_HASHES)
+      return;
+
+    uint hash = atom.hash();
+
+    for (uint i = 0; i < numAncestorHashes_; ++i)
+      if (ancestorHashes_[i] == hash) return;
+
+    ancestorHashes_[numAncestorHashes_++] = hash;
+  };
+
+  for (int pass = 0; pass < 3; ++pass) {
+    for (int i = int(selectors.size()) - 2; i >= 0; --i) {
+      const Selector &selector = selectors[uint(i)];
+
+      if (selector.nextType() != NextType::DESCENDANT && selector.nextType() != NextType::CHILD)
+        continue;
+
+      if      (pass == 0) {
+        for (const auto &id : selector.idNames())
+          addHash(id);
+      }
+      else if (pass == 1) {
+        for (const auto &className : selector.classNames())
+          addHash(className);
+      }
+      else {
+        if (! selector.isUniversal() && ! selector.nameAtom().empty())
+          addHash(selector.nameAtom());
+      }
+    }
+  }
+}
+
+void
+CCSS::StyleData::
+initShareType()
+{
+  shareType_ = ShareType::NONE;
+
+  const auto &selectors = selectorList_.selectors();
+
+  if (selectors.empty())
+    return;
+
+  uint n = uint(selectors.size());
+
+  // matched tag must only be checked by names and not depend on its siblings
+  if (! selectors[n - 1].isNamesOnly())
+    return;
+
+  if (n > 1) {
+    NextType nextType = selectors[n - 2].nextType();
+
+    if (nextType == NextType::SIBLING || nextType == NextType::PRECEDER)
+      return;
+  }
+
+  shareType_ = ShareType::SIBLING;
+
+  // ancestors must only be checked by names
+  for (uint i = 0; i < n - 1; ++i) {
+    NextType nextType = selectors[i].nextType();
+
+    if (nextType != NextType::DESCENDANT && nextType != NextType::CHILD)
+      return;
+
+    if (! selectors[i].isNamesOnly())
+      return;
+  }
+
+  shareType_ = ShareType::CHAIN;
+}
+
+bool
+CCSS::StyleData::
+checkMatch(const CCSSTagDataP &data) const
+{
+  CCSSTagDataNode node(data);
+
+  return checkMatch(node);
+}
+
+bool
+CCSS::StyleData::
+checkMatch(const CCSSTagNode &node) const
+{
+  return checkMatch(CCSSTagNodeAdapter(), &node);
+}
+
+bool
+CCSS::StyleData::
+checkMatch(const TreePath &path) const
+{
+  CCSSPathAdapter adapter(path);
+
+  return checkMatch(adapter, adapter.current());
+}
+
+void
+CCSS::StyleData::
+printStyle(std::ostream &os) const
+{
+  os << "<style class=\"";
+
+  int i = 0;
+
+  for (const auto &selector : selectorList_.selectors()) {
+    if (i > 0)
+      os << " ";
+
+    os << selector;
+
+    ++i;
+  }
+
+  os << "\"";
+
+  for (const auto &o : options_) {
+    os << " ";
+
+    o.printStyle(os);
+  }
+
+  os << "/>";
+}
+
+void
+CCSS::StyleData::
+print(std::ostream &os) const
+{
+  int i = 0;
+
+  for (const auto &selector : selectorList_.selectors()) {
+    if (i > 0)
+      os << " ";
+
+    os << selector;
+
+    ++i;
+  }
+
+  os << " {";
+
+  for (const auto &o : options_) {
+    os << " ";
+
+    o.print(os);
+  }
+
+  os << " }";
+}
+
+void
+CCSS::StyleData::
+printDebug(std::ostream &os) const
+{
+  int i = 0;
+
+  for (const auto &selector : selectorList_.selectors()) {
+    if (i > 0)
+      os << " ";
+
+    selector.printDebug(os);
+
+    ++i;
+  }
+
+  //---
+
+  i = 0;
+
+  os << " {";
+
+  for (const auto &o : options_) {
+    if (i > 0)
+      os << " ";
+
+    o.printDebug(os);
+
+    ++i;
+  }
+
+  os << "}";
+}
+
+//----------
+
+void
+CCSS::ComputedStyle::
+setOptions(OptionList &&options)
+{
+  options_ = std::move(options);
+
+  // names are unique so order doesn't depend on order options are resolved in
+  std::sort(options_.begin(), options_.end(), [](const Option &o1, const Option &o2) {
+    return o1.getName() < o2.getName();
+  });
+
+  // atom order depends on order names were interned so only used for lookup
+  uint numOptions = uint(options_.size());
+
+  atomIndex_.resize(numOptions);
+
+  for (uint i = 0; i < numOptions; ++i)
+    atomIndex_[i] = i;
+
+  std::sort(atomIndex_.begin(), atomIndex_.end(), [&](uint i1, uint i2) {
+    return options_[i1].nameAtom() < options_[i2].nameAtom();
+  });
+}
+
+const CCSS::Option *
+CCSS::ComputedStyle::
+getOption(const CCSSAtom &name) const
+{
+  if (name.empty())
+    return nullptr;
+
+  auto p = std::lower_bound(atomIndex_.begin(), atomIndex_.end(), name,
+    [&](uint i, const CCSSAtom &name1) { return options_[i].nameAtom() < name1; });
+
+  if (p == atomIndex_.end() || options_[*p].nameAtom() != name)
+    return nullptr;
+
+  return &options_[*p];
+}
+
+//----------
+
+void
+CCSS::MatchContext::
+pushAncestor(const CCSSTagDataP &data)
+{
+  CCSSTagNames names;
+
+  bool hasNames = data->getNames(names);
+
+  filter_    .pushNames(hasNames ? &names : nullptr);
+  shareCache_.pushAncestor(hasNames ? &names : nullptr);
+
+  pushAncestorHash(ancestorHashes_.empty() && ! data->getParent(), hasNames ? &names : nullptr);
+}
+
+void
+CCSS::MatchContext::
+pushAncestor(const CCSSTagNode &node)
+{
+  CCSSTagNames names;
+
+  bool hasNames = node.getNames(names);
+
+  filter_    .pushNames(hasNames ? &names : nullptr);
+  shareCache_.pushAncestor(hasNames ? &names : nullptr);
+
+  pushAncestorHash(ancestorHashes_.empty() && ! node.parentNode(), hasNames ? &names : nullptr);
+}
+
+void
+CCSS::MatchContext::
+pushAncestorHash(bool isRoot, const CCSSTagNames *names)
+{
+  // hash is only valid if walk started at document root and all ancestors have names
+  uint64_t hash = 0;
+
+  if (names) {
+    if (! ancestorHashes_.empty())
+      hash = ancestorHashes_.back();
+    else if (isRoot)
+      hash = rootAncestorsHash;
+
+    if (hash) {
+      getNamesKey(*names, namesKey_);
+
+      hash = addAncestorHash(hash, namesKey_);
+    }
+  }
+
+  ancestorHashes_.push_back(hash);
+}
+
+//----------
+
+uint64_t
+CCSS::RuleVersion::
+nextId()
+{
+  static std::atomic<uint64_t> lastId { 0 };
+
+  return ++lastId;
+}
+
+//----------
+
+void
+CCSS::MatchCache::
+setMaxSize(std::size_t n)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  maxSize_ = n;
+
+  clearEntries();
+}
+
+bool
+CCSS::MatchCache::
+lookup(const std::vector<uint> &names, uint64_t ancestorsHash, uint64_t version,
+       SharedRules &rules)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (version != version_) {
+    clearEntries();
+
+    version_ = version;
+  }
+
+  auto p = entryMap_.find(entryHash(names, ancestorsHash));
+
+  if (p == entryMap_.end() ||
+      (*p).second->ancestorsHash != ancestorsHash || (*p).second->names != names) {
+    ++misses_;
+    return false;
+  }
+
+  // move to front (most recently used)
+  entries_.splice(entries_.begin(), entries_, (*p).second);
+
+  rules = entries_.front().rules;
+
+  ++hits_;
+
+  return true;
+}
+
+void
+CCSS::MatchCache::
+add(const std::vector<uint> &names, uint64_t ancestorsHash, uint64_t version,
+    const SharedRules &rules)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (maxSize_ == 0)
+    return;
+
+  if (version != version_) {
+    clearEntries();
+
+    version_ = version;
+  }
+
+  uint64_t hash = entryHash(names, ancestorsHash);
+
+  auto p = entryMap_.find(hash);
+
+  // replace entry with same hash
+  if (p != entryMap_.end()) {
+    entries_.splice(entries_.begin(), entries_, (*p).second);
+  }
+  else {
+    // remove least recently used
+    if (entries_.size() >= maxSize_) {
+      entryMap_.erase(entries_.back().hash);
+
+      entries_.pop_back();
+    }
+
+    entries_.emplace_front();
+
+    entryMap_[hash] = entries_.begin();
+  }
+
+  Entry &entry = entries_.front();
+
+  entry.hash          = hash;
+  entry.names         = names;
+  entry.ancestorsHash = ancestorsHash;
+  entry.rules         = rules;
+}
+
+CCSS::MatchCacheStats
+CCSS::MatchCache::
+stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  MatchCacheStats stats;
+
+  stats.hits   = hits_;
+  stats.misses = misses_;
+  stats.size   = entries_.size();
+
+  return stats;
+}
+
+void
+CCSS::MatchCache::
+resetStats()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  hits_   = 0;
+  misses_ = 0;
+}
+
+void
+CCSS::MatchCache::
+clear()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  clearEntries();
+}
+
+void
+CCSS::MatchCache::
+clearEntries()
+{
+  entries_ .clear();
+  entryMap_.clear();
+}
+
+uint64_t
+CCSS::MatchCache::
+entryHash(const std::vector<uint> &names, uint64_t ancestorsHash)
+{
+  return addAncestorHash(ancestorsHash, names);
+}
+
+//----------
+
+CCSS::RuleStatsTable &
+CCSS::RuleStatsTable::
+operator=(const RuleStatsTable &table)
+{
+  if (&table == this)
+    return *this;
+
+  enabled_ = table.enabled_;
+
+  counters_.clear();
+
+  resize(table.size());
+
+  for (std::size_t i = 0; i < table.size(); ++i)
+    add(uint(i), table.stats(uint(i)));
+
+  return *this;
+}
+
+void
+CCSS::RuleStatsTable::
+resize(std::size_t n)
+{
+  // counters are default constructed in place
+  while (counters_.size() < n)
+    counters_.emplace_back();
+}
+
+void
+CCSS::RuleStatsTable::
+add(uint ind, const RuleStats &stats)
+{
+  if (ind >= counters_.size())
+    return;
+
+  Counters &counters = counters_[ind];
+
+  auto order = std::memory_order_relaxed;
+
+  counters.attempts.fetch_add(stats.attempts, order);
+
+  if (stats.filtered)
+    counters.filtered.fetch_add(stats.filtered, order);
+
+  if (stats.rightmostRejects)
+    counters.rightmostRejects.fetch_add(stats.rightmostRejects, order);
+
+  if (stats.combinatorWalks)
+    counters.combinatorWalks.fetch_add(stats.combinatorWalks, order);
+
+  if (stats.matches)
+    counters.matches.fetch_add(stats.matches, order);
+
+  counters.time.fetch_add(stats.time, order);
+}
+
+CCSS::RuleStats
+CCSS::RuleStatsTable::
+stats(uint ind) const
+{
+  RuleStats stats;
+
+  if (ind >= counters_.size())
+    return stats;
+
+  const Counters &counters = counters_[ind];
+
+  auto order = std::memory_order_relaxed;
+
+  stats.attempts         = counters.attempts        .load(order);
+  stats.filtered         = counters.filtered        .load(order);
+  stats.rightmostRejects = counters.rightmostRejects.load(order);
+  stats.combinatorWalks  = counters.combinatorWalks .load(order);
+  stats.matches          = counters.matches         .load(order);
+  stats.time             = counters.time            .load(order);
+
+  return stats;
+}
+
+void
+CCSS::RuleStatsTable::
+reset()
+{
+  for (auto &counters : counters_) {
+    counters.attempts        .store(0);
+    counters.filtered        .store(0);
+    counters.rightmostRejects.store(0);
+    counters.combinatorWalks .store(0);
+    counters.matches         .store(0);
+    counters.time            .store(0);
+  }
+}
+
+//----------
+
+void
+CCSS::
+getNamesKey(const CCSSTagNames &names, std::vector<uint> &key)
+{
+  key.clear();
+
+  key.push_back(names.element.id());
+  key.push_back(uint(names.ids.size()));
+
+  for (const auto &id : names.ids)
+    key.push_back(id.id());
+
+  std::size_t numIds = key.size();
+
+  for (const auto &className : names.classes)
+    key.push_back(className.id());
+
+  // name order doesn't matter
+  auto begin = key.begin();
+
+  std::sort(begin + 2, begin + long(numIds));
+  std::sort(begin + long(numIds), key.end());
+}
+
+uint64_t
+CCSS::
+addAncestorHash(uint64_t hash, const std::vector<uint> &key)
+{
+  // FNV-1a of each id (ids are unique per name so only need to be hashed once)
+  for (const auto &id : key) {
+    hash ^= id;
+    hash *= 1099511628211ULL;
+  }
+
+  // separate ancestors
+  hash ^= 0xff;
+  hash *= 1099511628211ULL;
+
+  return hash;
+}
+
+//----------
+
+void
+CCSS::CompiledSelector::
+init(SelectorLists &selectorLists)
+{
+  selectorLists_ = std::move(selectorLists);
+
+  fastPath_ = FastPath::NONE;
+  fastName_ = CCSSAtom();
+
+  // single selector with only an id, class or element name
+  if (selectorLists_.size() != 1)
+    return;
+
+  const auto &selectors = selectorLists_[0].selectors();
+
+  if (selectors.size() != 1)
+    return;
+
+  const Selector &selector = selectors[0];
+
+  if (! selector.expressions().empty() || ! selector.functions().empty())
+    return;
+
+  std::size_t numIds     = selector.idNames   ().size();
+  std::size_t numClasses = selector.classNames().size();
+
+  if      (selector.isUniversal()) {
+    if      (numIds == 1 && numClasses == 0) {
+      fastPath_ = FastPath::ID;
+      fastName_ = selector.idNames()[0];
+    }
+    else if (numIds == 0 && numClasses == 1) {
+      fastPath_ = FastPath::CLASS;
+      fastName_ = selector.classNames()[0];
+    }
+  }
+  else if (numIds == 0 && numClasses == 0) {
+    fastPath_ = FastPath::ELEMENT;
+    fastName_ = selector.nameAtom();
+  }
+}
+
+bool
+CCSS::CompiledSelector::
+checkMatch(const CCSSTagDataP &data) const
+{
+  // fast paths only check tag itself
+  if (fastPath_ != FastPath::NONE)
+    return checkMatch(CCSSTagDataAdapter(), data);
+
+  // match through node so linked tags stay alive until match is done (tags are
+  // remembered by address and new tag data may be returned for each link)
+  CCSSTagDataNode node(data);
+
+  return checkMatch(CCSSTagNodeAdapter(), &node);
+}
+
+template<typename Proc>
+void
+CCSS::CompiledSelector::
+walk(const CCSSTagDataP &root, const Proc &proc) const
+{
+  // stack of tags to visit (children pushed in reverse so popped in document order)
+  TagDataArray stack, children;
+
+  root->getChildren(children);
+
+  stack.assign(children.rbegin(), children.rend());
+
+  while (! stack.empty()) {
+    CCSSTagDataP data = std::move(stack.back());
+
+    stack.pop_back();
+
+    if (! proc(data))
+      return;
+
+    children.clear();
+
+    data->getChildren(children);
+
+    stack.insert(stack.end(), children.rbegin(), children.rend());
+  }
+}
+
+CCSSTagDataP
+CCSS::CompiledSelector::
+querySelector(const CCSSTagDataP &root) const
+{
+  CCSSTagDataP result;
+
+  walk(root, [&](const CCSSTagDataP &data) {
+    if (! checkMatch(data))
+      return true;
+
+    result = data;
+
+    return false;
+  });
+
+  return result;
+}
+
+void
+CCSS::CompiledSelector::
+querySelectorAll(const CCSSTagDataP &root, TagDataArray &tags) const
+{
+  walk(root, [&](const CCSSTagDataP &data) {
+    if (checkMatch(data))
+      tags.push_back(data);
+
+    return true;
+  });
+}
+
+CCSS::CompiledSelector::TagDataArray
+CCSS::CompiledSelector::
+querySelectorAll(const CCSSTagDataP &root) const
+{
+  TagDataArray tags;
+
+  querySelectorAll(root, tags);
+
+  return tags;
+}
+
+//----------
+
+void
+CCSS::TagFilter::
+setAll()
 {
-  styleData_.clear();
+  all_ = true;
+
+  ids_       .clear();
+  classes_   .clear();
+  attributes_.clear();
+  elements_  .clear();
 }
 
 void
-CCSS::
-printStyle(std::ostream &os) const
+CCSS::TagFilter::
+addName(ChangeType type, const CCSSAtom &name)
 {
-  for (const auto &d : styleData_) {
-    const StyleData &styleData = d.second;
+  if (all_)
+    return;
 
-    styleData.printStyle(os);
+  Atoms &names1 = names(type);
 
-    os << std::endl;
+  if (std::find(names1.begin(), names1.end(), name) != names1.end())
+    return;
+
+  // too many names to check so match all
+  if (ids_.size() + classes_.size() + attributes_.size() + elements_.size() >= MAX_NAMES) {
+    setAll();
+    return;
   }
+
+  names1.push_back(name);
 }
 
 void
-CCSS::
-print(std::ostream &os) const
+CCSS::TagFilter::
+add(const TagFilter &filter)
 {
-  for (const auto &d : styleData_) {
-    const StyleData &styleData = d.second;
+  if (filter.all_) {
+    setAll();
+    return;
+  }
 
-    if (isDebug())
-      styleData.printDebug(os);
-    else
-      styleData.print(os);
+  for (const auto &name : filter.ids_       ) addName(ChangeType::ID       , name);
+  for (const auto &name : filter.classes_   ) addName(ChangeType::CLASS    , name);
+  for (const auto &name : filter.attributes_) addName(ChangeType::ATTRIBUTE, name);
+  for (const auto &name : filter.elements_  ) addName(ChangeType::ELEMENT  , name);
+}
 
-    os << std::endl;
-  }
+bool
+CCSS::TagFilter::
+checkMatch(const CCSSTagData &data) const
+{
+  if (all_)
+    return true;
+
+  for (const auto &name : ids_)
+    if (data.isId(name)) return true;
+
+  for (const auto &name : classes_)
+    if (data.isClass(name)) return true;
+
+  for (const auto &name : attributes_)
+    if (data.hasAttribute(name, CCSSAttributeOp::NONE, "")) return true;
+
+  for (const auto &name : elements_)
+    if (data.isElement(name)) return true;
+
+  return false;
 }
 
-void
-CCSS::
-errorMsg(const std::string &msg) const
+CCSS::Atoms &
+CCSS::TagFilter::
+names(ChangeType type)
 {
-  if (isDebug())
-    std::cerr << msg << std::endl;
+  switch (type) {
+    case ChangeType::ELEMENT: return elements_;
+    case ChangeType::ID     : return ids_;
+    case ChangeType::CLASS  : return classes_;
+    default                 : return attributes_;
+  }
 }
 
-//----------
+//---
 
 void
-CCSS::Expr::
-init(const std::string &str)
+CCSS::InvalidationSet::
+add(const InvalidationSet &set)
 {
-  CStrParse parse(str);
+  if (set.self)
+    self = true;
 
-  //---
+  descendants       .add(set.descendants);
+  siblings          .add(set.siblings);
+  siblingDescendants.add(set.siblingDescendants);
+}
 
-  // read id
-  parse.skipSpace();
+//---
 
-  char c;
+void
+CCSS::Invalidations::
+build(const StyleDataList &styleData)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
 
-  while (! parse.eof() && ! parse.isSpace() && ! parse.isOneOf("=~|")) {
-    parse.readChar(&c);
+  if (built_)
+    return;
 
-    id_ += c;
+  for (const auto &styleData1 : styleData) {
+    if (! styleData1.isRemoved())
+      addRule(styleData1.getSelectorList());
   }
 
-  //---
+  built_ = true;
+}
 
-  // read op
-  parse.skipSpace();
+void
+CCSS::Invalidations::
+addRule(const SelectorList &selectorList)
+{
+  static CCSSAtom requiredAtom("required");
+  static CCSSAtom invalidAtom ("invalid");
 
-  if      (parse.isChar('=')) {
-    parse.skipChar();
+  const auto &selectors = selectorList.selectors();
 
-    op_ = CCSSAttributeOp::EQUAL;
-  }
-  else if (parse.isChar('~')) {
-    parse.skipChar();
+  if (selectors.empty())
+    return;
 
-    if (parse.isChar('=')) {
-      parse.skipChar();
+  std::size_t n = selectors.size();
 
-      op_ = CCSSAttributeOp::PARTIAL;
-    }
+  // tags rule can match (tags with a name of rightmost selector)
+  TagFilter subject;
+
+  const Selector &last = selectors.back();
+
+  if      (! last.idNames().empty())
+    subject.addName(ChangeType::ID, last.idNames()[0]);
+  else if (! last.classNames().empty())
+    subject.addName(ChangeType::CLASS, last.classNames()[0]);
+  else if (! last.expressions().empty())
+    subject.addName(ChangeType::ATTRIBUTE, last.expressions()[0].idAtom());
+  else if (! last.isUniversal())
+    subject.addName(ChangeType::ELEMENT, last.nameAtom());
+  else
+    subject.setAll();
+
+  for (std::size_t i = 0; i < n; ++i) {
+    // get position of rule's tags relative to tag of selector from the combinators
+    // to its right. Sibling combinators before any descendant or child combinator
+    // move to later siblings, after it the rule's tags are below the sibling
+    InvalidationSet set;
+
+    if (i == n - 1)
+      set.self = true;
     else {
-      // TODO: error
-    }
-  }
-  else if (parse.isChar('|')) {
-    parse.skipChar();
+      bool sibling    = false;
+      bool descendant = false;
 
-    if (parse.isChar('=')) {
-      parse.skipChar();
+      for (std::size_t j = i; j < n - 1; ++j) {
+        NextType nextType = selectors[j].nextType();
 
-      op_ = CCSSAttributeOp::STARTS_WITH;
-    }
-    else {
-      // TODO: error
+        if (nextType == NextType::DESCENDANT || nextType == NextType::CHILD) {
+          descendant = true;
+          break;
+        }
+
+        sibling = true;
+      }
+
+      if      (! descendant)
+        set.siblings = subject;
+      else if (sibling)
+        set.siblingDescendants = subject;
+      else
+        set.descendants = subject;
     }
-  }
 
-  //---
+    //---
 
-  // read value
-  parse.skipSpace();
+    // add to set of each name checked by selector
+    const Selector &selector = selectors[i];
 
-  if (parse.isChar('"')) {
-    parse.skipChar();
+    if (! selector.isUniversal())
+      elements_[selector.nameAtom()].add(set);
 
-    while (! parse.eof() && ! parse.isChar('"')) {
-      parse.readChar(&c);
+    for (const auto &idName : selector.idNames())
+      ids_[idName].add(set);
 
-      value_ += c;
-    }
+    for (const auto &className : selector.classNames())
+      classes_[className].add(set);
 
-    if (parse.isChar('"'))
-      parse.skipChar();
+    for (const auto &expr : selector.expressions())
+      attributes_[expr.idAtom()].add(set);
+
+    for (const auto &fn : selector.compiledFunctions()) {
+      if      (fn.type() == FunctionType::REQUIRED)
+        attributes_[requiredAtom].add(set);
+      else if (fn.type() == FunctionType::INVALID)
+        attributes_[invalidAtom].add(set);
+    }
   }
 }
 
-//----------
-
-bool
-CCSS::Selector::
-checkMatch(const CCSSTagDataP &data) const
+const CCSS::InvalidationSet &
+CCSS::Invalidations::
+get(ChangeType type, const CCSSAtom &name) const
 {
-  // check name
-  if (name_ != "" && name_ != "*") {
-    if (! data->isElement(name_))
-      return false;
-  }
+  static InvalidationSet emptySet;
 
-  //---
+  const AtomSets *sets1 = &attributes_;
 
-  // check ids
-  if (! idNames_.empty()) {
-    // must match all
-    bool match = true;
+  switch (type) {
+    case ChangeType::ELEMENT: sets1 = &elements_; break;
+    case ChangeType::ID     : sets1 = &ids_     ; break;
+    case ChangeType::CLASS  : sets1 = &classes_ ; break;
+    default                 :                     break;
+  }
 
-    for (const auto &idName : idNames_) {
-      if (! data->isId(idName)) {
-        match = false;
-        break;
-      }
-    }
+  auto p = sets1->find(name);
 
-    if (! match)
-      return false;
-  }
+  if (p == sets1->end())
+    return emptySet;
 
-  //---
+  return (*p).second;
+}
+
+void
+CCSS::Invalidations::
+clear()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
 
-  // check classes
-  if (! classNames_.empty()) {
-    // must match all
-    bool match = true;
+  built_ = false;
 
-    for (const auto &className : classNames_) {
-      if (! data->isClass(className)) {
-        match = false;
-        break;
-      }
-    }
+  elements_  .clear();
+  ids_       .clear();
+  classes_   .clear();
+  attributes_.clear();
+}
 
-    if (! match)
-      return false;
+CCSS::Invalidations::AtomSets &
+CCSS::Invalidations::
+sets(ChangeType type)
+{
+  switch (type) {
+    case ChangeType::ELEMENT: return elements_;
+    case ChangeType::ID     : return ids_;
+    case ChangeType::CLASS  : return classes_;
+    default                 : return attributes_;
   }
+}
 
-  //---
+//----------
 
-  // check expressions
-  if (! exprs_.empty()) {
-    // must match all
-    bool match = true;
+void
+CCSS::StyleShareCache::
+pushAncestor(const CCSSTagNames *names)
+{
+  Ancestor ancestor;
 
-    for (const auto &expr : exprs_) {
-      if (! data->hasAttribute(expr.id(), expr.op(), expr.value())) {
-        match = false;
-        break;
-      }
-    }
+  ancestor.id = ++lastAncestorId_;
 
-    if (! match)
-      return false;
+  // ancestor without names gets a new chain so only its own children share it
+  if (enabled_ && names) {
+    setKey(*names);
+
+    ancestor.chain = findEntry().chain;
   }
+  else
+    ancestor.chain = ++lastChain_;
 
-  //---
+  ancestors_.push_back(ancestor);
+}
 
-  // check functions
-  if (! fns_.empty()) {
-    // must match all
-    bool match = true;
+void
+CCSS::StyleShareCache::
+popAncestor()
+{
+  assert(! ancestors_.empty());
 
-    bool error = false;
+  ancestors_.pop_back();
+}
 
-    for (const auto &fn : fns_) {
-      std::vector<std::string> match_strs;
+CCSS::StyleShareCache::Entry *
+CCSS::StyleShareCache::
+lookup(uint64_t version, const CCSSTagNames &names)
+{
+  if (! enabled_ || ancestors_.empty())
+    return nullptr;
 
-      if      (CRegExpUtil::parse(fn, "nth-child(\\(.*\\))", match_strs)) {
-        long value;
+  // rules are only valid for one version of one stylesheet
+  if (version != version_) {
+    entries_.clear();
 
-        if (! CStrUtil::toInteger(match_strs[0], &value))
-          continue;
+    version_ = version;
+  }
 
-        if (! data->isNthChild(int(value))) {
-          match = false;
-          break;
-        }
-      }
-      else if (fn == "required" || fn == "invalid") {
-        if (! data->isInputValue(fn)) {
-          match = false;
-          break;
-        }
-      }
-      else {
-        if (! error) {
-          std::cerr << "selector functions not handled:";
-          error = true;
-        }
+  setKey(names);
 
-        std::cerr << " " << fn;
-      }
-    }
+  return &findEntry();
+}
 
-    if (error)
-      std::cerr << std::endl;
+void
+CCSS::StyleShareCache::
+clear()
+{
+  entries_  .clear();
+  ancestors_.clear();
 
-    if (! match)
-      return false;
-  }
+  version_ = 0;
+}
 
-  //---
+void
+CCSS::StyleShareCache::
+setKey(const CCSSTagNames &names)
+{
+  key_.chain = (! ancestors_.empty() ? ancestors_.back().chain : 0);
 
-  return true;
+  getNamesKey(names, key_.names);
 }
 
-//----------
-
-bool
-CCSS::SelectorList::
-checkMatch(const CCSSTagDataP &data) const
+CCSS::StyleShareCache::Entry &
+CCSS::StyleShareCache::
+findEntry()
 {
-  // all selectors must match
-  for (const auto &selector : selectors_) {
-    if (! selector.checkMatch(data))
-      return false;
-  }
+  auto p = entries_.find(key_);
 
-  return true;
+  if (p != entries_.end())
+    return (*p).second;
+
+  // forget all entries when full (chain ids are never reused so ancestors
+  // keep valid chains)
+  if (entries_.size() >= MAX_ENTRIES)
+    entries_.clear();
+
+  Entry &entry = entries_[key_];
+
+  entry.chain = ++lastChain_;
+
+  return entry;
 }
 
 //----------
 
 bool
-CCSS::StyleData::
-checkMatch(const CCSSTagDataP &data) const
+CCSS::AncestorFilter::
+push(const CCSSTagData &data)
 {
-  const auto &selectors = selectorList_.selectors();
+  CCSSTagNames names;
 
-  if (selectors.empty())
-    return false;
+  bool hasNames = data.getNames(names);
 
-  //---
+  return pushNames(hasNames ? &names : nullptr);
+}
 
-  // match last selector
-  std::size_t n = selectors.size();
+bool
+CCSS::AncestorFilter::
+push(const CCSSTagNode &node)
+{
+  CCSSTagNames names;
 
-  int i = int(n - 1);
+  bool hasNames = node.getNames(names);
 
-  const CCSS::Selector &selector = selectors[uint(i)];
+  return pushNames(hasNames ? &names : nullptr);
+}
 
-  if (! selector.checkMatch(data))
-    return false;
+bool
+CCSS::AncestorFilter::
+pushNames(const CCSSTagNames *names)
+{
+  Frame frame;
 
-  --i;
+  frame.start = hashes_.size();
 
-  //---
+  if (names) {
+    if (! names->element.empty())
+      hashes_.push_back(names->element.hash());
 
-  if (i >= 0) {
-    CCSSTagData::TagDataArray currentTagDatas;
+    for (const auto &id : names->ids)
+      hashes_.push_back(id.hash());
 
-    currentTagDatas.push_back(data);
+    for (const auto &className : names->classes)
+      hashes_.push_back(className.hash());
 
-    while (i >= 0) {
-      const CCSS::Selector &selector1 = selectors[uint(i)];
+    for (std::size_t i = frame.start; i < hashes_.size(); ++i)
+      add(hashes_[i]);
+  }
+  else {
+    frame.named = false;
 
-      CCSSTagData::TagDataArray parentTagDatas;
+    ++numUnnamed_;
+  }
 
-      if      (selector1.nextType() == NextType::DESCENDANT) {
-        // collect list of any parents which match selector
-        for (const auto &currentTagData : currentTagDatas) {
-          CCSSTagDataP parent = currentTagData->getParent();
+  frames_.push_back(frame);
 
-          while (parent) {
-            if (selector1.checkMatch(parent))
-              parentTagDatas.push_back(parent);
+  return frame.named;
+}
 
-            parent = parent->getParent();
-          }
-        }
+void
+CCSS::AncestorFilter::
+pop()
+{
+  assert(! frames_.empty());
 
-        if (parentTagDatas.empty())
-          return false;
-      }
-      else if (selector1.nextType() == NextType::CHILD) {
-        // update list if parent matches selector
-        for (const auto &currentTagData : currentTagDatas) {
-          CCSSTagDataP parent = currentTagData->getParent();
-          if (! parent) continue;
-
-          if (selector1.checkMatch(parent))
-            parentTagDatas.push_back(parent);
-        }
+  const Frame &frame = frames_.back();
 
-        if (parentTagDatas.empty())
-          return false;
-      }
-      else if (selector1.nextType() == NextType::SIBLING) {
-        // update list if previous sibling matches selector
-        for (const auto &currentTagData : currentTagDatas) {
-          CCSSTagDataP child = currentTagData->getPrevSibling();
-          if (! child) continue;
-
-          if (selector1.checkMatch(child))
-            parentTagDatas.push_back(child);
-        }
+  if (frame.named) {
+    for (std::size_t i = frame.start; i < hashes_.size(); ++i)
+      remove(hashes_[i]);
 
-        if (parentTagDatas.empty())
-          return false;
-      }
-      else if (selector1.nextType() == NextType::PRECEDER) {
-        // update list if any previous sibling matches selector
-        for (const auto &currentTagData : currentTagDatas) {
-          CCSSTagDataP child = currentTagData->getPrevSibling();
+    hashes_.resize(frame.start);
+  }
+  else
+    --numUnnamed_;
 
-          while (child) {
-            if (selector1.checkMatch(child))
-              parentTagDatas.push_back(child);
+  frames_.pop_back();
+}
 
-            child = child->getPrevSibling();
-          }
-        }
+void
+CCSS::AncestorFilter::
+clear()
+{
+  std::fill(counts_, counts_ + SIZE, uint8_t(0));
 
-        if (parentTagDatas.empty())
-          return false;
-      }
+  hashes_.clear();
+  frames_.clear();
 
-      currentTagDatas = parentTagDatas;
+  numUnnamed_ = 0;
+}
 
-      --i;
-    }
-  }
+void
+CCSS::AncestorFilter::
+add(uint hash)
+{
+  uint8_t &count1 = counts_[hash1(hash)];
+  uint8_t &count2 = counts_[hash2(hash)];
 
-  return true;
+  if (count1 < 0xff) ++count1;
+  if (count2 < 0xff) ++count2;
 }
 
 void
-CCSS::StyleData::
-printStyle(std::ostream &os) const
+CCSS::AncestorFilter::
+remove(uint hash)
 {
-  os << "<style class=\"";
+  uint8_t &count1 = counts_[hash1(hash)];
+  uint8_t &count2 = counts_[hash2(hash)];
 
-  int i = 0;
+  if (count1 < 0xff) --count1;
+  if (count2 < 0xff) --count2;
+}
 
-  for (const auto &selector : selectorList_.selectors()) {
-    if (i > 0)
-      os << " ";
+//----------
 
-    os << selector;
+void
+CCSS::TreePath::
+setRoot(const CCSSTagDataP &root)
+{
+  clear();
 
-    ++i;
-  }
+  levels_.resize(1);
 
-  os << "\"";
+  Level &level = levels_[0];
 
-  for (const auto &o : options_) {
-    os << " ";
+  level.children.push_back(root);
 
-    o.printStyle(os);
-  }
+  level.index = 0;
+  level.end   = 1;
 
-  os << "/>";
+  depth_ = 1;
 }
 
 void
-CCSS::StyleData::
-print(std::ostream &os) const
+CCSS::TreePath::
+pushChildren()
 {
-  int i = 0;
+  // resize before getting current tag (may move levels)
+  if (depth_ >= levels_.size())
+    levels_.resize(depth_ + 1);
 
-  for (const auto &selector : selectorList_.selectors()) {
-    if (i > 0)
-      os << " ";
-
-    os << selector;
+  const CCSSTagDataP &data = current();
 
-    ++i;
-  }
+  Level &level = levels_[depth_];
 
-  os << " {";
+  level.children.clear();
 
-  for (const auto &o : options_) {
-    os << " ";
+  data->getChildren(level.children);
 
-    o.print(os);
-  }
+  level.borrowed = nullptr;
+  level.index    = 0;
+  level.end      = uint(level.children.size());
 
-  os << " }";
+  ++depth_;
 }
 
 void
-CCSS::StyleData::
-printDebug(std::ostream &os) const
+CCSS::TreePath::
+pushLevel(const TagDataArray &children, uint start, uint end)
 {
-  int i = 0;
+  if (depth_ >= levels_.size())
+    levels_.resize(depth_ + 1);
 
-  for (const auto &selector : selectorList_.selectors()) {
-    if (i > 0)
-      os << " ";
-
-    selector.printDebug(os);
+  Level &level = levels_[depth_];
 
-    ++i;
-  }
+  level.children.clear();
 
-  //---
+  level.borrowed = &children;
+  level.index    = start;
+  level.end      = std::min(end, uint(children.size()));
 
-  i = 0;
+  ++depth_;
+}
 
-  os << " {";
+void
+CCSS::TreePath::
+pop()
+{
+  assert(depth_ > 0);
 
-  for (const auto &o : options_) {
-    if (i > 0)
-      os << " ";
+  --depth_;
 
-    o.printDebug(os);
+  // release tags but keep capacity for reuse
+  levels_[depth_].children.clear();
 
-    ++i;
-  }
+  levels_[depth_].borrowed = nullptr;
+}
 
-  os << "}";
+void
+CCSS::TreePath::
+clear()
+{
+  while (depth_ > 0)
+    pop();
 }
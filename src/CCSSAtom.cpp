@@ -0,0 +1,133 @@
+#include <CCSSAtom.h>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+
+namespace {
+
+// global table of interned strings.
+//
+// Split into shards by string hash, each with its own lock, so threads interning
+// names (e.g. parsing stylesheet chunks) rarely wait for each other
+class CCSSAtomTable {
+ public:
+  typedef CCSSAtom::Entry Entry;
+
+ public:
+  static CCSSAtomTable &instance() {
+    static CCSSAtomTable table;
+
+    return table;
+  }
+
+  const Entry *emptyEntry() const { return &shards_[0].entries[0]; }
+
+  const Entry *lookup(std::string_view str, bool add) {
+    if (str.empty())
+      return emptyEntry();
+
+    uint hash = CCSSAtom::hashString(str);
+
+    uint shardInd = hash % NUM_SHARDS;
+
+    Shard &shard = shards_[shardInd];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto p = shard.entryMap.find(str);
+
+    if (p != shard.entryMap.end())
+      return (*p).second;
+
+    if (! add)
+      return nullptr;
+
+    // entries are in a deque so their address (and string) never change.
+    // ids are unique over all shards
+    Entry entry;
+
+    entry.str  = std::string(str);
+    entry.id   = uint(shard.entries.size())*NUM_SHARDS + shardInd;
+    entry.hash = hash;
+
+    shard.entries.push_back(std::move(entry));
+
+    const Entry *entry1 = &shard.entries.back();
+
+    shard.entryMap[std::string_view(entry1->str)] = entry1;
+
+    return entry1;
+  }
+
+ private:
+  CCSSAtomTable() {
+    // empty atom is first entry of first shard (id zero)
+    shards_[0].entries.push_back(Entry());
+  }
+
+ private:
+  enum { NUM_SHARDS = 16 };
+
+  // map uses atom hash so string is only hashed once per lookup
+  struct Hash {
+    std::size_t operator()(std::string_view str) const { return CCSSAtom::hashString(str); }
+  };
+
+  typedef std::unordered_map<std::string_view, const Entry *, Hash> EntryMap;
+
+  struct Shard {
+    std::mutex        mutex;
+    std::deque<Entry> entries;
+    EntryMap          entryMap;
+  };
+
+  Shard shards_[NUM_SHARDS];
+};
+
+}
+
+//------
+
+CCSSAtom::
+CCSSAtom() :
+ entry_(CCSSAtomTable::instance().emptyEntry())
+{
+}
+
+CCSSAtom::
+CCSSAtom(std::string_view str) :
+ entry_(CCSSAtomTable::instance().lookup(str, /*add*/true))
+{
+}
+
+CCSSAtom
+CCSSAtom::
+find(std::string_view str)
+{
+  const Entry *entry = CCSSAtomTable::instance().lookup(str, /*add*/false);
+
+  if (! entry)
+    return CCSSAtom();
+
+  return CCSSAtom(entry);
+}
+
+//------
+
+CCSSAtomCache::
+CCSSAtomCache(std::size_t n) :
+ entries_(new EntryP[n]()), size_(n)
+{
+}
+
+CCSSAtom
+CCSSAtomCache::
+add(std::size_t ind, std::string_view str) const
+{
+  // threads interning the same string get the same entry
+  CCSSAtom atom(str);
+
+  entries_[ind].store(atom.entry_, std::memory_order_release);
+
+  return atom;
+}
@@ -0,0 +1,858 @@
+#include <CCSSBinary.h>
+#include <CFile.h>
+#include <fstream>
+#include <unordered_map>
+#include <cstring>
+
+// Precompiled binary stylesheet.
+//
+// The file is a header followed by 32 bit words (in the byte order of the writer)
+// and the string characters:
+//
+//   header        : magic, version, byte order, number of strings, number of rules,
+//                   number of option orders, number of words, start of rule buckets
+//                   in words, number of string chars
+//   string offsets: start of each string in string chars (plus end of last)
+//   words         : rule table, rules in source order and rule buckets
+//   string chars  : all strings (names and values) without terminators
+//
+// The rule table has the position of the selectors and options of each rule and its
+// packed specificity. Each rule is its selector list and options:
+//
+//   <num selectors> <selector position>* { <name> <next type> <num ids> <id>*
+//     <num classes> <class>* <num exprs> { <id> <op> <value> }*
+//     <num fns> { <fn> <type> <a> <b> }* }*
+//   <num options> { <name> <value> <important> <order> }* <declarations order>
+//
+// where names and values are string indices and functions are stored classified
+// (with their An+B expression). The rule buckets are the start and count of the
+// universal and all rules lists, followed by hash tables (slot count and
+// <name> <start> <count> slots) of the rules by rightmost id, first class and element
+// name (see CCSS::addRuleBucket) indexed by the name's atom hash. Each list is the
+// rule indices sorted by specificity then source order.
+//
+// Only offsets are stored so the file can be mapped at any address and matched in
+// place (see CCSSBinaryStyleSheet).
+
+namespace {
+
+const char     binaryMagic[8] = { 'C', 'C', 'S', 'S', 'B', 'I', 'N', '\0' };
+const uint32_t binaryVersion  = 3;
+const uint32_t binaryOrder    = 0x01020304;
+
+typedef CCSSBinaryStyleSheet::Header BinaryHeader;
+
+//---
+
+// build words and string table of binary file
+class CCSSBinaryWriter {
+ public:
+  std::size_t numWords() const { return words_.size(); }
+
+  void addWord(uint32_t w) { words_.push_back(w); }
+
+  void addSize(std::size_t n) { addWord(uint32_t(n)); }
+
+  void setWord(std::size_t pos, uint32_t w) { words_[pos] = w; }
+
+  void addString(const std::string &str) { addWord(stringIndex(str)); }
+
+  uint32_t stringIndex(const std::string &str) {
+    auto p = stringMap_.find(str);
+
+    if (p == stringMap_.end()) {
+      p = stringMap_.insert(p, StringMap::value_type(str, uint32_t(strings_.size())));
+
+      strings_.push_back(&(*p).first);
+    }
+
+    return (*p).second;
+  }
+
+  bool write(std::ostream &os, uint32_t numRules, uint32_t numOrders,
+             uint32_t bucketOffset) const {
+    std::vector<uint32_t> offsets;
+
+    uint32_t numChars = 0;
+
+    for (const auto *str : strings_) {
+      offsets.push_back(numChars);
+
+      numChars += uint32_t(str->size());
+    }
+
+    offsets.push_back(numChars);
+
+    BinaryHeader header;
+
+    memcpy(header.magic, binaryMagic, sizeof(binaryMagic));
+
+    header.version      = binaryVersion;
+    header.byteOrder    = binaryOrder;
+    header.numStrings   = uint32_t(strings_.size());
+    header.numRules     = numRules;
+    header.numOrders    = numOrders;
+    header.numWords     = uint32_t(words_.size());
+    header.bucketOffset = bucketOffset;
+    header.numChars     = numChars;
+
+    os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    os.write(reinterpret_cast<const char *>(offsets.data()),
+             std::streamsize(offsets.size()*sizeof(uint32_t)));
+    os.write(reinterpret_cast<const char *>(words_.data()),
+             std::streamsize(words_.size()*sizeof(uint32_t)));
+
+    for (const auto *str : strings_)
+      os.write(str->data(), std::streamsize(str->size()));
+
+    return bool(os);
+  }
+
+ private:
+  typedef std::unordered_map<std::string, uint32_t> StringMap;
+
+  std::vector<uint32_t>            words_;
+  StringMap                        stringMap_;
+  std::vector<const std::string *> strings_;
+};
+
+}
+
+//------
+
+bool
+CCSS::
+isBinary(std::string_view text)
+{
+  return (text.size() >= sizeof(binaryMagic) &&
+          memcmp(text.data(), binaryMagic, sizeof(binaryMagic)) == 0);
+}
+
+bool
+CCSS::
+saveBinary(const std::string &filename) const
+{
+  CCSSBinaryWriter writer;
+
+  std::vector<const StyleData *> rules;
+
+  for (const auto &styleData : styleData_) {
+    if (! styleData.isRemoved())
+      rules.push_back(&styleData);
+  }
+
+  uint32_t numRules = uint32_t(rules.size());
+
+  // rule table (filled as rules are added)
+  for (uint32_t i = 0; i < 3*numRules; ++i)
+    writer.addWord(0);
+
+  // rule buckets (rightmost selector's id, first class or element name as for
+  // addRuleBucket) with sort keys of file's rule indices
+  typedef std::unordered_map<CCSSAtom, RuleKeys> AtomKeys;
+
+  AtomKeys idKeys, classKeys, elementKeys;
+  RuleKeys universalKeys, allKeys;
+
+  for (uint32_t ind = 0; ind < numRules; ++ind) {
+    const StyleData &styleData = *rules[ind];
+
+    const auto &selectors = styleData.getSelectorList().selectors();
+
+    writer.setWord(3*ind, uint32_t(writer.numWords()));
+
+    writer.addSize(selectors.size());
+
+    std::size_t selectorPos = writer.numWords();
+
+    for (std::size_t i = 0; i < selectors.size(); ++i)
+      writer.addWord(0);
+
+    for (const auto &selector : selectors) {
+      writer.setWord(selectorPos++, uint32_t(writer.numWords()));
+
+      writer.addString(selector.name());
+      writer.addWord  (uint32_t(selector.nextType()));
+
+      writer.addSize(selector.idNames().size());
+
+      for (const auto &idName : selector.idNames())
+        writer.addString(idName.str());
+
+      writer.addSize(selector.classNames().size());
+
+      for (const auto &className : selector.classNames())
+        writer.addString(className.str());
+
+      writer.addSize(selector.expressions().size());
+
+      for (const auto &expr : selector.expressions()) {
+        writer.addString(expr.id());
+        writer.addWord  (uint32_t(expr.op()));
+        writer.addString(expr.value());
+      }
+
+      const auto &fns = selector.functions();
+
+      writer.addSize(fns.size());
+
+      for (std::size_t i = 0; i < fns.size(); ++i) {
+        const Function &fn = selector.compiledFunctions()[i];
+
+        writer.addString(fns[i]);
+        writer.addWord  (uint32_t(fn.type()));
+        writer.addWord  (uint32_t(fn.nthExpr().a()));
+        writer.addWord  (uint32_t(fn.nthExpr().b()));
+      }
+    }
+
+    writer.setWord(3*ind + 1, uint32_t(writer.numWords()));
+
+    writer.addSize(styleData.getNumOptions());
+
+    for (const auto &option : styleData.getOptions()) {
+      writer.addString(option.getName());
+      writer.addString(option.getValue());
+      writer.addWord  (option.isImportant() ? 1 : 0);
+      writer.addWord  (option.order());
+    }
+
+    writer.addWord(styleData.declarationOrder());
+
+    writer.setWord(3*ind + 2, styleData.specificity().packed());
+
+    //---
+
+    uint64_t key = (uint64_t(styleData.specificity().packed()) << 32) | ind;
+
+    allKeys.push_back(key);
+
+    const Selector &selector = selectors.back();
+
+    if      (! selector.idNames().empty())
+      idKeys[selector.idNames()[0]].push_back(key);
+    else if (! selector.classNames().empty())
+      classKeys[selector.classNames()[0]].push_back(key);
+    else if (! selector.isUniversal())
+      elementKeys[selector.nameAtom()].push_back(key);
+    else
+      universalKeys.push_back(key);
+  }
+
+  //---
+
+  uint32_t bucketOffset = uint32_t(writer.numWords());
+
+  // universal start and count, all start and count, id, class and element tables
+  for (int i = 0; i < 7; ++i)
+    writer.addWord(0);
+
+  // add sorted rule indices of bucket and return start
+  auto addKeys = [&](RuleKeys &keys) {
+    std::sort(keys.begin(), keys.end());
+
+    uint32_t start = uint32_t(writer.numWords());
+
+    for (const auto &key : keys)
+      writer.addWord(uint32_t(key & 0xffffffff));
+
+    return start;
+  };
+
+  writer.setWord(bucketOffset    , addKeys(universalKeys));
+  writer.setWord(bucketOffset + 1, uint32_t(universalKeys.size()));
+  writer.setWord(bucketOffset + 2, addKeys(allKeys));
+  writer.setWord(bucketOffset + 3, uint32_t(allKeys.size()));
+
+  // add open addressed table of name buckets (slot count is a power of two at least
+  // twice the number of names, empty slots have zero count)
+  auto addTable = [&](AtomKeys &atomKeys) {
+    std::size_t numSlots = 0;
+
+    if (! atomKeys.empty()) {
+      numSlots = 4;
+
+      while (numSlots < 2*atomKeys.size())
+        numSlots *= 2;
+    }
+
+    std::vector<uint32_t> slots(3*numSlots, 0);
+
+    for (auto &atomKey : atomKeys) {
+      std::size_t mask = numSlots - 1;
+
+      std::size_t slot = atomKey.first.hash() & mask;
+
+      while (slots[3*slot + 2] != 0)
+        slot = (slot + 1) & mask;
+
+      slots[3*slot    ] = writer.stringIndex(atomKey.first.str());
+      slots[3*slot + 1] = addKeys(atomKey.second);
+      slots[3*slot + 2] = uint32_t(atomKey.second.size());
+    }
+
+    uint32_t start = uint32_t(writer.numWords());
+
+    writer.addSize(numSlots);
+
+    for (const auto &w : slots)
+      writer.addWord(w);
+
+    return start;
+  };
+
+  writer.setWord(bucketOffset + 4, addTable(idKeys));
+  writer.setWord(bucketOffset + 5, addTable(classKeys));
+  writer.setWord(bucketOffset + 6, addTable(elementKeys));
+
+  //---
+
+  std::ofstream os(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+
+  if (! os || ! writer.write(os, numRules, optionOrder_, bucketOffset)) {
+    errorMsg("Failed to write file '" + filename + "'");
+    return false;
+  }
+
+  return true;
+}
+
+bool
+CCSS::
+loadBinary(const std::string &filename)
+{
+  if (! CFile::exists(filename) || ! CFile::isRegular(filename)) {
+    errorMsg("Invalid file '" + filename + "'");
+    return false;
+  }
+
+  SourceP source = Source::mapFile(filename);
+
+  if (! source) {
+    errorMsg("Failed to read file '" + filename + "'");
+    return false;
+  }
+
+  if (! loadBinarySource(source)) {
+    errorMsg("Invalid binary file '" + filename + "'");
+    return false;
+  }
+
+  return true;
+}
+
+bool
+CCSS::
+loadBinarySource(const SourceP &source)
+{
+  CCSSBinaryStyleSheet sheet;
+
+  if (! sheet.load(source))
+    return false;
+
+  // option orders of file follow those already loaded
+  uint orderBase = optionOrder_;
+
+  // read all rules before adding so invalid file adds nothing
+  Rules             rules;
+  std::vector<uint> declOrders;
+
+  rules.resize(sheet.numRules());
+
+  for (uint i = 0; i < sheet.numRules(); ++i) {
+    Rule &rule = rules[i];
+
+    SelectorList selectorList;
+    uint         declOrder;
+
+    if (! sheet.getRule(i, selectorList, rule.options, declOrder))
+      return false;
+
+    for (auto &option : rule.options)
+      option.setOrder(orderBase + option.order());
+
+    declOrders.push_back(orderBase + declOrder);
+
+    rule.selectorLists.push_back(std::move(selectorList));
+  }
+
+  //---
+
+  // add rules (with saved orders). Saved rules are added as they are if stylesheet is
+  // empty (including separate rules with the same selector list added by insertRule),
+  // otherwise they are merged with existing rules as for parsed rules
+  bool merge = ! styleData_.empty();
+
+  styleDataIndex_.reserve(styleDataIndex_.size() + rules.size());
+
+  for (std::size_t i = 0; i < rules.size(); ++i) {
+    const Rule &rule = rules[i];
+
+    const SelectorList &selectorList = rule.selectorLists[0];
+
+    addFunctionDiagnostics(selectorList);
+
+    StyleData &styleData = (merge ? addStyleData   (selectorList, declOrders[i]) :
+                                    addNewStyleData(selectorList, declOrders[i]));
+
+    if (! rule.options.empty())
+      styleData.setDeclarationOrder(declOrders[i]);
+
+    for (const auto &option : rule.options)
+      styleData.addOption(option);
+  }
+
+  optionOrder_ = orderBase + sheet.numOrders();
+
+  sortRuleBuckets();
+
+  return true;
+}
+
+//------
+
+bool
+CCSSBinaryStyleSheet::
+loadFile(const std::string &filename)
+{
+  if (! CFile::exists(filename) || ! CFile::isRegular(filename))
+    return false;
+
+  CCSS::SourceP source = CCSS::Source::mapFile(filename);
+
+  if (! source)
+    return false;
+
+  return load(source);
+}
+
+bool
+CCSSBinaryStyleSheet::
+load(const CCSS::SourceP &source)
+{
+  source_.reset();
+
+  std::string_view data = source->text();
+
+  Header header;
+
+  if (data.size() < sizeof(Header))
+    return false;
+
+  memcpy(&header, data.data(), sizeof(header));
+
+  if (memcmp(header.magic, binaryMagic, sizeof(binaryMagic)) != 0 ||
+      header.version != binaryVersion || header.byteOrder != binaryOrder)
+    return false;
+
+  std::size_t numOffsets = std::size_t(header.numStrings) + 1;
+
+  std::size_t size = sizeof(Header) +
+    (numOffsets + header.numWords)*sizeof(uint32_t) + header.numChars;
+
+  // rule table and bucket header must fit in words
+  if (data.size() != size || std::size_t(header.numRules)*3 > header.bucketOffset ||
+      std::size_t(header.bucketOffset) + 7 > header.numWords)
+    return false;
+
+  source_  = source;
+  header_  = header;
+  offsets_ = data.data() + sizeof(Header);
+  words_   = offsets_ + numOffsets*sizeof(uint32_t);
+  chars_   = words_ + std::size_t(header.numWords)*sizeof(uint32_t);
+
+  atoms_ = CCSSAtomCache(header.numStrings);
+
+  return true;
+}
+
+std::string_view
+CCSSBinaryStyleSheet::
+string(uint32_t ind) const
+{
+  if (ind >= header_.numStrings)
+    return std::string_view();
+
+  uint32_t offsets[2];
+
+  memcpy(offsets, offsets_ + std::size_t(ind)*sizeof(uint32_t), sizeof(offsets));
+
+  if (offsets[0] > offsets[1] || offsets[1] > header_.numChars)
+    return std::string_view();
+
+  return std::string_view(chars_ + offsets[0], offsets[1] - offsets[0]);
+}
+
+void
+CCSSBinaryStyleSheet::
+getCandidateRules(const CCSSTagNames *names, CCSS::RuleKeys &keys) const
+{
+  std::size_t bucketOffset = header_.bucketOffset;
+
+  // add sort keys of rule indices start to start + n - 1 (sorted) merged with keys
+  auto addBucket = [&](std::size_t start, std::size_t n) {
+    if (n == 0) return;
+
+    std::size_t n1 = keys.size();
+
+    for (std::size_t i = 0; i < n; ++i) {
+      uint32_t ind = word(start + i);
+
+      if (ind < header_.numRules)
+        keys.push_back((uint64_t(word(3*std::size_t(ind) + 2)) << 32) | ind);
+    }
+
+    if (n1 > 0)
+      std::inplace_merge(keys.begin(), keys.begin() + long(n1), keys.end());
+  };
+
+  // no names so check all rules
+  if (! names) {
+    addBucket(word(bucketOffset + 2), word(bucketOffset + 3));
+    return;
+  }
+
+  auto addAtomBucket = [&](std::size_t table, const CCSSAtom &name) {
+    if (name.empty()) return;
+
+    std::size_t numSlots = count(table);
+
+    // slot count is a power of two
+    if (numSlots == 0 || (numSlots & (numSlots - 1)) != 0)
+      return;
+
+    std::size_t mask = numSlots - 1;
+
+    std::size_t slot = name.hash() & mask;
+
+    for (std::size_t i = 0; i < numSlots; ++i, slot = (slot + 1) & mask) {
+      std::size_t pos = table + 1 + 3*slot;
+
+      uint32_t n = word(pos + 2);
+
+      if (n == 0)
+        return;
+
+      if (atom(word(pos)) == name) {
+        addBucket(word(pos + 1), n);
+        return;
+      }
+    }
+  };
+
+  for (const auto &id : names->ids)
+    addAtomBucket(word(bucketOffset + 4), id);
+
+  for (const auto &className : names->classes)
+    addAtomBucket(word(bucketOffset + 5), className);
+
+  addAtomBucket(word(bucketOffset + 6), names->element);
+
+  addBucket(word(bucketOffset), word(bucketOffset + 1));
+
+  // remove duplicates from repeated names
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+void
+CCSSBinaryStyleSheet::
+matchRules(const CCSSTagDataP &data, RuleIndices &rules) const
+{
+  CCSSTagDataNode node(data);
+
+  matchRules(node, rules);
+}
+
+void
+CCSSBinaryStyleSheet::
+matchRules(const CCSSTagNode &node, RuleIndices &rules) const
+{
+  match(&node, rules, CCSSTagNodeAdapter());
+}
+
+void
+CCSSBinaryStyleSheet::
+computeStyle(const CCSSTagDataP &data, CCSS::ComputedStyle &style) const
+{
+  RuleIndices rules;
+
+  matchRules(data, rules);
+
+  computeStyle(rules, style);
+}
+
+void
+CCSSBinaryStyleSheet::
+computeStyle(const RuleIndices &rules, CCSS::ComputedStyle &style) const
+{
+  // winning option (position in words) and its rule's specificity for each option name.
+  // Specificities are compared packed (same order unless a part is more than 255)
+  struct Winner {
+    std::size_t pos         { 0 };
+    uint32_t    specificity { 0 };
+    bool        important   { false };
+    uint32_t    order       { 0 };
+  };
+
+  std::vector<Winner> winners;
+
+  std::unordered_map<CCSSAtom, uint> nameWinner;
+
+  for (const auto &ind : rules) {
+    uint32_t specificity = word(3*std::size_t(ind) + 2);
+
+    std::size_t pos = word(3*std::size_t(ind) + 1);
+
+    uint32_t numOptions = count(pos++);
+
+    for (uint32_t i = 0; i < numOptions; ++i, pos += 4) {
+      Winner winner1;
+
+      winner1.pos         = pos;
+      winner1.specificity = specificity;
+      winner1.important   = (word(pos + 2) != 0);
+      winner1.order       = word(pos + 3);
+
+      CCSSAtom name = atom(word(pos));
+
+      auto p = nameWinner.find(name);
+
+      if (p == nameWinner.end()) {
+        nameWinner[name] = uint(winners.size());
+
+        winners.push_back(winner1);
+
+        continue;
+      }
+
+      Winner &winner = winners[(*p).second];
+
+      // !important wins, then higher specificity, then later declaration
+      if (winner1.important != winner.important) {
+        if (! winner1.important)
+          continue;
+      }
+      else {
+        if (winner1.specificity < winner.specificity ||
+            (winner1.specificity == winner.specificity && winner1.order < winner.order))
+          continue;
+      }
+
+      winner = winner1;
+    }
+  }
+
+  //---
+
+  CCSS::OptionList options;
+
+  options.reserve(winners.size());
+
+  for (const auto &winner : winners) {
+    CCSS::Option option(atom(word(winner.pos)), std::string(string(word(winner.pos + 1))),
+                        winner.important);
+
+    option.setOrder(winner.order);
+
+    options.push_back(option);
+  }
+
+  style.setOptions(std::move(options));
+}
+
+void
+CCSSBinaryStyleSheet::
+print(std::ostream &os) const
+{
+  for (uint i = 0; i < numRules(); ++i) {
+    CCSS::SelectorList selectorList;
+    CCSS::OptionList   options;
+    uint               declOrder;
+
+    if (! getRule(i, selectorList, options, declOrder))
+      continue;
+
+    CCSS::StyleData styleData(selectorList, i);
+
+    styleData.setOptions(options);
+
+    styleData.print(os);
+
+    os << std::endl;
+  }
+}
+
+bool
+CCSSBinaryStyleSheet::
+getRule(uint ind, CCSS::SelectorList &selectorList, CCSS::OptionList &options,
+        uint &declOrder) const
+{
+  if (ind >= numRules())
+    return false;
+
+  std::size_t pos = word(3*std::size_t(ind));
+
+  uint32_t numSelectors;
+
+  if (! readWord(pos, numSelectors) || numSelectors == 0 ||
+      numSelectors > header_.numWords - pos)
+    return false;
+
+  for (uint32_t i = 0; i < numSelectors; ++i) {
+    std::size_t pos1 = word(pos + i);
+
+    CCSSAtom name;
+    uint32_t nextType;
+
+    if (! readAtom(pos1, name) || ! readWord(pos1, nextType) ||
+        nextType > uint32_t(CCSS::NextType::PRECEDER))
+      return false;
+
+    CCSS::Atoms idNames, classNames;
+
+    for (auto *atoms : { &idNames, &classNames }) {
+      uint32_t n;
+
+      if (! readWord(pos1, n) || n > header_.numWords - pos1)
+        return false;
+
+      for (uint32_t j = 0; j < n; ++j) {
+        CCSSAtom atom;
+
+        if (! readAtom(pos1, atom))
+          return false;
+
+        atoms->push_back(atom);
+      }
+    }
+
+    uint32_t numExprs;
+
+    if (! readWord(pos1, numExprs) || numExprs > header_.numWords - pos1)
+      return false;
+
+    CCSS::Exprs exprs;
+
+    for (uint32_t j = 0; j < numExprs; ++j) {
+      CCSSAtom         id;
+      uint32_t         op;
+      std::string_view value;
+
+      if (! readAtom(pos1, id) || ! readWord(pos1, op) ||
+          op > uint32_t(CCSSAttributeOp::STARTS_WITH) || ! readString(pos1, value))
+        return false;
+
+      exprs.push_back(CCSS::Expr(id, CCSSAttributeOp(op), std::string(value)));
+    }
+
+    uint32_t numFns;
+
+    if (! readWord(pos1, numFns) || numFns > header_.numWords - pos1)
+      return false;
+
+    CCSS::Names fns;
+
+    for (uint32_t j = 0; j < numFns; ++j) {
+      std::string_view fn;
+      uint32_t         type, a, b;
+
+      if (! readString(pos1, fn) || ! readWord(pos1, type) ||
+          ! readWord(pos1, a) || ! readWord(pos1, b))
+        return false;
+
+      fns.push_back(std::string(fn));
+    }
+
+    CCSS::Selector selector;
+
+    selector.setName       (name);
+    selector.setNextType   (CCSS::NextType(nextType));
+    selector.setIdNames    (idNames);
+    selector.setClassNames (classNames);
+    selector.setExpressions(exprs);
+    selector.setFunctions  (fns);
+
+    selectorList.addSelector(selector);
+  }
+
+  //---
+
+  pos = word(3*std::size_t(ind) + 1);
+
+  uint32_t numOptions;
+
+  if (! readWord(pos, numOptions) || numOptions > header_.numWords - pos)
+    return false;
+
+  for (uint32_t i = 0; i < numOptions; ++i) {
+    CCSSAtom         name;
+    std::string_view value;
+    uint32_t         important, order;
+
+    if (! readAtom(pos, name) || ! readString(pos, value) ||
+        ! readWord(pos, important) || ! readWord(pos, order) || order >= numOrders())
+      return false;
+
+    CCSS::Option option(name, std::string(value), important != 0);
+
+    option.setOrder(order);
+
+    options.push_back(option);
+  }
+
+  if (! readWord(pos, declOrder) || declOrder > numOrders())
+    return false;
+
+  return true;
+}
+
+bool
+CCSSBinaryStyleSheet::
+readWord(std::size_t &pos, uint32_t &w) const
+{
+  if (pos >= header_.numWords)
+    return false;
+
+  w = word(pos++);
+
+  return true;
+}
+
+bool
+CCSSBinaryStyleSheet::
+readString(std::size_t &pos, std::string_view &str) const
+{
+  uint32_t ind;
+
+  if (! readWord(pos, ind) || ind >= header_.numStrings)
+    return false;
+
+  uint32_t offsets[2];
+
+  memcpy(offsets, offsets_ + std::size_t(ind)*sizeof(uint32_t), sizeof(offsets));
+
+  if (offsets[0] > offsets[1] || offsets[1] > header_.numChars)
+    return false;
+
+  str = std::string_view(chars_ + offsets[0], offsets[1] - offsets[0]);
+
+  return true;
+}
+
+bool
+CCSSBinaryStyleSheet::
+readAtom(std::size_t &pos, CCSSAtom &atom) const
+{
+  uint32_t ind = word(pos);
+
+  std::string_view str;
+
+  if (! readString(pos, str))
+    return false;
+
+  if (! atoms_.find(ind, atom))
+    atom = atoms_.add(ind, str);
+
+  return true;
+}
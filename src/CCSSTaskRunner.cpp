@@ -0,0 +1,133 @@
+#include <CCSSTaskRunner.h>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+// tasks of one worker (owner takes from front, thieves from back)
+class CCSSTaskQueue {
+ public:
+  CCSSTaskQueue() { }
+
+  void add(uint task) { tasks_.push_back(task); }
+
+  bool popFront(uint &task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (tasks_.empty()) return false;
+
+    task = tasks_.front();
+
+    tasks_.pop_front();
+
+    return true;
+  }
+
+  bool popBack(uint &task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (tasks_.empty()) return false;
+
+    task = tasks_.back();
+
+    tasks_.pop_back();
+
+    return true;
+  }
+
+ private:
+  std::mutex       mutex_;
+  std::deque<uint> tasks_;
+};
+
+}
+
+//------
+
+CCSSTaskRunner::
+CCSSTaskRunner(uint numThreads) :
+ numThreads_(numThreads)
+{
+  if (numThreads_ == 0)
+    numThreads_ = std::max(1U, std::thread::hardware_concurrency());
+}
+
+void
+CCSSTaskRunner::
+run(uint numTasks, const TaskProc &proc) const
+{
+  uint numWorkers = std::min(numThreads_, numTasks);
+
+  // no need for threads
+  if (numWorkers <= 1) {
+    for (uint task = 0; task < numTasks; ++task)
+      proc(task, 0);
+
+    return;
+  }
+
+  //---
+
+  // give each worker a contiguous block of tasks
+  std::vector<std::unique_ptr<CCSSTaskQueue>> queues;
+
+  for (uint w = 0; w < numWorkers; ++w) {
+    queues.push_back(std::make_unique<CCSSTaskQueue>());
+
+    uint start = uint((uint64_t(numTasks)*w      )/numWorkers);
+    uint end   = uint((uint64_t(numTasks)*(w + 1))/numWorkers);
+
+    for (uint task = start; task < end; ++task)
+      queues.back()->add(task);
+  }
+
+  //---
+
+  std::mutex         exceptionMutex;
+  std::exception_ptr exception;
+
+  auto runWorker = [&](uint worker) {
+    while (true) {
+      uint task = 0;
+
+      bool found = queues[worker]->popFront(task);
+
+      // steal from other workers (tasks are never added so if all queues
+      // are empty there is no more work)
+      for (uint i = 1; ! found && i < numWorkers; ++i)
+        found = queues[(worker + i) % numWorkers]->popBack(task);
+
+      if (! found)
+        break;
+
+      try {
+        proc(task, worker);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(exceptionMutex);
+
+        if (! exception)
+          exception = std::current_exception();
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+
+  for (uint w = 1; w < numWorkers; ++w)
+    threads.emplace_back(runWorker, w);
+
+  runWorker(0);
+
+  for (auto &thread : threads)
+    thread.join();
+
+  if (exception)
+    std::rethrow_exception(exception);
+}
@@ -0,0 +1,245 @@
+#include <CCSSTokenizer.h>
+
+bool
+CCSSTokenizer::
+skipSpace()
+{
+  std::size_t pos = pos_;
+
+  std::size_t len = str_.size();
+
+  while (pos_ < len) {
+    if      (isspace(uchar(str_[pos_])))
+      ++pos_;
+    else if (isComment())
+      skipComment();
+    else
+      break;
+  }
+
+  return (pos_ > pos);
+}
+
+CCSSTokenizer::Token
+CCSSTokenizer::
+nextToken()
+{
+  Token token;
+
+  if (eof())
+    return token;
+
+  if (skipSpace()) {
+    token.type = Type::SPACE;
+    return token;
+  }
+
+  char c = str_[pos_];
+
+  if      (isIdentChar(c) || c == '\\') {
+    token.str = readIdent();
+
+    if (isChar('(')) {
+      ++pos_;
+
+      token.type = Type::FUNCTION;
+    }
+    else
+      token.type = Type::IDENT;
+  }
+  else if (c == '#' && pos_ + 1 < str_.size() && isIdentChar(str_[pos_ + 1])) {
+    ++pos_;
+
+    token.type = Type::HASH;
+    token.str  = readIdent();
+  }
+  else if (c == '"' || c == '\'') {
+    token.type = Type::STRING;
+    token.str  = readString();
+  }
+  else {
+    token.type = Type::DELIM;
+    token.str  = str_.substr(pos_, 1);
+    token.c    = c;
+
+    ++pos_;
+  }
+
+  return token;
+}
+
+std::string_view
+CCSSTokenizer::
+readIdent()
+{
+  std::size_t start = pos_;
+
+  std::size_t len = str_.size();
+
+  while (pos_ < len) {
+    char c = str_[pos_];
+
+    if      (isIdentChar(c))
+      ++pos_;
+    else if (c == '\\' && pos_ + 1 < len)
+      pos_ += 2; // escaped char
+    else
+      break;
+  }
+
+  return str_.substr(start, pos_ - start);
+}
+
+std::string_view
+CCSSTokenizer::
+readUntil(const char *chars)
+{
+  // table of chars to stop at (1) or which need checking for nesting (2)
+  unsigned char charType[256];
+
+  memset(charType, 0, sizeof(charType));
+
+  for (const char *c = "\"'/\\()[]"; *c; ++c)
+    charType[uchar(*c)] = 2;
+
+  for (const char *c = chars; *c; ++c)
+    charType[uchar(*c)] = 1;
+
+  //---
+
+  std::size_t start = pos_;
+
+  std::size_t len = str_.size();
+
+  int depth = 0;
+
+  while (pos_ < len) {
+    char c = str_[pos_];
+
+    unsigned char type = charType[uchar(c)];
+
+    if (type == 0) {
+      ++pos_;
+      continue;
+    }
+
+    if (type == 1 && depth == 0)
+      break;
+
+    if      (c == '"' || c == '\'') {
+      (void) readString();
+      continue;
+    }
+    else if (c == '/' && isComment()) {
+      skipComment();
+      continue;
+    }
+    else if (c == '\\')
+      ++pos_;
+    else if (c == '(' || c == '[')
+      ++depth;
+    else if ((c == ')' || c == ']') && depth > 0)
+      --depth;
+
+    ++pos_;
+  }
+
+  setPos(pos_);
+
+  return str_.substr(start, pos_ - start);
+}
+
+std::string
+CCSSTokenizer::
+stateStr() const
+{
+  static const std::size_t maxContext = 40;
+
+  std::size_t start = (pos_ > maxContext ? pos_ - maxContext : 0);
+
+  std::string_view lhs = str_.substr(start, pos_ - start);
+  std::string_view rhs = str_.substr(pos_, maxContext);
+
+  return std::string(lhs) + "^" + std::string(rhs);
+}
+
+std::string_view
+CCSSTokenizer::
+trim(std::string_view str)
+{
+  std::size_t i1 = 0;
+  std::size_t i2 = str.size();
+
+  while (i1 < i2 && isspace(uchar(str[i1])))
+    ++i1;
+
+  while (i2 > i1 && isspace(uchar(str[i2 - 1])))
+    --i2;
+
+  return str.substr(i1, i2 - i1);
+}
+
+std::string
+CCSSTokenizer::
+stripComments(std::string_view str)
+{
+  std::string str1;
+
+  std::size_t pos = 0;
+
+  while (true) {
+    std::size_t pos1 = str.find("/*", pos);
+
+    if (pos1 == std::string_view::npos) {
+      str1.append(str.substr(pos));
+      break;
+    }
+
+    str1.append(str.substr(pos, pos1 - pos));
+
+    std::size_t pos2 = str.find("*/", pos1 + 2);
+
+    if (pos2 == std::string_view::npos)
+      break;
+
+    pos = pos2 + 2;
+  }
+
+  return str1;
+}
+
+void
+CCSSTokenizer::
+skipComment()
+{
+  std::size_t pos = str_.find("*/", pos_ + 2);
+
+  pos_ = (pos != std::string_view::npos ? pos + 2 : str_.size());
+}
+
+std::string_view
+CCSSTokenizer::
+readString()
+{
+  char quote = str_[pos_++];
+
+  std::size_t start = pos_;
+
+  std::size_t len = str_.size();
+
+  while (pos_ < len && str_[pos_] != quote) {
+    if (str_[pos_] == '\\')
+      ++pos_;
+
+    ++pos_;
+  }
+
+  setPos(pos_);
+
+  std::string_view str = str_.substr(start, pos_ - start);
+
+  if (! eof())
+    ++pos_; // skip close quote
+
+  return str;
+}
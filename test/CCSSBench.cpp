@@ -0,0 +1,634 @@
+#include <CCSS.h>
+#include <CCSSBinary.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <sys/resource.h>
+
+// Benchmark of parse throughput and per element match latency using a generated
+// stylesheet and a generated in memory tree
+
+namespace {
+
+const char *elementNames[] = {
+  "html", "body", "div", "span", "p", "a", "ul", "ol", "li", "table", "tr", "td",
+  "th", "h1", "h2", "h3", "img", "input", "button", "form", "label", "section",
+  "article", "nav", "header", "footer", "em", "strong", "pre", "code"
+};
+
+const int numElementNames = sizeof(elementNames)/sizeof(elementNames[0]);
+
+const char *attrNames[] = {
+  "type", "href", "title", "lang", "role", "data-id", "data-state", "name"
+};
+
+const int numAttrNames = sizeof(attrNames)/sizeof(attrNames[0]);
+
+const char *attrValues[] = {
+  "text", "submit", "en", "main", "open", "closed", "button", "link"
+};
+
+const int numAttrValues = sizeof(attrValues)/sizeof(attrValues[0]);
+
+const char *pseudoNames[] = {
+  ":first-child", ":last-child", ":only-child", ":first-of-type", ":last-of-type",
+  ":nth-child(2n+1)", ":nth-child(3)", ":nth-of-type(2n)", ":nth-last-child(2)", ":root"
+};
+
+const int numPseudoNames = sizeof(pseudoNames)/sizeof(pseudoNames[0]);
+
+const char *combinators[] = { " ", " > ", " + ", " ~ " };
+
+//---
+
+// settings of generated stylesheet and tree
+struct BenchConfig {
+  uint     numRules     { 10000 }; // number of rules
+  uint     numTags      { 10000 }; // number of tags in tree
+  uint     numClasses   { 200 };   // number of distinct class names
+  uint     numIds       { 1000 };  // number of distinct id names
+  int      combinators  { 50 };    // percent of selectors with combinators
+  int      attributes   { 10 };    // percent of compound selectors with attribute
+  int      pseudos      { 10 };    // percent of compound selectors with pseudo class
+  uint     parseThreads { 1 };     // number of parse threads
+  bool     context      { true };  // match using ancestor context
+  bool     ruleStats    { false }; // record and print per rule match statistics
+  bool     binary       { false }; // time load and match of binary stylesheet
+  uint32_t seed         { 1 };     // random number seed
+};
+
+//---
+
+class BenchRandom {
+ public:
+  explicit BenchRandom(uint32_t seed) : gen_(seed) { }
+
+  // random number in range [0, n)
+  uint next(uint n) { return (n > 0 ? uint(gen_() % n) : 0); }
+
+  // true for specified percent of calls
+  bool percent(int p) { return int(next(100)) < p; }
+
+ private:
+  std::mt19937 gen_;
+};
+
+//---
+
+// generate stylesheet text
+std::string
+generateStyleSheet(const BenchConfig &config)
+{
+  BenchRandom random(config.seed);
+
+  std::string text;
+
+  text.reserve(size_t(config.numRules)*64);
+
+  // add compound selector (universal only for ancestors as, like in real stylesheets,
+  // few rules need to be checked against every tag)
+  auto addCompound = [&](bool rightmost) {
+    // element, class and id mix similar to real stylesheets
+    uint kind = random.next(rightmost ? 9 : 10);
+
+    if      (kind < 3)
+      text += elementNames[random.next(numElementNames)];
+    else if (kind < 8) {
+      if (random.percent(30))
+        text += elementNames[random.next(numElementNames)];
+
+      text += ".c" + std::to_string(random.next(config.numClasses));
+    }
+    else if (kind < 9)
+      text += "#i" + std::to_string(random.next(config.numIds));
+    else
+      text += "*";
+
+    if (random.percent(config.attributes)) {
+      text += "[";
+      text += attrNames[random.next(numAttrNames)];
+
+      if (random.percent(50)) {
+        text += (random.percent(50) ? "=\"" : "*=\"");
+        text += attrValues[random.next(numAttrValues)];
+        text += "\"";
+      }
+
+      text += "]";
+    }
+
+    if (random.percent(config.pseudos))
+      text += pseudoNames[random.next(numPseudoNames)];
+  };
+
+  for (uint i = 0; i < config.numRules; ++i) {
+    uint numSelectors = (random.percent(20) ? 2 : 1);
+
+    for (uint j = 0; j < numSelectors; ++j) {
+      if (j > 0)
+        text += ", ";
+
+      uint numCompounds = 1;
+
+      if (random.percent(config.combinators))
+        numCompounds += 1 + random.next(3);
+
+      for (uint k = 0; k < numCompounds; ++k) {
+        if (k > 0)
+          text += combinators[random.next(random.percent(80) ? 2 : 4)];
+
+        addCompound(k == numCompounds - 1);
+      }
+    }
+
+    text += " { color: #" + std::to_string(100 + random.next(900)) +
+            "; margin: " + std::to_string(random.next(20)) + "px; }\n";
+  }
+
+  return text;
+}
+
+//---
+
+class BenchTag;
+
+typedef std::shared_ptr<BenchTag> BenchTagP;
+
+// in memory tree tag
+class BenchTag : public CCSSTagData, public std::enable_shared_from_this<BenchTag> {
+ public:
+  typedef std::pair<CCSSAtom, std::string> Attr;
+  typedef std::vector<Attr>                Attrs;
+  typedef std::vector<BenchTagP>           Children;
+
+ public:
+  explicit BenchTag(const CCSSAtom &name) : name_(name) { }
+
+  const CCSSAtom &name() const { return name_; }
+
+  void setId(const CCSSAtom &id) { id_ = id; }
+
+  void addClass(const CCSSAtom &name) { classes_.push_back(name); }
+
+  void addAttr(const CCSSAtom &name, const std::string &value) {
+    attrs_.push_back(Attr(name, value));
+  }
+
+  const Children &children() const { return children_; }
+
+  void addChild(const BenchTagP &child) {
+    child->parent_ = shared_from_this();
+    child->index_  = int(children_.size());
+
+    children_.push_back(child);
+  }
+
+  bool isElement(const std::string &name) const override { return name_.str() == name; }
+
+  bool isClass(const std::string &name) const override {
+    for (const auto &c : classes_)
+      if (c.str() == name)
+        return true;
+
+    return false;
+  }
+
+  bool isId(const std::string &name) const override { return id_.str() == name; }
+
+  bool hasAttribute(const std::string &name, CCSSAttributeOp op,
+                    const std::string &value) const override {
+    return hasAttribute(CCSSAtom(name), op, value);
+  }
+
+  bool isElement(const CCSSAtom &name) const override { return name_ == name; }
+
+  bool isClass(const CCSSAtom &name) const override {
+    for (const auto &c : classes_)
+      if (c == name)
+        return true;
+
+    return false;
+  }
+
+  bool isId(const CCSSAtom &name) const override { return id_ == name; }
+
+  bool hasAttribute(const CCSSAtom &name, CCSSAttributeOp op,
+                    const std::string &value) const override {
+    for (const auto &attr : attrs_) {
+      if (attr.first != name)
+        continue;
+
+      if      (op == CCSSAttributeOp::NONE)
+        return true;
+      else if (op == CCSSAttributeOp::EQUAL)
+        return (attr.second == value);
+      else if (op == CCSSAttributeOp::PARTIAL)
+        return (attr.second.find(value) != std::string::npos);
+      else if (op == CCSSAttributeOp::STARTS_WITH)
+        return (attr.second.compare(0, value.size(), value) == 0);
+    }
+
+    return false;
+  }
+
+  bool getNames(CCSSTagNames &names) const override {
+    names.element = name_;
+
+    if (! id_.empty())
+      names.ids.push_back(id_);
+
+    for (const auto &c : classes_)
+      names.classes.push_back(c);
+
+    return true;
+  }
+
+  bool isNthChild(int n) const override { return (index_ + 1 == n); }
+
+  int childIndex(bool fromEnd) const override {
+    if (! fromEnd)
+      return index_ + 1;
+
+    BenchTagP parent = parent_.lock();
+
+    return (parent ? int(parent->children_.size()) - index_ : 1);
+  }
+
+  bool isInputValue(const std::string &) const override { return false; }
+
+  CCSSTagDataP getParent() const override { return parent_.lock(); }
+
+  void getChildren(TagDataArray &children) const override {
+    for (const auto &child : children_)
+      children.push_back(child);
+  }
+
+  CCSSTagDataP getPrevSibling() const override {
+    BenchTagP parent = parent_.lock();
+
+    if (! parent || index_ == 0)
+      return CCSSTagDataP();
+
+    return parent->children_[index_ - 1];
+  }
+
+  CCSSTagDataP getNextSibling() const override {
+    BenchTagP parent = parent_.lock();
+
+    if (! parent || index_ + 1 >= int(parent->children_.size()))
+      return CCSSTagDataP();
+
+    return parent->children_[index_ + 1];
+  }
+
+ private:
+  CCSSAtom                name_;
+  CCSSAtom                id_;
+  CCSSAtoms               classes_;
+  Attrs                   attrs_;
+  std::weak_ptr<BenchTag> parent_;
+  Children                children_;
+  int                     index_ { 0 };
+};
+
+//---
+
+// generate tree of tags (tags are given children breadth first so the depth of the
+// tree grows slowly with its size like a real document)
+BenchTagP
+generateTree(const BenchConfig &config)
+{
+  BenchRandom random(config.seed + 1);
+
+  BenchTagP root = std::make_shared<BenchTag>(CCSSAtom("html"));
+
+  std::vector<BenchTagP> tags;
+
+  tags.push_back(root);
+
+  uint numTags = 1;
+
+  for (size_t i = 0; numTags < config.numTags; ++i) {
+    BenchTagP parent = tags[i];
+
+    uint numChildren = std::min(1 + random.next(8), config.numTags - numTags);
+
+    for (uint j = 0; j < numChildren; ++j) {
+      BenchTagP tag =
+        std::make_shared<BenchTag>(CCSSAtom(elementNames[2 + random.next(numElementNames - 2)]));
+
+      if (random.percent(40)) {
+        uint numClasses = 1 + random.next(3);
+
+        for (uint k = 0; k < numClasses; ++k)
+          tag->addClass(CCSSAtom("c" + std::to_string(random.next(config.numClasses))));
+      }
+
+      if (random.percent(5))
+        tag->setId(CCSSAtom("i" + std::to_string(random.next(config.numIds))));
+
+      if (random.percent(20))
+        tag->addAttr(CCSSAtom(attrNames[random.next(numAttrNames)]),
+                     attrValues[random.next(numAttrValues)]);
+
+      parent->addChild(tag);
+
+      tags.push_back(tag);
+
+      ++numTags;
+    }
+  }
+
+  return root;
+}
+
+//---
+
+// peak resident memory of process in kilobytes
+long
+peakMemory()
+{
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+#ifdef __APPLE__
+  return usage.ru_maxrss/1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+typedef std::chrono::steady_clock Clock;
+
+double
+elapsedSeconds(const Clock::time_point &t1, const Clock::time_point &t2)
+{
+  return std::chrono::duration<double>(t2 - t1).count();
+}
+
+//---
+
+// match rules of each tag of tree in document order and record time of each match
+void
+matchTree(const CCSS &css, const BenchTagP &tag, CCSS::MatchContext &context,
+          bool useContext, std::vector<double> &times, size_t &numMatches)
+{
+  CCSS::StyleDataArray styles;
+
+  Clock::time_point t1 = Clock::now();
+
+  if (useContext)
+    css.matchRules(tag, context, styles);
+  else
+    css.matchRules(tag, styles);
+
+  Clock::time_point t2 = Clock::now();
+
+  times.push_back(std::chrono::duration<double, std::nano>(t2 - t1).count());
+
+  numMatches += styles.size();
+
+  if (tag->children().empty())
+    return;
+
+  if (useContext)
+    context.pushAncestor(CCSSTagDataP(tag));
+
+  for (const auto &child : tag->children())
+    matchTree(css, child, context, useContext, times, numMatches);
+
+  if (useContext)
+    context.popAncestor();
+}
+
+// match rules of binary stylesheet for each tag of tree in document order
+void
+matchBinaryTree(const CCSSBinaryStyleSheet &sheet, const BenchTagP &tag, size_t &numTags,
+                size_t &numMatches)
+{
+  CCSSBinaryStyleSheet::RuleIndices rules;
+
+  sheet.matchRules(tag, rules);
+
+  ++numTags;
+
+  numMatches += rules.size();
+
+  for (const auto &child : tag->children())
+    matchBinaryTree(sheet, child, numTags, numMatches);
+}
+
+double
+percentile(const std::vector<double> &sorted, double p)
+{
+  if (sorted.empty())
+    return 0.0;
+
+  size_t ind = std::min(size_t(p*double(sorted.size())/100.0), sorted.size() - 1);
+
+  return sorted[ind];
+}
+
+//---
+
+void
+runBench(const BenchConfig &config, bool dumpStyleSheet)
+{
+  std::string text = generateStyleSheet(config);
+
+  if (dumpStyleSheet) {
+    std::cout << text;
+    return;
+  }
+
+  BenchTagP root = generateTree(config);
+
+  //---
+
+  // parse
+  long memory1 = peakMemory();
+
+  CCSS css;
+
+  css.setParseThreads(config.parseThreads);
+
+  Clock::time_point t1 = Clock::now();
+
+  css.processLine(text);
+
+  Clock::time_point t2 = Clock::now();
+
+  long memory2 = peakMemory();
+
+  double parseTime = elapsedSeconds(t1, t2);
+
+  double mb = double(text.size())/(1024.0*1024.0);
+
+  std::cout << "rules        : " << config.numRules << "\n";
+  std::cout << "text         : " << mb << " MB\n";
+  std::cout << "parse        : " << parseTime*1000.0 << " ms, " <<
+               mb/parseTime << " MB/s, " <<
+               double(config.numRules)/parseTime << " rules/s\n";
+  std::cout << "peak memory  : " << memory2/1024.0 << " MB (+" <<
+               (memory2 - memory1)/1024.0 << " MB for parse)\n";
+
+  //---
+
+  // match
+  std::vector<double> times;
+
+  times.reserve(config.numTags);
+
+  size_t numMatches = 0;
+
+  CCSS::MatchContext context;
+
+  css.setRuleStats(config.ruleStats);
+
+  t1 = Clock::now();
+
+  matchTree(css, root, context, config.context, times, numMatches);
+
+  t2 = Clock::now();
+
+  double matchTime = elapsedSeconds(t1, t2);
+
+  std::sort(times.begin(), times.end());
+
+  std::cout << "tags         : " << times.size() << " (" <<
+               double(numMatches)/double(times.size()) << " rules per tag)\n";
+  std::cout << "match        : " << matchTime*1000.0 << " ms, " <<
+               matchTime*1e9/double(times.size()) << " ns/tag\n";
+  std::cout << "match ns/tag : p50 " << percentile(times, 50.0) <<
+               " p90 "   << percentile(times, 90.0) <<
+               " p99 "   << percentile(times, 99.0) <<
+               " p99.9 " << percentile(times, 99.9) <<
+               " max "   << times.back() << "\n";
+
+  if (config.ruleStats) {
+    std::cout << "\n";
+
+    css.printRuleStats(std::cout);
+  }
+
+  //---
+
+  // load (map) and match binary stylesheet
+  if (config.binary) {
+    std::string filename = "CCSSBench.ccssb";
+
+    if (! css.saveBinary(filename))
+      return;
+
+    CCSSBinaryStyleSheet sheet;
+
+    t1 = Clock::now();
+
+    bool loaded = sheet.loadFile(filename);
+
+    t2 = Clock::now();
+
+    double loadTime = elapsedSeconds(t1, t2);
+
+    if (loaded) {
+      size_t numTags = 0, numBinaryMatches = 0;
+
+      t1 = Clock::now();
+
+      matchBinaryTree(sheet, root, numTags, numBinaryMatches);
+
+      t2 = Clock::now();
+
+      double binaryMatchTime = elapsedSeconds(t1, t2);
+
+      std::cout << "binary load  : " << loadTime*1000.0 << " ms\n";
+      std::cout << "binary match : " << binaryMatchTime*1000.0 << " ms, " <<
+                   binaryMatchTime*1e9/double(numTags) << " ns/tag (" <<
+                   double(numBinaryMatches)/double(numTags) << " rules per tag)\n";
+    }
+
+    std::remove(filename.c_str());
+  }
+}
+
+}
+
+//------
+
+int
+main(int argc, char **argv)
+{
+  BenchConfig config;
+
+  std::vector<uint> numRulesArray;
+
+  bool dumpStyleSheet = false;
+
+  auto intArg = [&](int &i) {
+    ++i;
+
+    return (i < argc ? atoi(argv[i]) : 0);
+  };
+
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') {
+      if      (strcmp(&argv[i][1], "rules") == 0)
+        numRulesArray.push_back(uint(intArg(i)));
+      else if (strcmp(&argv[i][1], "sweep") == 0) {
+        for (uint n = 1000; n <= 1000000; n *= 10)
+          numRulesArray.push_back(n);
+      }
+      else if (strcmp(&argv[i][1], "tags") == 0)
+        config.numTags = uint(std::max(intArg(i), 1));
+      else if (strcmp(&argv[i][1], "classes") == 0)
+        config.numClasses = uint(std::max(intArg(i), 1));
+      else if (strcmp(&argv[i][1], "ids") == 0)
+        config.numIds = uint(std::max(intArg(i), 1));
+      else if (strcmp(&argv[i][1], "combinators") == 0)
+        config.combinators = intArg(i);
+      else if (strcmp(&argv[i][1], "attributes") == 0)
+        config.attributes = intArg(i);
+      else if (strcmp(&argv[i][1], "pseudos") == 0)
+        config.pseudos = intArg(i);
+      else if (strcmp(&argv[i][1], "threads") == 0)
+        config.parseThreads = uint(intArg(i));
+      else if (strcmp(&argv[i][1], "seed") == 0)
+        config.seed = uint32_t(intArg(i));
+      else if (strcmp(&argv[i][1], "no_context") == 0)
+        config.context = false;
+      else if (strcmp(&argv[i][1], "stats") == 0)
+        config.ruleStats = true;
+      else if (strcmp(&argv[i][1], "binary") == 0)
+        config.binary = true;
+      else if (strcmp(&argv[i][1], "dump") == 0)
+        dumpStyleSheet = true;
+      else if (strcmp(&argv[i][1], "help") == 0) {
+        std::cerr << "Usage: CCSSBench [-rules <n>]... [-sweep] [-tags <n>] "
+                     "[-classes <n>] [-ids <n>] [-combinators <pct>] "
+                     "[-attributes <pct>] [-pseudos <pct>] [-threads <n>] "
+                     "[-seed <n>] [-no_context] [-stats] [-binary] [-dump]\n";
+        exit(0);
+      }
+      else
+        std::cerr << "Invalid option: " << argv[i] << std::endl;
+    }
+  }
+
+  if (numRulesArray.empty())
+    numRulesArray.push_back(config.numRules);
+
+  for (size_t i = 0; i < numRulesArray.size(); ++i) {
+    if (i > 0)
+      std::cout << "\n";
+
+    config.numRules = numRulesArray[i];
+
+    runBench(config, dumpStyleSheet);
+  }
+
+  return 0;
+}
@@ -0,0 +1,2563 @@
+#include <CCSS.h>
+#include <CCSSBinary.h>
+#include <CCSSMatch.h>
+#include <CCSSTagNode.h>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <random>
+#include <set>
+#include <sstream>
+
+// Checks selector matching (matchRules, borrowed nodes, context walks, adapters,
+// styleTree and querySelectorAll) against a naive reference matcher using random trees
+// and stylesheets. The reference matcher only uses the string checks and links of the
+// tags and the text of the selector functions. Each tree is matched both as persistent
+// tags and as tags whose links return new tag data for each call (like wrappers of a
+// native DOM), so tags are freed as soon as matching stops using them and their
+// addresses are reused. Invalidation sets and rule handles are checked against
+// restyling and reparsing, and binary stylesheets (loaded and matched in place) against
+// the saved stylesheet
+
+namespace {
+
+class TestRandom {
+ public:
+  explicit TestRandom(uint32_t seed) : gen_(seed) { }
+
+  // random number in range [0, n)
+  uint next(uint n) { return (n > 0 ? uint(gen_() % n) : 0); }
+
+  // true for specified percent of calls
+  bool percent(int p) { return int(next(100)) < p; }
+
+ private:
+  std::mt19937 gen_;
+};
+
+//---
+
+class TestTag;
+
+typedef std::shared_ptr<TestTag> TestTagP;
+
+// persistent tag
+class TestTag : public CCSSTagData, public std::enable_shared_from_this<TestTag> {
+ public:
+  typedef std::set<std::string>             Classes;
+  typedef std::map<std::string,std::string> Attrs;
+  typedef std::vector<TestTagP>             Children;
+
+ public:
+  explicit TestTag(const std::string &name) : name_(name) { }
+
+  const std::string &name() const { return name_; }
+
+  const std::string &id() const { return id_; }
+  void setId(const std::string &id) { id_ = id; }
+
+  const Classes &classes() const { return classes_; }
+
+  void addClass   (const std::string &name) { classes_.insert(name); }
+  void removeClass(const std::string &name) { classes_.erase(name); }
+
+  const Attrs &attrs() const { return attrs_; }
+
+  void setAttr   (const std::string &name, const std::string &value) { attrs_[name] = value; }
+  void removeAttr(const std::string &name) { attrs_.erase(name); }
+
+  const Children &children() const { return children_; }
+
+  void addChild(const TestTagP &child) {
+    child->parent_ = this;
+    child->index_  = int(children_.size());
+
+    children_.push_back(child);
+  }
+
+  const TestTag *parentTag() const { return parent_; }
+
+  const TestTag *prevTag() const { return sibling(-1).get(); }
+  const TestTag *nextTag() const { return sibling( 1).get(); }
+
+  bool isElement(const std::string &name) const override { return name_ == name; }
+
+  bool isClass(const std::string &name) const override { return classes_.count(name); }
+
+  bool isId(const std::string &name) const override { return id_ == name; }
+
+  bool hasAttribute(const std::string &name, CCSSAttributeOp op,
+                    const std::string &value) const override {
+    auto p = attrs_.find(name);
+
+    if (p == attrs_.end())
+      return false;
+
+    if      (op == CCSSAttributeOp::NONE)
+      return true;
+    else if (op == CCSSAttributeOp::EQUAL)
+      return ((*p).second == value);
+    else if (op == CCSSAttributeOp::PARTIAL)
+      return ((*p).second.find(value) != std::string::npos);
+    else if (op == CCSSAttributeOp::STARTS_WITH)
+      return ((*p).second.compare(0, value.size(), value) == 0);
+
+    return false;
+  }
+
+  bool getNames(CCSSTagNames &names) const override {
+    names.element = CCSSAtom(name_);
+
+    if (! id_.empty())
+      names.ids.push_back(CCSSAtom(id_));
+
+    for (const auto &c : classes_)
+      names.classes.push_back(CCSSAtom(c));
+
+    return true;
+  }
+
+  bool isNthChild(int n) const override { return (index_ + 1 == n); }
+
+  bool isInputValue(const std::string &value) const override { return attrs_.count(value); }
+
+  CCSSTagDataP getParent() const override {
+    if (! parent_)
+      return CCSSTagDataP();
+
+    return parent_->shared_from_this();
+  }
+
+  void getChildren(TagDataArray &children) const override {
+    for (const auto &child : children_)
+      children.push_back(child);
+  }
+
+  CCSSTagDataP getPrevSibling() const override { return sibling(-1); }
+
+  CCSSTagDataP getNextSibling() const override { return sibling( 1); }
+
+  std::string label() const {
+    std::string str = name_;
+
+    if (! id_.empty())
+      str += "#" + id_;
+
+    for (const auto &c : classes_)
+      str += "." + c;
+
+    return str;
+  }
+
+ private:
+  // sibling at offset from tag (null if none)
+  TestTagP sibling(int d) const {
+    int ind = index_ + d;
+
+    if (! parent_ || ind < 0 || ind >= int(parent_->children_.size()))
+      return TestTagP();
+
+    return parent_->children_[ind];
+  }
+
+ private:
+  std::string  name_;
+  std::string  id_;
+  Classes      classes_;
+  Attrs        attrs_;
+  TestTag     *parent_ { nullptr };
+  Children     children_;
+  int          index_ { 0 };
+};
+
+//---
+
+// tag data for a test tag which is created for each link (not kept by the tree)
+class WrapTag : public CCSSTagData {
+ public:
+  explicit WrapTag(const TestTag *tag) : tag_(tag) { }
+
+  static CCSSTagDataP make(const TestTag *tag) {
+    return (tag ? std::make_shared<WrapTag>(tag) : CCSSTagDataP());
+  }
+
+  const TestTag *tag() const { return tag_; }
+
+  bool isElement(const std::string &name) const override { return tag_->isElement(name); }
+
+  bool isClass(const std::string &name) const override { return tag_->isClass(name); }
+
+  bool isId(const std::string &name) const override { return tag_->isId(name); }
+
+  bool hasAttribute(const std::string &name, CCSSAttributeOp op,
+                    const std::string &value) const override {
+    return tag_->hasAttribute(name, op, value);
+  }
+
+  bool getNames(CCSSTagNames &names) const override { return tag_->getNames(names); }
+
+  bool isNthChild(int n) const override { return tag_->isNthChild(n); }
+
+  bool isInputValue(const std::string &value) const override {
+    return tag_->isInputValue(value);
+  }
+
+  CCSSTagDataP getParent() const override { return make(tag_->parentTag()); }
+
+  void getChildren(TagDataArray &children) const override {
+    for (const auto &child : tag_->children())
+      children.push_back(make(child.get()));
+  }
+
+  CCSSTagDataP getPrevSibling() const override { return make(tag_->prevTag()); }
+
+  CCSSTagDataP getNextSibling() const override { return make(tag_->nextTag()); }
+
+ private:
+  const TestTag *tag_ { nullptr };
+};
+
+//---
+
+// how tree is presented to matching
+enum class TreeType {
+  PERSISTENT,
+  WRAPPED
+};
+
+const TreeType treeTypes[] = { TreeType::PERSISTENT, TreeType::WRAPPED };
+
+const char *treeTypeName(TreeType type) {
+  return (type == TreeType::PERSISTENT ? "persistent" : "wrapped");
+}
+
+CCSSTagDataP
+tagData(const TestTagP &tag, TreeType type)
+{
+  if (type == TreeType::PERSISTENT)
+    return tag;
+
+  return WrapTag::make(tag.get());
+}
+
+// test tag of persistent or wrapped tag data
+const TestTag *
+testTag(const CCSSTagDataP &data)
+{
+  const WrapTag *wrap = dynamic_cast<const WrapTag *>(data.get());
+
+  if (wrap)
+    return wrap->tag();
+
+  return dynamic_cast<const TestTag *>(data.get());
+}
+
+// tags of tree in document order
+void
+getTags(const TestTagP &tag, std::vector<TestTagP> &tags)
+{
+  tags.push_back(tag);
+
+  for (const auto &child : tag->children())
+    getTags(child, tags);
+}
+
+//---
+
+// plain tree (array of nodes linked by index) which is matched through a user defined
+// adapter without deriving from CCSSTagData
+struct PlainNode {
+  typedef std::vector<std::pair<CCSSAtom, std::string>> Attrs;
+
+  CCSSAtom         element;
+  CCSSAtom         id;
+  CCSSAtoms        classes;
+  Attrs            attrs;
+  int              parent { -1 };
+  int              index  { 0 };  // index in parent's children
+  std::vector<int> children;
+};
+
+typedef std::vector<PlainNode> PlainNodes;
+
+// add node for tag and its descendants (nodes are in document order)
+int
+addPlainNodes(const TestTag &tag, int parent, PlainNodes &nodes)
+{
+  int ind = int(nodes.size());
+
+  nodes.push_back(PlainNode());
+
+  PlainNode &node = nodes.back();
+
+  node.element = CCSSAtom(tag.name());
+
+  if (! tag.id().empty())
+    node.id = CCSSAtom(tag.id());
+
+  for (const auto &c : tag.classes())
+    node.classes.push_back(CCSSAtom(c));
+
+  for (const auto &attr : tag.attrs())
+    node.attrs.push_back(PlainNode::Attrs::value_type(CCSSAtom(attr.first), attr.second));
+
+  node.parent = parent;
+
+  if (parent >= 0) {
+    node.index = int(nodes[parent].children.size());
+
+    nodes[parent].children.push_back(ind);
+  }
+
+  for (const auto &child : tag.children())
+    addPlainNodes(*child, ind, nodes);
+
+  return ind;
+}
+
+// adapter for plain tree (nodes are indices)
+class PlainAdapter {
+ public:
+  typedef int Node;
+
+ public:
+  explicit PlainAdapter(const PlainNodes &nodes) : nodes_(nodes) { }
+
+  bool isElement(int node, const CCSSAtom &name) const { return nodes_[node].element == name; }
+
+  bool isClass(int node, const CCSSAtom &name) const {
+    const auto &classes = nodes_[node].classes;
+
+    return (std::find(classes.begin(), classes.end(), name) != classes.end());
+  }
+
+  bool isId(int node, const CCSSAtom &name) const {
+    return (! name.empty() && nodes_[node].id == name);
+  }
+
+  bool hasAttribute(int node, const CCSSAtom &name, CCSSAttributeOp op,
+                    const std::string &value) const {
+    for (const auto &attr : nodes_[node].attrs) {
+      if (attr.first != name)
+        continue;
+
+      switch (op) {
+        case CCSSAttributeOp::NONE       : return true;
+        case CCSSAttributeOp::EQUAL      : return attr.second == value;
+        case CCSSAttributeOp::PARTIAL    : return attr.second.find(value) != std::string::npos;
+        case CCSSAttributeOp::STARTS_WITH: return attr.second.compare(0, value.size(), value) == 0;
+        default                          : return false;
+      }
+    }
+
+    return false;
+  }
+
+  bool getNames(int node, CCSSTagNames &names) const {
+    names.element = nodes_[node].element;
+
+    if (! nodes_[node].id.empty())
+      names.ids.push_back(nodes_[node].id);
+
+    names.classes = nodes_[node].classes;
+
+    return true;
+  }
+
+  bool isNthChild(int node, int n) const { return (nodes_[node].index + 1 == n); }
+
+  int childIndex(int node, bool fromEnd) const {
+    if (! fromEnd)
+      return nodes_[node].index + 1;
+
+    return int(siblings(node).size()) - nodes_[node].index;
+  }
+
+  int typeIndex(int node, const CCSSAtom &name, bool fromEnd) const {
+    const std::vector<int> &siblings1 = siblings(node);
+
+    int d = (fromEnd ? 1 : -1), ind = 1;
+
+    for (int i = nodes_[node].index + d; i >= 0 && i < int(siblings1.size()); i += d) {
+      if (nodes_[siblings1[i]].element == name)
+        ++ind;
+    }
+
+    return ind;
+  }
+
+  bool isInputValue(int node, const std::string &value) const {
+    for (const auto &attr : nodes_[node].attrs)
+      if (attr.first.str() == value)
+        return true;
+
+    return false;
+  }
+
+  bool isRoot(int node) const { return nodes_[node].parent < 0; }
+
+  bool parent(int node, int &parent) const {
+    parent = nodes_[node].parent;
+
+    return (parent >= 0);
+  }
+
+  bool prevSibling(int node, int &sibling) const {
+    if (nodes_[node].index == 0)
+      return false;
+
+    sibling = siblings(node)[nodes_[node].index - 1];
+
+    return true;
+  }
+
+  uint64_t key(int node) const { return uint64_t(node); }
+
+ private:
+  // children of node's parent (only node if root)
+  const std::vector<int> &siblings(int node) const {
+    if (nodes_[node].parent < 0) {
+      static std::vector<int> root = { 0 };
+
+      return root;
+    }
+
+    return nodes_[nodes_[node].parent].children;
+  }
+
+ private:
+  const PlainNodes &nodes_;
+};
+
+static_assert(CCSSIsTagAdapter<PlainAdapter>::value, "plain adapter is not a tag adapter");
+
+//---
+
+const char *testElementNames[] = { "a", "b", "c" };
+
+const char *testClassNames[] = { "x", "y", "z" };
+
+const char *testCombinators[] = { " ", " > ", " + ", " ~ " };
+
+// includes unsupported functions (ignored) and invalid nth expressions (never match)
+const char *testExtras[] = {
+  ".x", ".y", ".x.y", "#i", "[t]", "[t=\"1\"]", "[t*=\"2\"]", "[t~=\"2\"]", "[t|=\"1\"]",
+  ":first-child", ":last-child", ":only-child", ":nth-child(2n+1)", ":nth-child(odd)",
+  ":nth-child(-n+3)", ":nth-child(2)", ":nth-last-child(2)", ":nth-last-child(3n-1)",
+  ":first-of-type", ":last-of-type", ":only-of-type", ":nth-of-type(even)",
+  ":nth-last-of-type(n+2)", ":root", ":required", ":invalid", ":hover", ":foo(1)",
+  ":nth-child(x)", ":nth-of-type(3n+-2)", ":nth-child(99999999999)"
+};
+
+template<typename T, std::size_t N>
+const T &pick(TestRandom &random, const T (&array)[N]) { return array[random.next(N)]; }
+
+// random tree (tags are added to random earlier tags so the tree has some depth)
+TestTagP
+generateTree(TestRandom &random, uint numTags)
+{
+  TestTagP root = std::make_shared<TestTag>("a");
+
+  std::vector<TestTagP> tags;
+
+  tags.push_back(root);
+
+  for (uint i = 1; i < numTags; ++i) {
+    uint window = std::min(uint(tags.size()), 12u);
+
+    TestTagP parent = (random.percent(70) ? tags[tags.size() - 1 - random.next(window)] :
+                                            tags[random.next(uint(tags.size()))]);
+
+    TestTagP tag = std::make_shared<TestTag>(pick(random, testElementNames));
+
+    if (random.percent(35))
+      tag->addClass(pick(random, testClassNames));
+
+    if (random.percent(15))
+      tag->addClass(pick(random, testClassNames));
+
+    if (random.percent(8))
+      tag->setId("i");
+
+    if (random.percent(20))
+      tag->setAttr("t", random.percent(50) ? "1" : "2");
+
+    if (random.percent(10))
+      tag->setAttr("required", "1");
+
+    if (random.percent(5))
+      tag->setAttr("invalid", "1");
+
+    parent->addChild(tag);
+
+    tags.push_back(tag);
+  }
+
+  return root;
+}
+
+// random selector list
+std::string
+generateSelector(TestRandom &random)
+{
+  std::string text;
+
+  uint numCompounds = 1 + random.next(4);
+
+  for (uint i = 0; i < numCompounds; ++i) {
+    if (i > 0)
+      text += pick(random, testCombinators);
+
+    text += (random.percent(80) ? pick(random, testElementNames) : "*");
+
+    if (random.percent(40))
+      text += pick(random, testExtras);
+  }
+
+  return text;
+}
+
+// random comma separated selector lists
+std::string
+generateSelectors(TestRandom &random)
+{
+  std::string text = generateSelector(random);
+
+  if (random.percent(25))
+    text += ", " + generateSelector(random);
+
+  return text;
+}
+
+// random stylesheet (each rule sets its own property)
+std::string
+generateStyleSheet(TestRandom &random, uint numRules)
+{
+  std::string text;
+
+  for (uint i = 0; i < numRules; ++i)
+    text += generateSelectors(random) + " { p" + std::to_string(i) + ": 1 }\n";
+
+  return text;
+}
+
+// random declarations of a rule (few names so declarations of rules compete)
+std::string
+generateDeclarations(TestRandom &random, uint value)
+{
+  std::string text;
+
+  uint numOptions = random.next(3);
+
+  for (uint i = 0; i < numOptions; ++i) {
+    uint name      = random.next(3);
+    bool important = random.percent(10);
+
+    text += " p" + std::to_string(name) + ": " + std::to_string(value) +
+            (important ? " !important;" : ";");
+  }
+
+  return text;
+}
+
+//---
+
+// reference An+B check of 1-based index i (valid set false if expression is invalid).
+// Spaces are removed and the number of n >= 0 with a*n + b = i is searched for
+bool
+refNthMatch(const std::string &expr, int i, bool &valid)
+{
+  std::string str;
+
+  for (char c : expr)
+    if (! isspace(c))
+      str += char(tolower(c));
+
+  if      (str == "odd" ) str = "2n+1";
+  else if (str == "even") str = "2n";
+
+  // optional sign and at least one digit
+  auto isInteger = [](const std::string &s, bool signOk) {
+    std::size_t j = 0;
+
+    if (signOk && j < s.size() && (s[j] == '+' || s[j] == '-'))
+      ++j;
+
+    if (j == s.size() || s.size() - j > 9)
+      return false;
+
+    for ( ; j < s.size(); ++j)
+      if (! isdigit(s[j]))
+        return false;
+
+    return true;
+  };
+
+  long a = 0, b = 0;
+
+  std::size_t pn = str.find('n');
+
+  valid = false;
+
+  if (pn == std::string::npos) {
+    if (! isInteger(str, true))
+      return false;
+
+    b = atol(str.c_str());
+  }
+  else {
+    std::string as = str.substr(0, pn);
+    std::string bs = str.substr(pn + 1);
+
+    if      (as == "" || as == "+") a = 1;
+    else if (as == "-")             a = -1;
+    else if (isInteger(as, true))   a = atol(as.c_str());
+    else                            return false;
+
+    if (bs != "") {
+      // exactly one sign then digits
+      if ((bs[0] != '+' && bs[0] != '-') || ! isInteger(bs.substr(1), false))
+        return false;
+
+      b = atol(bs.c_str());
+    }
+  }
+
+  valid = true;
+
+  for (long n = 0; n <= i + std::labs(b); ++n)
+    if (a*n + b == i)
+      return true;
+
+  return false;
+}
+
+// reference sibling index of tag (1-based, from last if fromEnd) counting siblings with
+// element name type (any sibling if empty)
+int
+refIndex(const CCSSTagDataP &data, bool fromEnd, const std::string &type)
+{
+  int ind = 1;
+
+  CCSSTagDataP p = (fromEnd ? data->getNextSibling() : data->getPrevSibling());
+
+  for ( ; p; p = (fromEnd ? p->getNextSibling() : p->getPrevSibling()))
+    if (type == "" || p->isElement(type))
+      ++ind;
+
+  return ind;
+}
+
+// reference compound selector match using only the string checks and links of the tag
+// and the text of the selector functions (unknown functions are ignored and invalid nth
+// expressions never match)
+bool
+refCompoundMatch(const CCSS::Selector &selector, const CCSSTagDataP &data)
+{
+  const std::string &name = selector.name();
+
+  bool universal = (name == "" || name == "*");
+
+  if (! universal && ! data->isElement(name))
+    return false;
+
+  for (const auto &id : selector.idNames())
+    if (! data->isId(id.str()))
+      return false;
+
+  for (const auto &className : selector.classNames())
+    if (! data->isClass(className.str()))
+      return false;
+
+  for (const auto &expr : selector.expressions())
+    if (! data->hasAttribute(expr.id(), expr.op(), expr.value()))
+      return false;
+
+  // type of of-type functions is selector name or tag's name
+  std::string type = (universal ? testTag(data)->name() : name);
+
+  for (const auto &fn : selector.functions()) {
+    std::size_t pl = fn.find('(');
+
+    if (pl != std::string::npos && fn.back() == ')') {
+      std::string fnName = fn.substr(0, pl);
+      std::string arg    = fn.substr(pl + 1, fn.size() - pl - 2);
+
+      int ind;
+
+      if      (fnName == "nth-child"       ) ind = refIndex(data, false, "");
+      else if (fnName == "nth-last-child"  ) ind = refIndex(data, true , "");
+      else if (fnName == "nth-of-type"     ) ind = refIndex(data, false, type);
+      else if (fnName == "nth-last-of-type") ind = refIndex(data, true , type);
+      else continue;
+
+      bool valid;
+
+      if (! refNthMatch(arg, ind, valid) || ! valid)
+        return false;
+    }
+    else if (fn == "first-child"  ) { if (refIndex(data, false, "") != 1) return false; }
+    else if (fn == "last-child"   ) { if (refIndex(data, true , "") != 1) return false; }
+    else if (fn == "only-child"   ) { if (refIndex(data, false, "") != 1 ||
+                                          refIndex(data, true , "") != 1) return false; }
+    else if (fn == "first-of-type") { if (refIndex(data, false, type) != 1) return false; }
+    else if (fn == "last-of-type" ) { if (refIndex(data, true , type) != 1) return false; }
+    else if (fn == "only-of-type" ) { if (refIndex(data, false, type) != 1 ||
+                                          refIndex(data, true , type) != 1) return false; }
+    else if (fn == "root"         ) { if (data->getParent()) return false; }
+    else if (fn == "required"     ) { if (! data->isInputValue("required")) return false; }
+    else if (fn == "invalid"      ) { if (! data->isInputValue("invalid")) return false; }
+  }
+
+  return true;
+}
+
+// naive reference match : selector i matches tag and selectors before it match
+// tags found by trying every ancestor or previous sibling for each combinator
+bool
+refMatch(const CCSS::SelectorList::Selectors &selectors, uint i, const CCSSTagDataP &data)
+{
+  if (! refCompoundMatch(selectors[i], data))
+    return false;
+
+  if (i == 0)
+    return true;
+
+  switch (selectors[i - 1].nextType()) {
+    case CCSS::NextType::DESCENDANT: {
+      for (CCSSTagDataP p = data->getParent(); p; p = p->getParent())
+        if (refMatch(selectors, i - 1, p))
+          return true;
+
+      return false;
+    }
+    case CCSS::NextType::CHILD: {
+      CCSSTagDataP p = data->getParent();
+
+      return (p && refMatch(selectors, i - 1, p));
+    }
+    case CCSS::NextType::SIBLING: {
+      CCSSTagDataP p = data->getPrevSibling();
+
+      return (p && refMatch(selectors, i - 1, p));
+    }
+    case CCSS::NextType::PRECEDER: {
+      for (CCSSTagDataP p = data->getPrevSibling(); p; p = p->getPrevSibling())
+        if (refMatch(selectors, i - 1, p))
+          return true;
+
+      return false;
+    }
+    default:
+      return false;
+  }
+}
+
+bool
+refMatch(const CCSS::SelectorList &selectorList, const CCSSTagDataP &data)
+{
+  const auto &selectors = selectorList.selectors();
+
+  if (selectors.empty())
+    return false;
+
+  return refMatch(selectors, uint(selectors.size() - 1), data);
+}
+
+//---
+
+// number of checks and failures of a test
+class TestCounts {
+ public:
+  explicit TestCounts(const std::string &name) : name_(name) { }
+
+  uint failures() const { return failures_; }
+
+  void check(bool ok, const std::string &msg) {
+    ++checks_;
+
+    if (ok)
+      return;
+
+    // only report first few failures
+    if (failures_ < 5)
+      std::cerr << name_ << ": " << msg << "\n";
+
+    ++failures_;
+  }
+
+  void print() const {
+    std::cout << name_ << ": " << checks_ << " checks, " << failures_ << " failures\n";
+  }
+
+ private:
+  std::string name_;
+  uint        checks_   { 0 };
+  uint        failures_ { 0 };
+};
+
+typedef std::vector<const TestTag *> TestTags;
+
+TestTags
+testTags(const CCSSTagData::TagDataArray &tags)
+{
+  TestTags tags1;
+
+  for (const auto &data : tags)
+    tags1.push_back(testTag(data));
+
+  return tags1;
+}
+
+typedef std::map<const TestTag *, CCSS::StyleDataArray> TagStyles;
+
+// rules of stylesheet which match each tag using reference match (in specificity then
+// source order like CCSS::matchRules)
+void
+getRefStyles(const CCSS &css, const std::vector<TestTagP> &tags, TagStyles &tagStyles)
+{
+  std::vector<CCSS::SelectorList> selectorLists;
+
+  css.getSelectors(selectorLists);
+
+  for (const auto &tag : tags) {
+    CCSS::StyleDataArray &styles = tagStyles[tag.get()];
+
+    for (const auto &selectorList : selectorLists) {
+      const CCSS::StyleData &styleData = css.getStyleData(selectorList);
+
+      if (refMatch(styleData.getSelectorList(), tag))
+        styles.push_back(&styleData);
+    }
+
+    std::sort(styles.begin(), styles.end(),
+      [](const CCSS::StyleData *s1, const CCSS::StyleData *s2) {
+        return s1->sortKey() < s2->sortKey();
+      });
+  }
+}
+
+std::string
+stylesString(const CCSS::StyleDataArray &styles)
+{
+  std::string str;
+
+  for (const auto &styleData : styles)
+    str += (str.empty() ? "" : ", ") + styleData->toString();
+
+  return "[" + str + "]";
+}
+
+// check rules of each tag of styleTree (sequential and on threads) for both tree types
+void
+checkStyleTree(const CCSS &css, const TestTagP &root, const TagStyles &expected,
+               TestCounts &counts)
+{
+  for (const auto &type : treeTypes) {
+    for (uint numThreads = 1; numThreads <= 3; numThreads += 2) {
+      uint numTags = 0;
+
+      auto proc = [&](const CCSSTagDataP &data, const CCSS::StyleDataArray &styles) {
+        ++numTags;
+
+        const TestTag *tag = testTag(data);
+
+        const CCSS::StyleDataArray &styles1 = (*expected.find(tag)).second;
+
+        counts.check(styles == styles1, std::string("styleTree ") + treeTypeName(type) +
+                     " threads " + std::to_string(numThreads) + " " + tag->label() + " " +
+                     stylesString(styles) + ", expected " + stylesString(styles1));
+      };
+
+      if (numThreads == 1)
+        css.styleTree(tagData(root, type), proc);
+      else
+        css.styleTree(tagData(root, type), proc, numThreads);
+
+      counts.check(numTags == expected.size(), "styleTree tag count");
+    }
+  }
+}
+
+//---
+
+// compiled selector queries against reference matches of root's descendants
+uint
+testQuery(uint32_t seed, uint iterations)
+{
+  TestCounts counts("query");
+
+  TestRandom random(seed);
+
+  for (uint iter = 0; iter < iterations; ++iter) {
+    TestTagP root = generateTree(random, 40 + random.next(160));
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    const CCSS css;
+
+    for (uint j = 0; j < 10; ++j) {
+      std::string text = generateSelectors(random);
+
+      CCSS::CompiledSelector selector;
+
+      if (! css.compileSelector(text, selector)) {
+        counts.check(false, "compile '" + text + "'");
+        continue;
+      }
+
+      // descendants of root (not root) in document order
+      TestTags expected;
+
+      for (std::size_t i = 1; i < tags.size(); ++i) {
+        for (const auto &selectorList : selector.selectorLists()) {
+          if (refMatch(selectorList, tags[i])) {
+            expected.push_back(tags[i].get());
+            break;
+          }
+        }
+      }
+
+      for (const auto &type : treeTypes) {
+        CCSSTagDataP rootData = tagData(root, type);
+
+        TestTags result = testTags(selector.querySelectorAll(rootData));
+
+        counts.check(result == expected, std::string("querySelectorAll '") + text + "' " +
+                     treeTypeName(type) + " " + std::to_string(result.size()) + " tags, " +
+                     "expected " + std::to_string(expected.size()));
+
+        CCSSTagDataP first = selector.querySelector(rootData);
+
+        counts.check((first ? testTag(first) : nullptr) ==
+                     (! expected.empty() ? expected[0] : nullptr),
+                     std::string("querySelector '") + text + "' " + treeTypeName(type));
+      }
+    }
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// rules of tags from styleTree against reference matches. Rules shared between tags
+// with the same names must not be shared by tags of a different parent (cousins)
+uint
+testStyleTree(uint32_t seed, uint iterations)
+{
+  TestCounts counts("styleTree");
+
+  // cousins with same names : only first ul's span matches
+  {
+    TestTagP root = std::make_shared<TestTag>("html");
+
+    for (uint i = 0; i < 2; ++i) {
+      TestTagP ul   = std::make_shared<TestTag>("ul");
+      TestTagP li   = std::make_shared<TestTag>("li");
+      TestTagP span = std::make_shared<TestTag>("span");
+
+      root->addChild(ul);
+      ul  ->addChild(li);
+      li  ->addChild(span);
+    }
+
+    CCSS css;
+
+    css.processLine("ul:first-child span { color: red }");
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    TagStyles expected;
+
+    getRefStyles(css, tags, expected);
+
+    checkStyleTree(css, root, expected, counts);
+  }
+
+  TestRandom random(seed);
+
+  for (uint iter = 0; iter < iterations; ++iter) {
+    TestTagP root = generateTree(random, 20 + random.next(150));
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    CCSS css;
+
+    css.processLine(generateStyleSheet(random, 25));
+
+    TagStyles expected;
+
+    getRefStyles(css, tags, expected);
+
+    checkStyleTree(css, root, expected, counts);
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// rules of tags from matchRules against reference matches for both tree types
+uint
+testMatchRules(uint32_t seed, uint iterations)
+{
+  TestCounts counts("matchRules");
+
+  TestRandom random(seed);
+
+  for (uint iter = 0; iter < iterations; ++iter) {
+    TestTagP root = generateTree(random, 20 + random.next(150));
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    CCSS css;
+
+    css.processLine(generateStyleSheet(random, 25));
+
+    TagStyles expected;
+
+    getRefStyles(css, tags, expected);
+
+    for (const auto &type : treeTypes) {
+      std::string typeName = treeTypeName(type);
+
+      for (const auto &tag : tags) {
+        const CCSS::StyleDataArray &styles1 = expected[tag.get()];
+
+        CCSSTagDataP data = tagData(tag, type);
+
+        CCSS::StyleDataArray styles;
+
+        css.matchRules(data, styles);
+
+        counts.check(styles == styles1, "matchRules " + typeName + " " + tag->label() +
+                     " " + stylesString(styles) + ", expected " + stylesString(styles1));
+      }
+    }
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// check rules of tag and its descendants matched with context of a document order walk.
+// Each child is released once it has been walked so wrapped tags are freed and their
+// addresses reused by later tags (cousins)
+void
+checkContextMatch(const CCSS &css, const CCSSTagDataP &data, CCSS::MatchContext &context,
+                  const TagStyles &expected, const std::string &name, TestCounts &counts)
+{
+  const TestTag *tag = testTag(data);
+
+  const CCSS::StyleDataArray &styles1 = (*expected.find(tag)).second;
+
+  CCSS::StyleDataArray styles;
+
+  css.matchRules(data, context, styles);
+
+  counts.check(styles == styles1, name + " " + tag->label() + " " + stylesString(styles) +
+               ", expected " + stylesString(styles1));
+
+  context.pushAncestor(data);
+
+  CCSSTagData::TagDataArray children;
+
+  data->getChildren(children);
+
+  for (auto &child : children) {
+    CCSSTagDataP child1 = std::move(child);
+
+    checkContextMatch(css, child1, context, expected, name, counts);
+  }
+
+  context.popAncestor();
+}
+
+// rules of tags from document order context walks with and without style sharing
+// and match cache against reference matches for both tree types
+uint
+testMatchContext(uint32_t seed, uint iterations)
+{
+  TestCounts counts("matchContext");
+
+  TestRandom random(seed);
+
+  for (uint iter = 0; iter < iterations; ++iter) {
+    TestTagP root = generateTree(random, 20 + random.next(150));
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    CCSS css;
+
+    css.processLine(generateStyleSheet(random, 25));
+
+    TagStyles expected;
+
+    getRefStyles(css, tags, expected);
+
+    for (const auto &type : treeTypes) {
+      std::string typeName = treeTypeName(type);
+
+      // second walk with match cache reuses rules cached by first walk
+      for (uint cacheSize = 0; cacheSize <= 64; cacheSize += 64) {
+        css.setMatchCacheSize(cacheSize);
+
+        for (uint walk = 0; walk < (cacheSize > 0 ? 2 : 1); ++walk) {
+          for (uint sharing = 0; sharing < 2; ++sharing) {
+            CCSS::MatchContext context;
+
+            context.setStyleSharing(sharing);
+
+            checkContextMatch(css, tagData(root, type), context, expected,
+                              "context " + typeName + " sharing " +
+                              std::to_string(sharing) + " cache " +
+                              std::to_string(cacheSize), counts);
+          }
+        }
+      }
+    }
+  }
+
+  //---
+
+  // context reused by new stylesheets created at the same address with the same number
+  // of rules must not return shared rules of the previous stylesheet
+  {
+  TestTagP root = generateTree(random, 100);
+
+  std::vector<TestTagP> tags;
+
+  getTags(root, tags);
+
+  CCSS::MatchContext context;
+
+  std::optional<CCSS> css;
+
+  std::size_t numRules = 0;
+
+  auto getNumRules = [&]() {
+    std::vector<CCSS::SelectorList> selectors;
+
+    css->getSelectors(selectors);
+
+    return selectors.size();
+  };
+
+  for (uint iter = 0; iter < std::max(iterations/10, 1U); ++iter) {
+    // same number of rules as first stylesheet
+    do {
+      css.emplace();
+
+      css->processLine(generateStyleSheet(random, 25));
+    } while (numRules > 0 && getNumRules() != numRules);
+
+    numRules = getNumRules();
+
+    TagStyles expected;
+
+    getRefStyles(*css, tags, expected);
+
+    checkContextMatch(*css, tagData(root, TreeType::PERSISTENT), context, expected,
+                      "reused context", counts);
+  }
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// rules of tags matched through borrowed links of nodes (CCSSTagDataNode) against
+// reference matches for both tree types. Node links of wrapped tags return tag data
+// which is only kept alive by the node
+uint
+testTagNode(uint32_t seed, uint iterations)
+{
+  TestCounts counts("tagNode");
+
+  TestRandom random(seed);
+
+  for (uint iter = 0; iter < iterations; ++iter) {
+    TestTagP root = generateTree(random, 20 + random.next(150));
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    CCSS css;
+
+    css.processLine(generateStyleSheet(random, 25));
+
+    TagStyles expected;
+
+    getRefStyles(css, tags, expected);
+
+    for (const auto &type : treeTypes) {
+      std::string typeName = treeTypeName(type);
+
+      for (const auto &tag : tags) {
+        const CCSS::StyleDataArray &styles1 = expected[tag.get()];
+
+        CCSSTagDataNode node(tagData(tag, type));
+
+        CCSS::StyleDataArray styles;
+
+        css.matchRules(node, styles);
+
+        counts.check(styles == styles1, "node " + typeName + " " + tag->label() + " " +
+                     stylesString(styles) + ", expected " + stylesString(styles1));
+      }
+    }
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// rules matched through a user defined adapter of a plain tree (with and without the
+// match cache) and compiled selectors checked through it must be the same as for the
+// tag data of the tree
+uint
+testAdapter(uint32_t seed, uint iterations)
+{
+  TestCounts counts("adapter");
+
+  TestRandom random(seed);
+
+  for (uint iter = 0; iter < iterations; ++iter) {
+    TestTagP root = generateTree(random, 20 + random.next(60));
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    PlainNodes nodes;
+
+    addPlainNodes(*root, -1, nodes);
+
+    PlainAdapter adapter(nodes);
+
+    CCSS css;
+
+    css.processLine(generateStyleSheet(random, 30));
+
+    CCSS::CompiledSelector selector;
+
+    css.compileSelector(generateSelectors(random), selector);
+
+    for (std::size_t cacheSize : { 0, 64 }) {
+      css.setMatchCacheSize(cacheSize);
+
+      // nodes and tags are both in document order
+      for (std::size_t i = 0; i < tags.size(); ++i) {
+        CCSS::StyleDataArray styles;
+
+        css.match(int(i), styles, adapter);
+
+        std::string msg = tags[i]->label() + " (cache " + std::to_string(cacheSize) + ")";
+
+        counts.check(styles == css.matchRules(tags[i]),
+                     "adapter rules of " + msg + " " + stylesString(styles) +
+                     " expected " + stylesString(css.matchRules(tags[i])));
+
+        if (cacheSize == 0)
+          counts.check(selector.checkMatch(adapter, int(i)) == selector.checkMatch(tags[i]),
+                       "adapter compiled selector of " + msg);
+      }
+    }
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// parse of An+B expressions (valid expressions give A and B, invalid ones fail)
+uint
+testNthExpr()
+{
+  TestCounts counts("nthExpr");
+
+  struct Test {
+    const char *str;
+    bool        valid;
+    int         a, b;
+  };
+
+  const Test tests[] = {
+    { "odd"         , true , 2,  1 },
+    { "EVEN"        , true , 2,  0 },
+    { "-n+3"        , true , -1, 3 },
+    { "+5"          , true , 0,  5 },
+    { "n"           , true , 1,  0 },
+    { " 3n - 2 "    , true , 3, -2 },
+    { "2147483647"  , true , 0, 2147483647 },
+    { "3n+-2"       , false, 0,  0 },
+    { "3n-+2"       , false, 0,  0 },
+    { "3n+"         , false, 0,  0 },
+    { "2147483648"  , false, 0,  0 },
+    { "99999999999n", false, 0,  0 },
+    { "n+99999999999", false, 0, 0 },
+    { "x"           , false, 0,  0 },
+  };
+
+  for (const auto &test : tests) {
+    CCSS::NthExpr expr;
+
+    bool valid = CCSS::NthExpr::parse(test.str, expr);
+
+    counts.check(valid == test.valid, std::string("parse '") + test.str + "'");
+
+    if (valid && test.valid)
+      counts.check(expr.a() == test.a && expr.b() == test.b,
+                   std::string("parse '") + test.str + "' gives " +
+                   std::to_string(expr.a()) + "n" + std::to_string(expr.b()));
+  }
+
+  // large A and B don't overflow match
+  CCSS::NthExpr expr(INT_MAX, 1 - INT_MAX);
+
+  counts.check(expr.isMatch(1) && ! expr.isMatch(2), "large expression match");
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// stream parse of stylesheet split into random chunks must give the same rules as
+// parsing it in one go. Rules have comments, quoted values and url values containing
+// braces and quotes and escaped braces in selectors, and splits are forced inside a
+// string, inside a comment, inside a url, after an escape and between braces
+uint
+testStreamParser(uint32_t seed, uint iterations)
+{
+  TestCounts counts("streamParser");
+
+  TestRandom random(seed);
+
+  auto printRules = [](const CCSS &css) {
+    std::ostringstream ss;
+
+    css.print(ss);
+
+    return ss.str();
+  };
+
+  for (uint iter = 0; iter < iterations; ++iter) {
+    std::string text;
+
+    std::vector<std::size_t> ruleEnds; // position after close brace of each rule
+
+    for (uint i = 0; i < 20; ++i) {
+      if (random.percent(30))
+        text += "/* comment { " + std::to_string(i) + " } \"x */\n";
+
+      text += generateSelectors(random);
+
+      if (random.percent(20))
+        text += ".e\\}" + std::to_string(i);
+
+      text += " {";
+
+      if (random.percent(10))
+        text += "}"; // empty rule
+      else {
+        text += " p" + std::to_string(i) + ": 1;";
+
+        if (random.percent(30))
+          text += " q: \"v { ' " + std::to_string(i) + "\";";
+
+        if (random.percent(30))
+          text += " r: url(x}" + std::to_string(i) + ".png);";
+
+        text += " }";
+      }
+
+      ruleEnds.push_back(text.size());
+
+      text += "\n";
+    }
+
+    CCSS css;
+
+    css.processLine(text);
+
+    std::string expected = printRules(css);
+
+    //---
+
+    // forced splits (middle of a string, middle of a comment, middle of a url,
+    // after an escape and between braces)
+    std::set<std::size_t> splits;
+
+    std::size_t pos = text.find("\"v {");
+    if (pos != std::string::npos) splits.insert(pos + 2);
+
+    pos = text.find("/* comment");
+    if (pos != std::string::npos) splits.insert(pos + 4);
+
+    pos = text.find("url(x}");
+    if (pos != std::string::npos) splits.insert(pos + 5);
+
+    pos = text.find("\\}");
+    if (pos != std::string::npos) splits.insert(pos + 1);
+
+    pos = text.find("{}");
+    if (pos != std::string::npos) splits.insert(pos + 1);
+
+    uint numSplits = random.next(20);
+
+    for (uint i = 0; i < numSplits; ++i)
+      splits.insert(random.next(uint(text.size())));
+
+    //---
+
+    CCSS css1;
+
+    CCSS::StreamParser parser(css1);
+
+    std::size_t start = 0;
+
+    for (const auto &split : splits) {
+      parser.addChunk(std::string_view(text).substr(start, split - start));
+
+      start = split;
+
+      // each rule is added as soon as its close brace is seen
+      std::size_t end = 0;
+
+      for (const auto &ruleEnd : ruleEnds)
+        if (ruleEnd <= split)
+          end = ruleEnd;
+
+      CCSS css2;
+
+      css2.processLine(text.substr(0, end));
+
+      counts.check(printRules(css1) == printRules(css2),
+                   "stream rules at " + std::to_string(split) + " differ");
+    }
+
+    parser.addChunk(std::string_view(text).substr(start));
+
+    parser.finish();
+
+    std::string result = printRules(css1);
+
+    counts.check(result == expected, "stream parse differs\n" + result +
+                 "expected\n" + expected);
+
+    // one char at a time
+    if (iter % 10 == 0) {
+      CCSS css3;
+
+      CCSS::StreamParser parser3(css3);
+
+      for (const auto &c : text)
+        parser3.addChunk(std::string_view(&c, 1));
+
+      parser3.finish();
+
+      counts.check(printRules(css3) == expected, "single char stream parse differs");
+    }
+  }
+
+  //---
+
+  // close braces in url and escaped in selector don't end rule
+  {
+  std::string text = "a { background: url(x}y.png); color: blue }\n"
+                     "b { color: red }\n"
+                     ".c\\} { color: green }";
+
+  CCSS css;
+
+  css.processLine(text);
+
+  CCSS css1;
+
+  CCSS::StreamParser parser(css1);
+
+  parser.addChunk(text);
+
+  counts.check(parser.pending().empty(), "url and escape stream rules pending");
+
+  parser.finish();
+
+  counts.check(printRules(css1) == printRules(css), "url and escape stream parse differs\n" +
+               printRules(css1) + "expected\n" + printRules(css));
+
+  const CCSS::StyleData *styleData = css1.findStyleData("a");
+
+  counts.check(styleData && css1.findStyleData(".c\\}"), "url and escape stream rules");
+
+  if (styleData) {
+    const CCSS::OptionList &options = styleData->getOptions();
+
+    counts.check(options.size() == 2 && options[0].getValue() == "url(x}y.png)" &&
+                 options[1].getValue() == "blue", "url and escape stream options");
+  }
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// unsupported selector functions are reported once in the diagnostics and ignored
+// when matching, and nth functions with invalid expressions are reported and never match
+uint
+testDiagnostics()
+{
+  TestCounts counts("diagnostics");
+
+  TestTagP root = std::make_shared<TestTag>("div");
+  TestTagP p    = std::make_shared<TestTag>("p");
+  TestTagP span = std::make_shared<TestTag>("span");
+  TestTagP li1  = std::make_shared<TestTag>("li");
+  TestTagP li2  = std::make_shared<TestTag>("li");
+
+  span->addClass("x");
+
+  root->addChild(p);
+  p   ->addChild(span);
+  root->addChild(li1);
+  root->addChild(li2);
+
+  CCSS css;
+
+  css.processLine("p:foo(1) { a: 1 } p:foo(1) .x { b: 2 } li:nth-child(x) { c: 3 } "
+                  "li { d: 4 } :nth-child(x) { e: 5 } li:foo(1):nth-child(x) { f: 6 }");
+
+  CCSS::Diagnostics expected = {
+    "Selector function not handled: foo(1)",
+    "Invalid selector function expression: nth-child(x)"
+  };
+
+  counts.check(css.diagnostics() == expected, "diagnostics");
+
+  // option value of tag's computed style (empty if not set)
+  auto optionValue = [&](const TestTagP &tag, const std::string &name) {
+    std::string value;
+
+    css.computeStyle(tag).getOptionValue(name, value);
+
+    return value;
+  };
+
+  counts.check(optionValue(p   , "a") == "1", "p:foo(1) ignored");
+  counts.check(optionValue(span, "b") == "2", "p:foo(1) .x ignored");
+
+  for (const auto &tag : { root, p, span, li1, li2 }) {
+    counts.check(optionValue(tag, "c") == "" && optionValue(tag, "e") == "" &&
+                 optionValue(tag, "f") == "", tag->name() + " :nth-child(x) matched");
+  }
+
+  counts.check(optionValue(li1, "d") == "4" && optionValue(li2, "d") == "4", "li");
+
+  counts.check(css.querySelectorAll(root, "p:foo(1)").size() == 1, "query p:foo(1)");
+  counts.check(css.querySelectorAll(root, ":nth-child(x)").empty(), "query :nth-child(x)");
+
+  // reported once
+  css.processLine("p:foo(1) { a: 2 } span:nth-child(x) { c: 4 }");
+
+  counts.check(css.diagnostics() == expected, "repeated diagnostics");
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// computed style options are in name order whatever order names were interned and
+// rules declared them in, and are found by name
+uint
+testComputeStyle()
+{
+  TestCounts counts("computeStyle");
+
+  // intern names in reverse order
+  CCSSAtom atomC("cs-order-c");
+  CCSSAtom atomB("cs-order-b");
+
+  TestTagP tag = std::make_shared<TestTag>("p");
+
+  tag->addClass("x");
+
+  const char *rules[] = {
+    "p { cs-order-c: 1; cs-order-a: 2 } .x { cs-order-b: 3 }",
+    ".x { cs-order-b: 3 } p { cs-order-a: 2; cs-order-c: 1 }",
+  };
+
+  for (const auto &rule : rules) {
+    CCSS css;
+
+    css.processLine(rule);
+
+    CCSS::ComputedStyle style = css.computeStyle(tag);
+
+    std::ostringstream ss;
+
+    ss << style;
+
+    counts.check(ss.str() == "cs-order-a: 2; cs-order-b: 3; cs-order-c: 1;",
+                 std::string("computed style order of '") + rule + "' is " + ss.str());
+
+    const CCSS::Option *option = style.getOption(atomC);
+
+    counts.check(option && option->getValue() == "1", "computed style cs-order-c");
+
+    std::string value;
+
+    counts.check(style.getOptionValue("cs-order-a", value) && value == "2" &&
+                 style.getOptionValue("cs-order-b", value) && value == "3" &&
+                 ! style.getOptionValue("cs-order-d", value), "computed style values");
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// hit and miss counts of match cache for a known tree, and cache reset when rules change.
+// Tags with the same names and ancestor names (the p tags, the div tags and the span
+// tags) share an entry. The root has no ancestors so is never looked up
+uint
+testMatchCache()
+{
+  TestCounts counts("matchCache");
+
+  TestTagP root = std::make_shared<TestTag>("html");
+  TestTagP body = std::make_shared<TestTag>("body");
+
+  root->addChild(body);
+
+  for (uint i = 0; i < 3; ++i)
+    body->addChild(std::make_shared<TestTag>("p"));
+
+  for (uint i = 0; i < 2; ++i) {
+    TestTagP div = std::make_shared<TestTag>("div");
+
+    body->addChild(div);
+
+    div->addChild(std::make_shared<TestTag>("span"));
+  }
+
+  std::vector<TestTagP> tags;
+
+  getTags(root, tags);
+
+  std::string text = "p { a: 1 } div span { b: 1 } body > * { c: 1 }";
+
+  CCSS css;
+
+  css.processLine(text);
+
+  css.setMatchCacheSize(16);
+
+  // match all tags (rules must be the same as an uncached stylesheet of the same text)
+  // and check counts
+  auto walk = [&](const std::string &name, std::size_t hits, std::size_t misses,
+                  std::size_t size) {
+    CCSS css1;
+
+    css1.processLine(text);
+
+    css.resetMatchCacheStats();
+
+    for (const auto &tag : tags) {
+      std::string str  = stylesString(css .matchRules(tag));
+      std::string str1 = stylesString(css1.matchRules(tag));
+
+      counts.check(str == str1, name + " " + tag->label() + " " + str + ", expected " + str1);
+    }
+
+    CCSS::MatchCacheStats stats = css.matchCacheStats();
+
+    counts.check(stats.hits == hits && stats.misses == misses && stats.size == size,
+                 name + " hits " + std::to_string(stats.hits) + " misses " +
+                 std::to_string(stats.misses) + " size " + std::to_string(stats.size) +
+                 ", expected " + std::to_string(hits) + ", " + std::to_string(misses) +
+                 " and " + std::to_string(size));
+  };
+
+  walk("first walk", 4, 4, 4);
+  walk("second walk", 8, 0, 4);
+
+  // adding, inserting and removing rules changes the rule version so no entry is reused
+  text += " span { d: 1 }";
+
+  css.processLine("span { d: 1 }");
+
+  walk("added rule", 4, 4, 4);
+
+  CCSS::RuleHandles handles;
+
+  text += " body p { e: 1 }";
+
+  css.insertRule("body p { e: 1 }", handles);
+
+  walk("inserted rule", 4, 4, 4);
+
+  text = "div span { b: 1 } body > * { c: 1 } span { d: 1 } body p { e: 1 }";
+
+  css.removeRule(0);
+
+  walk("removed rule", 4, 4, 4);
+
+  // least recently used entry is replaced (so each div and span misses)
+  css.setMatchCacheSize(1);
+
+  walk("size 1", 2, 6, 1);
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// per rule match statistics of known walks (without and with ancestor filter). Rules are
+// only attempted for tags in their bucket (rule 5 for no tag)
+uint
+testRuleStats()
+{
+  TestCounts counts("ruleStats");
+
+  TestTagP root = std::make_shared<TestTag>("html");
+  TestTagP body = std::make_shared<TestTag>("body");
+  TestTagP p1   = std::make_shared<TestTag>("p");
+  TestTagP p2   = std::make_shared<TestTag>("p");
+  TestTagP div  = std::make_shared<TestTag>("div");
+  TestTagP span = std::make_shared<TestTag>("span");
+
+  p1->addClass("x");
+
+  root->addChild(body);
+  body->addChild(p1);
+  body->addChild(p2);
+  body->addChild(div);
+  div ->addChild(span);
+
+  std::vector<TestTagP> tags;
+
+  getTags(root, tags);
+
+  CCSS css;
+
+  css.processLine("p { a: 1 } .x { a: 2 } div span { a: 3 } body > p { a: 4 } "
+                  "ul span { a: 5 } span.y { a: 6 } p:first-child { a: 7 }");
+
+  // attempts, filtered, rightmost rejects, combinator walks and matches of each rule
+  typedef std::vector<std::vector<uint64_t>> Expected;
+
+  auto checkStats = [&](const std::string &name, const Expected &expected) {
+    for (uint i = 0; i < expected.size(); ++i) {
+      CCSS::RuleStats stats = css.ruleStats(i);
+
+      std::vector<uint64_t> values = { stats.attempts, stats.filtered, stats.rightmostRejects,
+                                       stats.combinatorWalks, stats.matches };
+
+      std::string str;
+
+      for (const auto &v : values)
+        str += " " + std::to_string(v);
+
+      counts.check(values == expected[i], name + " rule " + std::to_string(i) + str);
+    }
+  };
+
+  // disabled stats are not recorded
+  for (const auto &tag : tags)
+    css.matchRules(tag);
+
+  css.setRuleStats(true);
+
+  checkStats("disabled", Expected(7, std::vector<uint64_t>(5, 0)));
+
+  //---
+
+  for (const auto &tag : tags)
+    css.matchRules(tag);
+
+  checkStats("matchRules", {
+    { 2, 0, 0, 0, 2 }, { 1, 0, 0, 0, 1 }, { 1, 0, 0, 1, 1 }, { 2, 0, 0, 2, 2 },
+    { 1, 0, 0, 1, 0 }, { 0, 0, 0, 0, 0 }, { 2, 0, 1, 0, 1 } });
+
+  // all rules (except unattempted rule) listed
+  std::ostringstream ss;
+
+  css.printRuleStats(ss, 10);
+
+  std::string str = ss.str();
+
+  counts.check(std::count(str.begin(), str.end(), '\n') == 8, "printRuleStats lines\n" + str);
+
+  //---
+
+  // ancestor filter rejects ul span before it is checked
+  css.resetRuleStats();
+
+  CCSS::MatchContext context;
+
+  context.setStyleSharing(false);
+
+  TagStyles expected;
+
+  getRefStyles(css, tags, expected);
+
+  checkContextMatch(css, root, context, expected, "context", counts);
+
+  checkStats("context", {
+    { 2, 0, 0, 0, 2 }, { 1, 0, 0, 0, 1 }, { 1, 0, 0, 1, 1 }, { 2, 0, 0, 2, 2 },
+    { 1, 1, 0, 0, 0 }, { 0, 0, 0, 0, 0 }, { 2, 0, 1, 0, 1 } });
+
+  counts.print();
+
+  return counts.failures();
+}
+
+//---
+
+// change class, id or attribute of a tag and add invalidation set for the change
+void
+changeTag(const CCSS &css, TestRandom &random, TestTag &tag, CCSS::InvalidationSet &set)
+{
+  uint op = random.next(4);
+
+  if      (op == 0) {
+    CCSS::Atoms oldClasses, newClasses;
+
+    for (const auto &c : tag.classes())
+      oldClasses.push_back(CCSSAtom(c));
+
+    std::string name = pick(random, testClassNames);
+
+    if (tag.classes().count(name))
+      tag.removeClass(name);
+    else
+      tag.addClass(name);
+
+    for (const auto &c : tag.classes())
+      newClasses.push_back(CCSSAtom(c));
+
+    css.addClassChange(oldClasses, newClasses, set);
+  }
+  else if (op == 1) {
+    if (! tag.id().empty())
+      css.addInvalidation(CCSS::ChangeType::ID, CCSSAtom(tag.id()), set);
+
+    tag.setId(tag.id().empty() ? "i" : "");
+
+    if (! tag.id().empty())
+      css.addInvalidation(CCSS::ChangeType::ID, CCSSAtom(tag.id()), set);
+  }
+  else {
+    std::string name = (op == 2 ? "t" : "required");
+
+    if (tag.attrs().count(name) && random.percent(50))
+      tag.removeAttr(name);
+    else
+      tag.setAttr(name, random.percent(50) ? "1" : "2");
+
+    css.addInvalidation(CCSS::ChangeType::ATTRIBUTE, CCSSAtom(name), set);
+  }
+}
+
+// tags whose rules change after a change of a tag must be in its invalidated tags
+// (for both tree types and for rules added after the invalidation sets are built)
+uint
+testInvalidation(uint32_t seed, uint iterations)
+{
+  TestCounts counts("invalidation");
+
+  TestRandom random(seed);
+
+  for (uint iter = 0; iter < iterations; ++iter) {
+    TestTagP root = generateTree(random, 20 + random.next(60));
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    CCSS css;
+
+    css.processLine(generateStyleSheet(random, 20));
+
+    for (uint i = 0; i < 20; ++i) {
+      if (i == 10) {
+        CCSS::RuleHandles handles;
+
+        css.insertRule(generateSelector(random) + " { q: 1 }", handles);
+        css.processLine(generateSelector(random) + " { q: 2 }");
+      }
+
+      std::vector<CCSS::StyleDataArray> before;
+
+      for (const auto &tag : tags)
+        before.push_back(css.matchRules(tag));
+
+      TestTag &tag = *tags[random.next(uint(tags.size()))];
+
+      CCSS::InvalidationSet set;
+
+      changeTag(css, random, tag, set);
+
+      for (const auto &type : treeTypes) {
+        CCSSTagData::TagDataArray invalidated;
+
+        css.getInvalidatedTags(tagData(tag.shared_from_this(), type), set, invalidated);
+
+        std::set<const TestTag *> invalidatedTags;
+
+        for (const auto &data : invalidated)
+          counts.check(invalidatedTags.insert(testTag(data)).second,
+                       std::string("duplicate invalidated tag ") + treeTypeName(type));
+
+        for (std::size_t j = 0; j < tags.size(); ++j) {
+          if (css.matchRules(tags[j]) == before[j])
+            continue;
+
+          counts.check(invalidatedTags.count(tags[j].get()),
+                       std::string("changed tag not invalidated ") + treeTypeName(type) +
+                       " " + tags[j]->label() + " after change of " + tag.label());
+        }
+      }
+    }
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+//---
+
+// computed style of each tag as text
+std::vector<std::string>
+computeStyles(const CCSS &css, const std::vector<TestTagP> &tags)
+{
+  std::vector<std::string> styles;
+
+  for (const auto &tag : tags) {
+    std::ostringstream ss;
+
+    ss << css.computeStyle(tag);
+
+    styles.push_back(ss.str());
+  }
+
+  return styles;
+}
+
+// parse of large stylesheet on several threads must give the same rules, errors and
+// computed styles as on one thread. Selector lists are repeated across the whole text
+// so rules are merged and re-declared across chunk boundaries, and a syntax error
+// (which ends the parse) is put in a middle chunk
+uint
+testParallelParse(uint32_t seed, uint iterations)
+{
+  TestCounts counts("parallelParse");
+
+  TestRandom random(seed);
+
+  auto printRules = [](const CCSS &css) {
+    std::ostringstream ss;
+
+    css.print(ss);
+
+    return ss.str();
+  };
+
+  uint numTexts = std::max(iterations/20, 2u);
+
+  for (uint iter = 0; iter < numTexts; ++iter) {
+    TestTagP root = generateTree(random, 50 + random.next(50));
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    std::vector<std::string> selectors;
+
+    for (uint i = 0; i < 40; ++i)
+      selectors.push_back(generateSelectors(random));
+
+    // at least 128K so each thread parses several chunks
+    std::string text;
+
+    for (uint i = 0; text.size() < 128*1024; ++i)
+      text += selectors[random.next(uint(selectors.size()))] + " {" +
+              generateDeclarations(random, i) + " }\n";
+
+    for (bool hasError : { false, true }) {
+      std::string text1 = text;
+
+      if (hasError) {
+        // empty declaration name near middle of text (at start of a rule)
+        std::size_t pos = text1.find('\n', text1.size()/2 + random.next(16*1024)) + 1;
+
+        text1.insert(pos, "p { : 1 }\n");
+      }
+
+      CCSS css1, css4;
+
+      css1.setParseThreads(1);
+      css4.setParseThreads(4);
+
+      bool rc1 = css1.processLine(text1);
+      bool rc4 = css4.processLine(text1);
+
+      std::string msg = (hasError ? " (with error)" : "");
+
+      counts.check(rc1 == ! hasError && rc4 == rc1, "parse result" + msg);
+
+      std::string rules1 = printRules(css1);
+
+      counts.check(printRules(css4) == rules1, "parallel rules differ" + msg);
+
+      counts.check(computeStyles(css4, tags) == computeStyles(css1, tags),
+                   "parallel computed styles differ" + msg);
+
+      counts.check(css4.diagnostics() == css1.diagnostics(), "parallel diagnostics" + msg);
+
+      // rules before error are kept
+      if (hasError) {
+        CCSS css;
+
+        css.processLine(text1.substr(0, text1.find("p { : 1 }")));
+
+        counts.check(printRules(css) == rules1, "rules before error");
+      }
+    }
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// replacing declarations of each rule with its current declarations must not change
+// computed styles (replaced declarations keep their position in the cascade even when
+// the rule's declarations were merged from several blocks)
+uint
+testReplace(uint32_t seed, uint iterations)
+{
+  TestCounts counts("replace");
+
+  // merged re-declaration is later than other rule
+  {
+    TestTagP root = std::make_shared<TestTag>("a");
+    TestTagP tag  = std::make_shared<TestTag>("b");
+
+    tag->addClass("x");
+
+    root->addChild(tag);
+
+    CCSS css;
+
+    css.processLine(".x { color: red } :nth-child(1) { color: blue } .x { color: green }");
+
+    std::string value1, value2;
+
+    css.computeStyle(tag).getOptionValue("color", value1);
+
+    counts.check(css.replaceDeclarations(0, "color: green"), "replace .x");
+
+    css.computeStyle(tag).getOptionValue("color", value2);
+
+    counts.check(value1 == "green" && value2 == "green",
+                 "replaced color '" + value2 + "', expected 'green'");
+  }
+
+  // fetching a rule does not move its declarations after a later rule
+  {
+    TestTagP root = std::make_shared<TestTag>("a");
+    TestTagP tag  = std::make_shared<TestTag>("b");
+
+    tag->addClass("x");
+
+    root->addChild(tag);
+
+    CCSS css;
+
+    css.processLine(".x { color: red } :nth-child(1) { width: 2 }");
+
+    std::vector<CCSS::SelectorList> selectorLists;
+
+    css.getSelectors(selectorLists);
+
+    css.getStyleData(selectorLists[0]);
+
+    counts.check(css.replaceDeclarations(0, "width: 1"), "replace .x");
+
+    std::string value;
+
+    css.computeStyle(tag).getOptionValue("width", value);
+
+    counts.check(value == "2", "fetched rule width '" + value + "', expected '2'");
+  }
+
+  TestRandom random(seed);
+
+  for (uint iter = 0; iter < iterations; ++iter) {
+    TestTagP root = generateTree(random, 20 + random.next(60));
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    // few selectors and properties so rules are merged and declarations compete
+    std::vector<std::string> selectors;
+
+    for (uint i = 0; i < 4; ++i)
+      selectors.push_back(generateSelector(random));
+
+    std::string text;
+
+    for (uint i = 0; i < 12; ++i) {
+      const std::string &selector = selectors[random.next(uint(selectors.size()))];
+
+      text += selector + " {" + generateDeclarations(random, i) + " }\n";
+    }
+
+    CCSS css;
+
+    css.processLine(text);
+
+    std::vector<std::string> expected = computeStyles(css, tags);
+
+    for (CCSS::RuleHandle handle = 0; css.getRule(handle); ++handle) {
+      std::ostringstream ss;
+
+      for (const auto &opt : css.getRule(handle)->getOptions()) {
+        opt.print(ss);
+
+        ss << " ";
+      }
+
+      counts.check(css.replaceDeclarations(handle, ss.str()), "replace '" + ss.str() + "'");
+
+      counts.check(computeStyles(css, tags) == expected, "replace rule " +
+                   std::to_string(handle) + " '" + ss.str() + "' changed styles of\n" +
+                   text);
+    }
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+
+// rules inserted, removed and replaced by handle must give the same computed styles as
+// parsing the edited stylesheet text
+uint
+testRuleHandles(uint32_t seed, uint iterations)
+{
+  TestCounts counts("ruleHandles");
+
+  TestRandom random(seed);
+
+  for (uint iter = 0; iter < iterations; ++iter) {
+    TestTagP root = generateTree(random, 20 + random.next(60));
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    // text of each inserted rule (empty if removed)
+    struct RuleText {
+      CCSS::RuleHandle handle { 0 };
+      std::string      selector;
+      std::string      declarations;
+    };
+
+    std::vector<RuleText> ruleTexts;
+
+    CCSS css;
+
+    // few selectors so inserted rules have the same selector list as other rules
+    std::vector<std::string> selectors;
+
+    for (uint i = 0; i < 5; ++i)
+      selectors.push_back(generateSelector(random));
+
+    for (uint i = 0; i < 30; ++i) {
+      uint op = (ruleTexts.empty() ? 0 : random.next(3));
+
+      if      (op == 0) {
+        RuleText ruleText;
+
+        ruleText.selector     = selectors[random.next(uint(selectors.size()))];
+        ruleText.declarations = generateDeclarations(random, i);
+
+        CCSS::RuleHandles handles;
+
+        counts.check(css.insertRule(ruleText.selector + " {" + ruleText.declarations + " }",
+                                    handles) && handles.size() == 1, "insert rule");
+
+        ruleText.handle = (! handles.empty() ? handles[0] : 0);
+
+        ruleTexts.push_back(ruleText);
+      }
+      else if (op == 1) {
+        RuleText &ruleText = ruleTexts[random.next(uint(ruleTexts.size()))];
+
+        bool removed = ruleText.selector.empty();
+
+        counts.check(css.removeRule(ruleText.handle) != removed, "remove rule");
+
+        ruleText.selector.clear();
+      }
+      else {
+        RuleText &ruleText = ruleTexts[random.next(uint(ruleTexts.size()))];
+
+        if (ruleText.selector.empty())
+          continue;
+
+        ruleText.declarations = generateDeclarations(random, i);
+
+        counts.check(css.replaceDeclarations(ruleText.handle, ruleText.declarations),
+                     "replace declarations");
+      }
+
+      std::string text;
+
+      for (const auto &ruleText : ruleTexts)
+        if (! ruleText.selector.empty())
+          text += ruleText.selector + " {" + ruleText.declarations + " }\n";
+
+      CCSS css1;
+
+      css1.processLine(text);
+
+      counts.check(computeStyles(css, tags) == computeStyles(css1, tags),
+                   "computed styles differ from parsed stylesheet\n" + text);
+    }
+  }
+
+  counts.print();
+
+  return counts.failures();
+}
+
+// save and load of binary stylesheet must give the same rules and styles and the
+// mapped binary stylesheet must match the same rules as the saved stylesheet
+uint
+testBinary(uint32_t seed, uint iterations)
+{
+  TestCounts counts("binary");
+
+  TestRandom random(seed);
+
+  std::string filename = "CCSSMatchTest.ccssb";
+
+  // print of rule of binary stylesheet
+  auto binaryRuleString = [](const CCSSBinaryStyleSheet &sheet, uint ind) {
+    CCSS::SelectorList selectorList;
+    CCSS::OptionList   options;
+    uint               declOrder;
+
+    if (! sheet.getRule(ind, selectorList, options, declOrder))
+      return std::string("<invalid>");
+
+    CCSS::StyleData styleData(selectorList);
+
+    styleData.setOptions(options);
+
+    std::ostringstream ss;
+
+    ss << styleData;
+
+    return ss.str();
+  };
+
+  for (uint iter = 0; iter < iterations; ++iter) {
+    TestTagP root = generateTree(random, 20 + random.next(60));
+
+    std::vector<TestTagP> tags;
+
+    getTags(root, tags);
+
+    std::string text = generateStyleSheet(random, 20);
+
+    CCSS css;
+
+    css.processLine(text);
+
+    // inserted rules may have same selector list as other rules
+    CCSS::RuleHandles handles;
+
+    css.insertRule(generateSelector(random) + " { p0: 2 }", handles);
+
+    std::vector<CCSS::SelectorList> selectorLists;
+
+    css.getSelectors(selectorLists);
+
+    css.insertRule(selectorLists[random.next(uint(selectorLists.size()))].toString() +
+                   " { p1: 3 }", handles);
+
+    css.removeRule(random.next(20));
+
+    if (! css.saveBinary(filename)) {
+      counts.check(false, "save binary");
+      break;
+    }
+
+    CCSS css1;
+
+    counts.check(css1.loadBinary(filename), "load binary");
+
+    std::ostringstream ss, ss1;
+
+    css .print(ss );
+    css1.print(ss1);
+
+    counts.check(ss.str() == ss1.str(), "loaded rules differ\n" + ss1.str() +
+                 "expected\n" + ss.str());
+
+    counts.check(computeStyles(css1, tags) == computeStyles(css, tags),
+                 "loaded computed styles differ");
+
+    //---
+
+    // matched in place
+    CCSSBinaryStyleSheet sheet;
+
+    if (! sheet.loadFile(filename)) {
+      counts.check(false, "map binary");
+      break;
+    }
+
+    std::ostringstream ss2;
+
+    sheet.print(ss2);
+
+    counts.check(ss2.str() == ss.str(), "mapped rules differ\n" + ss2.str() +
+                 "expected\n" + ss.str());
+
+    for (const auto &type : treeTypes) {
+      for (const auto &tag : tags) {
+        CCSSTagDataP data = tagData(tag, type);
+
+        CCSS::StyleDataArray               styles;
+        CCSSBinaryStyleSheet::RuleIndices rules;
+
+        css  .matchRules(data, styles);
+        sheet.matchRules(data, rules);
+
+        std::string expected, result;
+
+        for (const auto &styleData : styles) {
+          std::ostringstream ss3;
+
+          ss3 << *styleData;
+
+          expected += ss3.str() + "\n";
+        }
+
+        for (const auto &ind : rules)
+          result += binaryRuleString(sheet, ind) + "\n";
+
+        counts.check(result == expected, std::string("mapped rules of ") +
+                     tag->name() + " (" + treeTypeName(type) + ")\n" + result +
+                     "expected\n" + expected);
+
+        CCSS::ComputedStyle style, style1;
+
+        css  .computeStyle(data, style);
+        sheet.computeStyle(data, style1);
+
+        std::ostringstream ss4, ss5;
+
+        ss4 << style;
+        ss5 << style1;
+
+        counts.check(ss5.str() == ss4.str(), "mapped computed style " + ss5.str() +
+                     " expected " + ss4.str());
+      }
+    }
+
+    //---
+
+    // binary added to existing rules
+    std::string text2 = generateStyleSheet(random, 5);
+
+    CCSS css2, css3;
+
+    css2.processLine(text2);
+    css2.processLine(text);
+
+    css3.processLine(text2);
+
+    CCSS css4;
+
+    css4.processLine(text);
+
+    css4.saveBinary(filename);
+
+    counts.check(css3.loadBinary(filename), "load binary into stylesheet");
+
+    counts.check(computeStyles(css3, tags) == computeStyles(css2, tags),
+                 "merged computed styles differ");
+  }
+
+  // attribute values are matched without being interned as names
+  {
+    CCSS css;
+
+    css.processLine("a[t=\"binary-attr-value\"] { c: d }");
+
+    css.saveBinary(filename);
+
+    CCSSBinaryStyleSheet sheet;
+
+    counts.check(sheet.loadFile(filename), "map attribute binary");
+
+    TestTagP tag = std::make_shared<TestTag>("a");
+
+    tag->setAttr("t", "binary-attr-value");
+
+    CCSSBinaryStyleSheet::RuleIndices rules;
+
+    sheet.matchRules(tag, rules);
+
+    counts.check(rules.size() == 1, "mapped attribute rule");
+
+    counts.check(CCSSAtom::find("binary-attr-value").empty(), "attribute value interned");
+  }
+
+  // corrupt file is rejected by load (but mapped sheet only checks header)
+  {
+    CCSS css;
+
+    css.processLine("a b { c: d }");
+
+    css.saveBinary(filename);
+
+    std::string data;
+
+    {
+      std::ifstream is(filename, std::ios::binary);
+
+      std::ostringstream ss;
+
+      ss << is.rdbuf();
+
+      data = ss.str();
+    }
+
+    // point first selector of first rule past end of words
+    CCSSBinaryStyleSheet::Header header;
+
+    memcpy(&header, data.data(), sizeof(header));
+
+    std::size_t wordsPos = sizeof(header) + (header.numStrings + 1)*sizeof(uint32_t);
+
+    uint32_t selectorsPos, badPos = header.numWords;
+
+    memcpy(&selectorsPos, &data[wordsPos], sizeof(uint32_t));
+
+    memcpy(&data[wordsPos + (selectorsPos + 1)*sizeof(uint32_t)], &badPos, sizeof(uint32_t));
+
+    {
+      std::ofstream os(filename, std::ios::binary | std::ios::trunc);
+
+      os << data;
+    }
+
+    CCSS css1;
+
+    counts.check(! css1.loadBinary(filename), "corrupt binary loaded");
+
+    CCSSBinaryStyleSheet sheet;
+
+    counts.check(sheet.loadFile(filename), "map corrupt binary");
+
+    TestTagP root = std::make_shared<TestTag>("a");
+
+    root->addChild(std::make_shared<TestTag>("b"));
+
+    CCSSBinaryStyleSheet::RuleIndices rules;
+
+    sheet.matchRules(root->children()[0], rules);
+
+    counts.check(rules.empty(), "corrupt binary matched");
+  }
+
+  std::remove(filename.c_str());
+
+  counts.print();
+
+  return counts.failures();
+}
+}
+
+//------
+
+int
+main(int argc, char **argv)
+{
+  uint32_t seed       = 1;
+  uint     iterations = 100;
+
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') {
+      if      (strcmp(&argv[i][1], "seed") == 0) {
+        ++i;
+
+        if (i < argc)
+          seed = uint32_t(atoi(argv[i]));
+      }
+      else if (strcmp(&argv[i][1], "iterations") == 0) {
+        ++i;
+
+        if (i < argc)
+          iterations = uint(atoi(argv[i]));
+      }
+      else if (strcmp(&argv[i][1], "help") == 0) {
+        std::cerr << "Usage: CCSSMatchTest [-seed <n>] [-iterations <n>]\n";
+        exit(0);
+      }
+      else
+        std::cerr << "Invalid option: " << argv[i] << std::endl;
+    }
+  }
+
+  uint failures = 0;
+
+  failures += testNthExpr      ();
+  failures += testStreamParser (seed, iterations);
+  failures += testDiagnostics  ();
+  failures += testComputeStyle ();
+  failures += testParallelParse(seed, iterations);
+  failures += testMatchRules   (seed, iterations);
+  failures += testMatchContext (seed, iterations);
+  failures += testTagNode      (seed, iterations);
+  failures += testAdapter      (seed, iterations);
+  failures += testMatchCache   ();
+  failures += testRuleStats    ();
+  failures += testQuery        (seed, iterations);
+  failures += testStyleTree    (seed, iterations);
+  failures += testInvalidation (seed, iterations);
+  failures += testReplace      (seed, iterations);
+  failures += testRuleHandles  (seed, iterations);
+  failures += testBinary       (seed, iterations);
+
+  return (failures > 0 ? 1 : 0);
+}
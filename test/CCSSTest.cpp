@@ -5,6 +5,7 @@ int
 main(int argc, char **argv)
 {
   std::string filename;
+  std::string binaryFilename;
 
   bool debug       = false;
   bool style       = false;
@@ -18,8 +19,15 @@ main(int argc, char **argv)
         style = true;
       else if (strcmp(&argv[i][1], "specificity") == 0)
         specificity = true;
+      else if (strcmp(&argv[i][1], "binary") == 0) {
+        ++i;
+
+        if (i < argc)
+          binaryFilename = argv[i];
+      }
       else if (strcmp(&argv[i][1], "help") == 0) {
-        std::cerr << "Usage: CCSSTest [-debug] [-style] [-specificity] <file>\n";
+        std::cerr << "Usage: CCSSTest [-debug] [-style] [-specificity] "
+                     "[-binary <file>] <file>\n";
         exit(0);
       }
       else
@@ -38,6 +46,11 @@ main(int argc, char **argv)
 
   css.processFile(filename);
 
+  if (! binaryFilename.empty()) {
+    if (! css.saveBinary(binaryFilename))
+      exit(1);
+  }
+
   if (specificity) {
     std::vector<CCSS::SelectorList> selectorListArray;
 